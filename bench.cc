@@ -0,0 +1,745 @@
+// Headless benchmark of the Life engines over a set of RLE patterns.
+//
+// Usage: bench [--generations N] [--time-limit SECONDS] [--threads N] [--engines A,B,...]
+//              [--step N] [--rule RULE] [--stats] [--format csv|json] [--no-fork]
+//              [--memory-budget KB] [pattern.rle ...]
+//        bench --verify [--generations N] [--seed N] [options above] [pattern.rle ...]
+//        bench --kernels [--engines A,B,...] [--rule RULE]
+//
+// Without patterns, every .rle file in the rle directory is run. --step advances N generations
+// per Step(N) call instead of one. --rule runs every pattern under RULE, e.g. B36/S23, instead
+// of the rule in its file. --stats prints the StepStats of every step to stderr, which slows
+// the steps down. --memory-budget has BlockLife spill cold blocks to disk past KB kilobytes of
+// blocks. Each pattern and engine pair
+// runs in its own process so that the reported peak RSS belongs to that run alone. Patterns
+// whose rule has a torus, e.g. B3/S23:T4096,4096, only run on DenseTorusLife, and the other
+// patterns only on the other engines.
+//
+// --verify checks the engines against the first one, LiveLife unless --engines says otherwise,
+// instead of timing them: every engine runs each pattern and a set of random soups, which sit
+// across block boundaries and across the wrapping edges of the int64 plane, and their live
+// cells are compared after every Step. Soups on small tori compare DenseTorusLife with a
+// simple reference that steps cell by cell. Exits with 1 on the first mismatch of each case.
+//
+// --kernels times the per-block kernel of each engine that has one on empty, sparse, dense and
+// border-only blocks, printing nanoseconds per 64x64 block.
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <limits>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <random>
+#include <set>
+#include <string>
+#include <vector>
+
+#include <dirent.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "distributed.h"
+#include "life.h"
+#include "rle.h"
+
+namespace {
+
+bool OnPlane(const conway::Torus& torus) {
+    return !torus.bounded();
+}
+
+struct Engine {
+    const char* name;
+    // Whether the engine runs on torus.
+    std::function<bool(const conway::Torus& torus)> runs;
+    std::function<conway::Life*(int threads, const conway::Torus& torus)> create;
+};
+
+const Engine ENGINES[] = {
+    {"LiveLife", OnPlane, [](int threads, const conway::Torus& torus) { return new conway::LiveLife(); }},
+    {"BlockLife", OnPlane, [](int threads, const conway::Torus& torus) {
+        conway::BlockLife* life = new conway::BlockLife();
+        life->set_num_threads(threads);
+        return life;
+    }},
+    {"BitBlockLife", OnPlane, [](int threads, const conway::Torus& torus) { return new conway::BitBlockLife(); }},
+    {"HybridLife", OnPlane, [](int threads, const conway::Torus& torus) { return new conway::HybridLife(); }},
+    {"HashLife", OnPlane, [](int threads, const conway::Torus& torus) { return new conway::HashLife(); }},
+    // One worker process per thread, and at least two so that halos are exchanged.
+    {"DistributedLife", OnPlane, [](int threads, const conway::Torus& torus) {
+        return new conway::DistributedLife(std::max(2, threads));
+    }},
+    {"DenseTorusLife", conway::DenseTorusLife::Fits, [](int threads, const conway::Torus& torus) {
+        conway::DenseTorusLife* life = new conway::DenseTorusLife(torus);
+        life->set_num_threads(threads);
+        return life;
+    }},
+};
+
+// Steps a torus one cell at a time, as the reference for DenseTorusLife in --verify.
+class TorusReference : public conway::Life {
+    public:
+    explicit TorusReference(const conway::Torus& torus) : torus_(torus) {}
+
+    conway::Torus torus() const override { return torus_; }
+
+    void AddLivePoint(const conway::Point& p) override { cells_.insert(Wrap(p.x, p.y)); }
+
+    std::vector<conway::Point> LivePoints() override {
+        return std::vector<conway::Point>(cells_.begin(), cells_.end());
+    }
+
+    void VisitLivePoints(const conway::Range& x_range, const conway::Range& y_range,
+                         conway::LivePointVisitor* visitor) override {
+        for (const conway::Point& p : cells_) {
+            if (p.x >= x_range.first && p.x <= x_range.second && p.y >= y_range.first && p.y <= y_range.second) {
+                visitor->Visit(p.x, p.y);
+            }
+        }
+    }
+
+    size_t TableSize() override { return cells_.size(); }
+
+    protected:
+    void DoStep() override {
+        std::map<conway::Point, int, PointLess> neighbors;
+        for (const conway::Point& p : cells_) {
+            for (int64_t dy = -1; dy <= 1; dy++) {
+                for (int64_t dx = -1; dx <= 1; dx++) {
+                    if (dx != 0 || dy != 0) {
+                        neighbors[Wrap(p.x + dx, p.y + dy)]++;
+                    }
+                }
+            }
+        }
+        std::set<conway::Point, PointLess> next;
+        for (const auto& entry : neighbors) {
+            uint16_t counts = cells_.count(entry.first) ? rule_.survival : rule_.birth;
+            if ((counts >> entry.second) & 1) {
+                next.insert(entry.first);
+            }
+        }
+        cells_.swap(next);
+    }
+
+    void CollectStats(conway::StepStats* stats) override { stats->live_cells = cells_.size(); }
+
+    private:
+    struct PointLess {
+        bool operator()(const conway::Point& a, const conway::Point& b) const {
+            return a.y != b.y ? a.y < b.y : a.x < b.x;
+        }
+    };
+
+    // Cells are kept in the coordinates DenseTorusLife uses, which center the torus on the
+    // origin.
+    conway::Point Wrap(int64_t x, int64_t y) const {
+        int64_t x0 = -(torus_.width / 2);
+        int64_t y0 = -(torus_.height / 2);
+        __int128 dx = (static_cast<__int128>(x) - x0) % torus_.width;
+        __int128 dy = (static_cast<__int128>(y) - y0) % torus_.height;
+        return conway::Point(x0 + static_cast<int64_t>(dx < 0 ? dx + torus_.width : dx),
+                             y0 + static_cast<int64_t>(dy < 0 ? dy + torus_.height : dy));
+    }
+
+    conway::Torus torus_;
+    std::set<conway::Point, PointLess> cells_;
+};
+
+struct Options {
+    int64_t generations = 1000;
+    double time_limit = 60;
+    int threads = 1;
+    int64_t step = 1;
+    bool has_rule = false;
+    conway::Rule rule;
+    conway::Torus torus;
+    bool stats = false;
+    bool verify = false;
+    bool kernels = false;
+    uint64_t seed = 1;
+    bool json = false;
+    bool fork = true;
+    uint64_t memory_budget_kb = 0;
+    std::vector<std::string> engines;
+    std::vector<std::string> patterns;
+};
+
+// Sent from the process running a benchmark back to the parent, so it must stay plain data.
+struct Result {
+    int64_t generations;
+    double seconds;
+    double load_seconds;
+    uint64_t population_start;
+    uint64_t population_end;
+    // Average of the population sampled across the run.
+    double population_average;
+    uint64_t peak_rss_kb;
+    uint64_t table_size;
+};
+
+double SecondsSince(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+uint64_t PeakRssKb() {
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+#ifdef __APPLE__
+    return usage.ru_maxrss / 1024;
+#else
+    return usage.ru_maxrss;
+#endif
+}
+
+// The torus a pattern runs on: the one of --rule if given, else the one of the file's rule.
+conway::Torus PatternTorus(const std::string& pattern, const Options& options) {
+    if (options.has_rule) {
+        return options.torus;
+    }
+    conway::RLEHeader header;
+    conway::Rule rule;
+    conway::Torus torus;
+    if (conway::ReadRLEHeader(pattern, &header) && !header.rule.empty()) {
+        conway::ParseRule(header.rule, &rule, &torus);
+    }
+    return torus;
+}
+
+// Applies --memory-budget to the engines that spill blocks.
+void SetMemoryBudget(conway::Life* life, const Options& options) {
+    conway::BlockLife* block_life = dynamic_cast<conway::BlockLife*>(life);
+    if (block_life != nullptr && options.memory_budget_kb > 0) {
+        block_life->set_memory_budget(options.memory_budget_kb << 10);
+    }
+}
+
+// Returns false, leaving result alone, if the pattern can't be loaded into the engine.
+bool Run(const Engine& engine, const std::string& pattern, const Options& options, Result* out) {
+    Result result;
+    std::unique_ptr<conway::Life> life(engine.create(options.threads, PatternTorus(pattern, options)));
+    SetMemoryBudget(life.get(), options);
+    auto start = std::chrono::steady_clock::now();
+    if (!conway::LoadRLE(pattern, life.get())) {
+        std::cerr << "Could not load " << pattern << " into " << engine.name << std::endl;
+        return false;
+    }
+    if (options.has_rule) {
+        life->set_rule(options.rule);
+    }
+    life->set_stats_enabled(options.stats);
+    result.load_seconds = SecondsSince(start);
+    result.population_start = life->LivePoints().size();
+
+    // Sample the population a few times outside of the timed region.
+    const int64_t samples = 16;
+    int64_t sample_every = std::max<int64_t>(1, options.generations / samples);
+    double population_sum = result.population_start;
+    int64_t population_samples = 1;
+    result.seconds = 0;
+    result.generations = 0;
+    while (result.generations < options.generations && result.seconds < options.time_limit) {
+        int64_t steps = std::min(sample_every, options.generations - result.generations);
+        start = std::chrono::steady_clock::now();
+        for (int64_t i = 0; i < steps; i += options.step) {
+            life->Step(std::min(options.step, steps - i));
+            if (options.stats) {
+                std::cerr << pattern << " " << engine.name << " " << conway::FormatStats(life->stats()) << "\n";
+            }
+        }
+        result.seconds += SecondsSince(start);
+        result.generations += steps;
+        population_sum += life->LivePoints().size();
+        population_samples++;
+    }
+    result.population_end = life->LivePoints().size();
+    result.population_average = population_sum / population_samples;
+    result.table_size = life->TableSize();
+    result.peak_rss_kb = PeakRssKb();
+    *out = result;
+    return true;
+}
+
+// Runs the benchmark in a child process and reads the result back over a pipe.
+bool RunInChild(const Engine& engine, const std::string& pattern, const Options& options, Result* result) {
+    int fds[2];
+    if (pipe(fds) != 0) {
+        return false;
+    }
+    // Otherwise the child would write out the parent's buffered output again.
+    std::cout.flush();
+    pid_t pid = fork();
+    if (pid < 0) {
+        close(fds[0]);
+        close(fds[1]);
+        return false;
+    }
+    if (pid == 0) {
+        close(fds[0]);
+        Result r;
+        if (!Run(engine, pattern, options, &r)) {
+            _exit(1);
+        }
+        ssize_t written = write(fds[1], &r, sizeof(r));
+        _exit(written == sizeof(r) ? 0 : 1);
+    }
+    close(fds[1]);
+    ssize_t got = read(fds[0], result, sizeof(*result));
+    close(fds[0]);
+    int status;
+    waitpid(pid, &status, 0);
+    return got == sizeof(*result) && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+std::vector<std::string> ListPatterns(const std::string& dir) {
+    std::vector<std::string> patterns;
+    DIR* d = opendir(dir.c_str());
+    if (d == nullptr) {
+        return patterns;
+    }
+    while (struct dirent* entry = readdir(d)) {
+        std::string name = entry->d_name;
+        if (name.size() > 4 && name.compare(name.size() - 4, 4, ".rle") == 0) {
+            patterns.push_back(dir + "/" + name);
+        }
+    }
+    closedir(d);
+    std::sort(patterns.begin(), patterns.end());
+    return patterns;
+}
+
+std::vector<std::string> Split(const std::string& s, char separator) {
+    std::vector<std::string> parts;
+    size_t start = 0;
+    while (start <= s.size()) {
+        size_t end = s.find(separator, start);
+        if (end == std::string::npos) {
+            end = s.size();
+        }
+        if (end > start) {
+            parts.push_back(s.substr(start, end - start));
+        }
+        start = end + 1;
+    }
+    return parts;
+}
+
+void PrintUsage() {
+    std::cerr << "Usage: bench [--generations N] [--time-limit SECONDS] [--threads N] [--engines A,B,...]\n"
+              << "             [--step N] [--rule RULE] [--stats] [--format csv|json] [--no-fork]\n"
+              << "             [--memory-budget KB] [pattern.rle ...]\n"
+              << "       bench --verify [--generations N] [--seed N] [options above] [pattern.rle ...]\n"
+              << "       bench --kernels [--engines A,B,...] [--rule RULE]\n"
+              << "Engines:";
+    for (const Engine& engine : ENGINES) {
+        std::cerr << " " << engine.name;
+    }
+    std::cerr << std::endl;
+}
+
+bool ParseOptions(int argc, char** argv, Options* options) {
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        bool has_value = i + 1 < argc;
+        if (arg == "--generations" && has_value) {
+            options->generations = std::atoll(argv[++i]);
+        } else if (arg == "--time-limit" && has_value) {
+            options->time_limit = std::atof(argv[++i]);
+        } else if (arg == "--threads" && has_value) {
+            options->threads = std::atoi(argv[++i]);
+        } else if (arg == "--step" && has_value) {
+            options->step = std::max<int64_t>(1, std::atoll(argv[++i]));
+        } else if (arg == "--rule" && has_value) {
+            if (!conway::ParseRule(argv[++i], &options->rule, &options->torus)) {
+                return false;
+            }
+            options->has_rule = true;
+        } else if (arg == "--engines" && has_value) {
+            options->engines = Split(argv[++i], ',');
+        } else if (arg == "--format" && has_value) {
+            std::string format = argv[++i];
+            if (format != "csv" && format != "json") {
+                return false;
+            }
+            options->json = format == "json";
+        } else if (arg == "--stats") {
+            options->stats = true;
+        } else if (arg == "--verify") {
+            options->verify = true;
+        } else if (arg == "--kernels") {
+            options->kernels = true;
+        } else if (arg == "--seed" && has_value) {
+            options->seed = std::strtoull(argv[++i], nullptr, 10);
+        } else if (arg == "--no-fork") {
+            options->fork = false;
+        } else if (arg == "--memory-budget" && has_value) {
+            options->memory_budget_kb = std::strtoull(argv[++i], nullptr, 10);
+        } else if (!arg.empty() && arg[0] != '-') {
+            options->patterns.push_back(arg);
+        } else {
+            return false;
+        }
+    }
+    for (const std::string& name : options->engines) {
+        bool known = false;
+        for (const Engine& engine : ENGINES) {
+            known |= name == engine.name;
+        }
+        if (!known) {
+            std::cerr << "Unknown engine: " << name << std::endl;
+            return false;
+        }
+    }
+    if (options->engines.empty()) {
+        for (const Engine& engine : ENGINES) {
+            options->engines.push_back(engine.name);
+        }
+    }
+    if (options->patterns.empty()) {
+        options->patterns = ListPatterns("rle");
+    }
+    return true;
+}
+
+const Engine* FindEngine(const std::string& name) {
+    for (const Engine& engine : ENGINES) {
+        if (name == engine.name) {
+            return &engine;
+        }
+    }
+    return nullptr;
+}
+
+// Returns nullptr if the engine doesn't run on torus.
+std::unique_ptr<conway::Life> CreateLife(const Engine& engine, const Options& options, const conway::Torus& torus) {
+    if (!engine.runs(torus)) {
+        return nullptr;
+    }
+    std::unique_ptr<conway::Life> life(engine.create(options.threads, torus));
+    SetMemoryBudget(life.get(), options);
+    if (options.has_rule) {
+        life->set_rule(options.rule);
+    }
+    return life;
+}
+
+std::vector<conway::Point> SortedLivePoints(conway::Life* life) {
+    std::vector<conway::Point> points = life->LivePoints();
+    std::sort(points.begin(), points.end(), [](const conway::Point& a, const conway::Point& b) {
+        return a.y != b.y ? a.y < b.y : a.x < b.x;
+    });
+    return points;
+}
+
+// The tiles of level over the whole plane, as (x, y, live cells), sorted.
+std::vector<std::array<int64_t, 3>> SortedDensity(conway::Life* life, int level) {
+    class Collector : public conway::DensityVisitor {
+        public:
+        void Visit(int64_t x, int64_t y, uint64_t live_cells) override {
+            tiles.push_back({{x, y, static_cast<int64_t>(live_cells)}});
+        }
+        std::vector<std::array<int64_t, 3>> tiles;
+    } collector;
+    conway::Range everything(std::numeric_limits<int64_t>::min(), std::numeric_limits<int64_t>::max());
+    life->VisitDensity(level, everything, everything, &collector);
+    std::sort(collector.tiles.begin(), collector.tiles.end());
+    return collector.tiles;
+}
+
+// Random cells in a size x size square from corner, wrapping around the edges of the plane.
+std::vector<conway::Point> Soup(const conway::Point& corner, int size, double density, std::mt19937_64* rng) {
+    std::vector<conway::Point> cells;
+    std::bernoulli_distribution alive(density);
+    for (int y = 0; y < size; y++) {
+        for (int x = 0; x < size; x++) {
+            if (alive(*rng)) {
+                cells.emplace_back(static_cast<int64_t>(static_cast<uint64_t>(corner.x) + x),
+                                   static_cast<int64_t>(static_cast<uint64_t>(corner.y) + y));
+            }
+        }
+    }
+    return cells;
+}
+
+// Loads the case into every engine that runs on torus with load, then steps them side by side
+// and compares their live cells, and their tiles at a few density levels, with the first
+// engine's after every Step. On a bounded torus the first engine is a TorusReference. Returns
+// false on a mismatch.
+bool VerifyCase(const std::string& name, const Options& options, const conway::Torus& torus,
+                std::function<bool(conway::Life*)> load) {
+    std::vector<std::unique_ptr<conway::Life>> lives;
+    std::vector<std::string> names;
+    if (torus.bounded()) {
+        lives.emplace_back(new TorusReference(torus));
+        if (options.has_rule) {
+            lives.back()->set_rule(options.rule);
+        }
+        names.push_back("TorusReference");
+    }
+    for (const std::string& engine : options.engines) {
+        std::unique_ptr<conway::Life> life = CreateLife(*FindEngine(engine), options, torus);
+        if (life) {
+            lives.push_back(std::move(life));
+            names.push_back(engine);
+        }
+    }
+    if (lives.size() < 2) {
+        std::cout << "skipped " << name << ", which fewer than two engines run" << std::endl;
+        return true;
+    }
+    for (auto& life : lives) {
+        if (!load(life.get())) {
+            std::cerr << "Could not load " << name << std::endl;
+            return false;
+        }
+    }
+    for (int64_t generation = 0; generation <= options.generations;) {
+        std::vector<conway::Point> expected = SortedLivePoints(lives[0].get());
+        for (size_t i = 1; i < lives.size(); i++) {
+            std::vector<conway::Point> actual = SortedLivePoints(lives[i].get());
+            if (actual == expected && lives[i]->generation() == lives[0]->generation()) {
+                continue;
+            }
+            std::cout << "MISMATCH " << name << " " << names[i] << " vs " << names[0]
+                      << " at generation " << generation << ": " << actual.size() << " vs " << expected.size()
+                      << " live cells";
+            size_t j = 0;
+            while (j < actual.size() && j < expected.size() && actual[j] == expected[j]) {
+                j++;
+            }
+            if (j < actual.size() || j < expected.size()) {
+                const conway::Point& p = j < actual.size() ? actual[j] : expected[j];
+                std::cout << ", first difference at (" << p.x << ", " << p.y << ")";
+            }
+            std::cout << std::endl;
+            return false;
+        }
+        // Levels below, at and above the block sizes, as drawn zoomed out.
+        for (int level : {3, 6, 9, 40}) {
+            std::vector<std::array<int64_t, 3>> expected_tiles = SortedDensity(lives[0].get(), level);
+            for (size_t i = 1; i < lives.size(); i++) {
+                std::vector<std::array<int64_t, 3>> actual_tiles = SortedDensity(lives[i].get(), level);
+                if (actual_tiles != expected_tiles) {
+                    std::cout << "MISMATCH " << name << " " << names[i] << " vs " << names[0] << " at generation "
+                              << generation << ": " << actual_tiles.size() << " vs " << expected_tiles.size()
+                              << " tiles of level " << level << std::endl;
+                    return false;
+                }
+            }
+        }
+        if (generation == options.generations) {
+            break;
+        }
+        int64_t steps = std::min(options.step, options.generations - generation);
+        for (auto& life : lives) {
+            life->Step(steps);
+        }
+        generation += steps;
+    }
+    std::cout << "ok " << name << std::endl;
+    return true;
+}
+
+int Verify(const Options& options) {
+    int failures = 0;
+    for (const std::string& pattern : options.patterns) {
+        failures += !VerifyCase(pattern, options, PatternTorus(pattern, options),
+                                [&](conway::Life* life) { return conway::LoadRLE(pattern, life); });
+    }
+    // Soups straddling the boundaries of both 32 and 64 cell blocks, and the wrapping edges of
+    // the plane, where neighbor coordinates overflow.
+    const int64_t MAX = std::numeric_limits<int64_t>::max();
+    const int64_t MIN = std::numeric_limits<int64_t>::min();
+    const conway::Point corners[] = {
+        {0, 0}, {-32, -32}, {-21, 45}, {97, -70}, {MAX - 30, 0}, {0, MAX - 30}, {MAX - 30, MAX - 30},
+        {MIN, MIN}, {MAX - 63, MIN + 2},
+    };
+    const double densities[] = {0.1, 0.35, 0.6};
+    std::mt19937_64 rng(options.seed);
+    for (const conway::Point& corner : corners) {
+        for (double density : densities) {
+            std::vector<conway::Point> cells = Soup(corner, 64, density, &rng);
+            char name[128];
+            snprintf(name, sizeof(name), "soup(%lld,%lld,%.2f)", static_cast<long long>(corner.x),
+                     static_cast<long long>(corner.y), density);
+            failures += !VerifyCase(name, options, options.torus, [&](conway::Life* life) {
+                for (const conway::Point& p : cells) {
+                    life->AddLivePoint(p);
+                }
+                return true;
+            });
+        }
+    }
+    // Tori with partial words at the end of each row, partial bands of rows, and sides shorter
+    // than a word or than the three cells of a neighborhood. Unless --rule picks a torus, these
+    // are the only cases DenseTorusLife runs.
+    const conway::Torus tori[] = {{64, 64}, {100, 37}, {3, 200}, {130, 129}, {1, 2}};
+    for (const conway::Torus& torus : tori) {
+        for (double density : densities) {
+            std::vector<conway::Point> cells =
+                Soup(conway::Point(-torus.width / 2, -torus.height / 2), 130, density, &rng);
+            char name[128];
+            snprintf(name, sizeof(name), "torus(%lld,%lld,%.2f)", static_cast<long long>(torus.width),
+                     static_cast<long long>(torus.height), density);
+            failures += !VerifyCase(name, options, torus, [&](conway::Life* life) {
+                for (const conway::Point& p : cells) {
+                    life->AddLivePoint(p);
+                }
+                return true;
+            });
+        }
+    }
+    std::cout << (failures == 0 ? "All engines agree." : "Engines disagree.") << std::endl;
+    return failures == 0 ? 0 : 1;
+}
+
+// Runs the kernel often enough to take a measurable time and returns nanoseconds per call.
+double TimeKernel(conway::Life* life, const uint64_t* rows) {
+    for (int iterations = 16;; iterations *= 2) {
+        double seconds = life->TimeBlockKernel(rows, iterations);
+        if (seconds < 0) {
+            return seconds;
+        }
+        if (seconds > 0.2 || iterations >= (1 << 24)) {
+            return seconds * 1e9 / iterations;
+        }
+    }
+}
+
+int Kernels(const Options& options) {
+    std::mt19937_64 rng(options.seed);
+    struct Block {
+        const char* name;
+        std::array<uint64_t, 64> rows;
+    } blocks[4] = {{"empty", {{0}}}, {"sparse", {{0}}}, {"dense", {{0}}}, {"border", {{0}}}};
+    for (int y = 0; y < 64; y++) {
+        // About 1 in 16 cells, and half the cells.
+        blocks[1].rows[y] = rng() & rng() & rng() & rng();
+        blocks[2].rows[y] = rng();
+        // Only the outermost cells, half of them live.
+        uint64_t edge = y == 0 || y == 63 ? ~uint64_t(0) : (uint64_t(1) << 63) | 1;
+        blocks[3].rows[y] = rng() & edge;
+    }
+    std::cout << "engine,block,ns_per_block\n";
+    for (const std::string& name : options.engines) {
+        std::unique_ptr<conway::Life> life = CreateLife(*FindEngine(name), options, options.torus);
+        if (!life) {
+            continue;
+        }
+        for (const Block& block : blocks) {
+            double ns = TimeKernel(life.get(), block.rows.data());
+            if (ns < 0) {
+                break;
+            }
+            char line[128];
+            snprintf(line, sizeof(line), "%s,%s,%.1f\n", name.c_str(), block.name, ns);
+            std::cout << line << std::flush;
+        }
+    }
+    return 0;
+}
+
+// Quotes text for a JSON string.
+std::string JsonEscape(const std::string& text) {
+    std::string escaped;
+    for (char c : text) {
+        if (c == '"' || c == '\\') {
+            escaped += '\\';
+            escaped += c;
+        } else if (static_cast<unsigned char>(c) < 0x20) {
+            char code[8];
+            snprintf(code, sizeof(code), "\\u%04x", c);
+            escaped += code;
+        } else {
+            escaped += c;
+        }
+    }
+    return escaped;
+}
+
+void PrintResult(const Options& options, const std::string& pattern, const std::string& engine,
+                 const Result& r, bool first) {
+    double gens_per_sec = r.seconds > 0 ? r.generations / r.seconds : 0;
+    double cell_generations = r.population_average * r.generations;
+    double ns_per_cell = cell_generations > 0 ? r.seconds * 1e9 / cell_generations : 0;
+    char line[1024];
+    if (options.json) {
+        snprintf(line, sizeof(line),
+                 "%s  {\"pattern\": \"%s\", \"engine\": \"%s\", \"threads\": %d, \"generations\": %lld, "
+                 "\"seconds\": %.6f, \"load_seconds\": %.6f, \"gens_per_sec\": %.3f, \"ns_per_cell\": %.3f, "
+                 "\"population_start\": %llu, \"population_end\": %llu, \"peak_rss_kb\": %llu, \"table_size\": %llu}",
+                 first ? "" : ",\n", JsonEscape(pattern).c_str(), engine.c_str(), options.threads, (long long)r.generations,
+                 r.seconds, r.load_seconds, gens_per_sec, ns_per_cell,
+                 (unsigned long long)r.population_start, (unsigned long long)r.population_end,
+                 (unsigned long long)r.peak_rss_kb, (unsigned long long)r.table_size);
+    } else {
+        snprintf(line, sizeof(line), "%s,%s,%d,%lld,%.6f,%.6f,%.3f,%.3f,%llu,%llu,%llu,%llu\n",
+                 pattern.c_str(), engine.c_str(), options.threads, (long long)r.generations,
+                 r.seconds, r.load_seconds, gens_per_sec, ns_per_cell,
+                 (unsigned long long)r.population_start, (unsigned long long)r.population_end,
+                 (unsigned long long)r.peak_rss_kb, (unsigned long long)r.table_size);
+    }
+    std::cout << line << std::flush;
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+    Options options;
+    if (!ParseOptions(argc, argv, &options)) {
+        PrintUsage();
+        return 2;
+    }
+    if (options.kernels) {
+        return Kernels(options);
+    }
+    if (options.patterns.empty()) {
+        std::cerr << "No patterns found." << std::endl;
+        return 2;
+    }
+    if (options.verify) {
+        return Verify(options);
+    }
+
+    if (options.json) {
+        std::cout << "[\n";
+    } else {
+        std::cout << "pattern,engine,threads,generations,seconds,load_seconds,gens_per_sec,ns_per_cell,"
+                  << "population_start,population_end,peak_rss_kb,table_size\n";
+    }
+    int failures = 0;
+    bool first = true;
+    for (const std::string& pattern : options.patterns) {
+        conway::Torus torus = PatternTorus(pattern, options);
+        for (const std::string& name : options.engines) {
+            const Engine* engine = FindEngine(name);
+            if (!engine->runs(torus)) {
+                continue;
+            }
+            Result result;
+            if (options.fork) {
+                if (!RunInChild(*engine, pattern, options, &result)) {
+                    std::cerr << "Benchmark failed: " << pattern << " " << name << std::endl;
+                    failures++;
+                    continue;
+                }
+            } else if (!Run(*engine, pattern, options, &result)) {
+                failures++;
+                continue;
+            }
+            PrintResult(options, pattern, name, result, first);
+            first = false;
+        }
+    }
+    if (options.json) {
+        std::cout << "\n]" << std::endl;
+    }
+    return failures == 0 ? 0 : 1;
+}
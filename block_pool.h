@@ -0,0 +1,60 @@
+#ifndef CONWAY_BLOCK_POOL_H
+#define CONWAY_BLOCK_POOL_H
+
+#include <cstddef>
+#include <memory>
+#include <vector>
+
+namespace conway {
+
+// Hands out objects of type T from chunks of CHUNK_SIZE, keeping freed objects on a free list
+// for reuse, so that objects which come and go don't cost a heap allocation each time. Objects
+// are value-initialized once, when their chunk is allocated, and otherwise come back exactly as
+// they were freed. The pool owns every object and frees them all when destroyed. Not
+// thread-safe.
+template <typename T>
+class BlockPool {
+    public:
+    static const size_t CHUNK_SIZE = 16;
+
+    BlockPool() : size_(0), allocated_(0) {}
+
+    T* Allocate() {
+        if (free_.empty()) {
+            chunks_.emplace_back(new T[CHUNK_SIZE]());
+            T* chunk = chunks_.back().get();
+            for (size_t i = CHUNK_SIZE; i > 0; i--) {
+                free_.push_back(&chunk[i - 1]);
+            }
+        }
+        T* object = free_.back();
+        free_.pop_back();
+        size_++;
+        allocated_++;
+        return object;
+    }
+
+    void Free(T* object) {
+        free_.push_back(object);
+        size_--;
+    }
+
+    // Objects handed out and not freed.
+    size_t size() const { return size_; }
+    // Objects ready for reuse without allocating.
+    size_t free_size() const { return free_.size(); }
+    // Objects handed out so far, including the ones freed since.
+    size_t allocated() const { return allocated_; }
+    // Number of chunks allocated, i.e. heap allocations made for objects.
+    size_t chunks() const { return chunks_.size(); }
+
+    private:
+    std::vector<std::unique_ptr<T[]>> chunks_;
+    std::vector<T*> free_;
+    size_t size_;
+    size_t allocated_;
+};
+
+}  // namespace conway
+
+#endif
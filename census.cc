@@ -0,0 +1,424 @@
+#include "census.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <limits>
+#include <numeric>
+
+namespace conway {
+
+namespace {
+
+const char WECHSLER_DIGITS[] = "0123456789abcdefghijklmnopqrstuvwxyz";
+
+bool PointLess(const Point& a, const Point& b) {
+    return a.y != b.y ? a.y < b.y : a.x < b.x;
+}
+
+int64_t Gcd(int64_t a, int64_t b) {
+    while (b != 0) {
+        int64_t r = a % b;
+        a = b;
+        b = r;
+    }
+    return a;
+}
+
+int64_t Lcm(int64_t a, int64_t b) {
+    return a / Gcd(a, b) * b;
+}
+
+// Cells further apart than this can't both be neighbors of a cell, so they don't affect each
+// other in the next generation.
+const int64_t REACH = 2;
+
+int64_t FloorDiv(int64_t a, int64_t b) {
+    int64_t q = a / b;
+    return (a % b != 0 && (a < 0) != (b < 0)) ? q - 1 : q;
+}
+
+int64_t CeilDiv(int64_t a, int64_t b) {
+    return -FloorDiv(-a, b);
+}
+
+// Whether some cell of a is within REACH of some cell of b.
+bool Near(const std::vector<Point>& a, const std::vector<Point>& b) {
+    for (const Point& p : a) {
+        for (const Point& q : b) {
+            if (std::abs(p.x - q.x) <= REACH && std::abs(p.y - q.y) <= REACH) {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+// Narrows [*first, *last] to the k for which [lo, hi] moved by k * step meets [min, max].
+void NarrowMeeting(int64_t lo, int64_t hi, int64_t step, int64_t min, int64_t max, int64_t* first, int64_t* last) {
+    if (step == 0) {
+        if (hi < min || lo > max) {
+            *last = *first - 1;
+        }
+    } else if (step > 0) {
+        *first = std::max(*first, CeilDiv(min - hi, step));
+        *last = std::min(*last, FloorDiv(max - lo, step));
+    } else {
+        *first = std::max(*first, CeilDiv(max - lo, step));
+        *last = std::min(*last, FloorDiv(min - hi, step));
+    }
+}
+
+// Moves the cells so that their bounding box starts at (0, 0), and sorts them.
+std::vector<Point> Normalize(std::vector<Point> cells, Point* origin = nullptr) {
+    Point min(cells.empty() ? 0 : cells[0].x, cells.empty() ? 0 : cells[0].y);
+    for (const Point& p : cells) {
+        min.x = std::min(min.x, p.x);
+        min.y = std::min(min.y, p.y);
+    }
+    for (Point& p : cells) {
+        p = Point(p.x - min.x, p.y - min.y);
+    }
+    std::sort(cells.begin(), cells.end(), PointLess);
+    if (origin != nullptr) {
+        *origin = min;
+    }
+    return cells;
+}
+
+// Appends a run of zero columns: "0", "w" and "x" for one to three, and "y" and a digit for 4
+// to 39.
+void AppendZeros(int zeros, std::string* code) {
+    while (zeros > 0) {
+        int run = std::min(zeros, 39);
+        if (run == 1) {
+            *code += '0';
+        } else if (run == 2) {
+            *code += 'w';
+        } else if (run == 3) {
+            *code += 'x';
+        } else {
+            *code += 'y';
+            *code += WECHSLER_DIGITS[run - 4];
+        }
+        zeros -= run;
+    }
+}
+
+// Extended Wechsler format of normalized cells: strips of 5 rows separated by "z", each strip
+// one digit per column with the top row as bit 0, without trailing zero columns.
+std::string Wechsler(const std::vector<Point>& cells) {
+    int64_t width = 0;
+    int64_t height = 0;
+    for (const Point& p : cells) {
+        width = std::max(width, p.x + 1);
+        height = std::max(height, p.y + 1);
+    }
+    int64_t strips = (height + 4) / 5;
+    std::vector<uint8_t> columns(static_cast<size_t>(width * strips), 0);
+    for (const Point& p : cells) {
+        columns[static_cast<size_t>(p.y / 5 * width + p.x)] |= static_cast<uint8_t>(1 << (p.y % 5));
+    }
+    std::string code;
+    for (int64_t strip = 0; strip < strips; strip++) {
+        if (strip > 0) {
+            code += 'z';
+        }
+        int zeros = 0;
+        for (int64_t x = 0; x < width; x++) {
+            uint8_t column = columns[static_cast<size_t>(strip * width + x)];
+            if (column == 0) {
+                zeros++;
+                continue;
+            }
+            AppendZeros(zeros, &code);
+            zeros = 0;
+            code += WECHSLER_DIGITS[column];
+        }
+    }
+    return code;
+}
+
+}  // namespace
+
+std::string Apgcode(const std::vector<std::vector<Point>>& phases, bool displaced) {
+    std::string best;
+    for (const std::vector<Point>& phase : phases) {
+        for (int orientation = 0; orientation < 8; orientation++) {
+            std::vector<Point> cells;
+            cells.reserve(phase.size());
+            for (const Point& p : phase) {
+                int64_t x = (orientation & 1) ? -p.x : p.x;
+                int64_t y = (orientation & 2) ? -p.y : p.y;
+                cells.push_back((orientation & 4) ? Point(y, x) : Point(x, y));
+            }
+            std::string code = Wechsler(Normalize(cells));
+            if (best.empty() || code.size() < best.size() || (code.size() == best.size() && code < best)) {
+                best = code;
+            }
+        }
+    }
+    std::string prefix;
+    if (phases.size() == 1 && !displaced) {
+        prefix = "xs" + std::to_string(phases[0].size());
+    } else {
+        prefix = (displaced ? "xq" : "xp") + std::to_string(phases.size());
+    }
+    return prefix + "_" + best;
+}
+
+SoupRunner::SoupRunner(const Rule& rule, int64_t max_generations)
+    : rule_(rule), max_generations_(max_generations) {
+    life_.set_rule(rule);
+}
+
+SoupOutcome SoupRunner::Run() {
+    SoupOutcome outcome;
+    populations_.clear();
+    populations_.push_back(life_.Population());
+    int64_t start = life_.generation();
+    while (life_.generation() - start < max_generations_) {
+        life_.Step();
+        populations_.push_back(life_.Population());
+        if (populations_.back() == 0 ||
+            (static_cast<int64_t>(populations_.size() - 1) % CHECK_EVERY == 0 && PopulationPeriod() > 0)) {
+            // Dies out, or might have settled if every object repeats on its own.
+            if (TakeCensus(&outcome.census, &outcome.period)) {
+                outcome.stable = true;
+                break;
+            }
+        }
+    }
+    if (!outcome.stable) {
+        int64_t period;
+        TakeCensus(&outcome.census, &period);
+        outcome.period = 0;
+    }
+    outcome.generations = life_.generation() - start;
+    outcome.population = populations_.back();
+    Clear();
+    return outcome;
+}
+
+void SoupRunner::Clear() {
+    life_.Clear();
+    life_.set_rule(rule_);
+}
+
+// The population repeats with period p once the last max(CHECK_EVERY, 3p) generations each
+// match the one p generations before.
+int SoupRunner::PopulationPeriod() const {
+    size_t n = populations_.size();
+    for (int p = 1; p <= MAX_PERIOD; p++) {
+        size_t window = std::max<size_t>(CHECK_EVERY, 3 * p);
+        if (n < window + p) {
+            return 0;
+        }
+        bool repeats = true;
+        for (size_t i = n - window; i < n && repeats; i++) {
+            repeats = populations_[i] == populations_[i - p];
+        }
+        if (repeats) {
+            return p;
+        }
+    }
+    return 0;
+}
+
+std::vector<std::vector<Point>> SoupRunner::SplitIslands(const std::vector<Point>& cells) {
+    PointMap<size_t> indices;
+    for (size_t i = 0; i < cells.size(); i++) {
+        indices.emplace(cells[i], i);
+    }
+    // Union-find over the cells, with path halving.
+    std::vector<size_t> parents(cells.size());
+    std::iota(parents.begin(), parents.end(), 0);
+    auto find = [&parents](size_t i) {
+        while (parents[i] != i) {
+            parents[i] = parents[parents[i]];
+            i = parents[i];
+        }
+        return i;
+    };
+    for (size_t i = 0; i < cells.size(); i++) {
+        for (int64_t dy = -1; dy <= 1; dy++) {
+            for (int64_t dx = -1; dx <= 1; dx++) {
+                const PointMap<size_t>::value_type* neighbor = indices.find(Point(cells[i].x + dx, cells[i].y + dy));
+                if (neighbor != nullptr) {
+                    parents[find(i)] = find(neighbor->second);
+                }
+            }
+        }
+    }
+    std::vector<std::vector<Point>> islands;
+    // Position of each root's island in islands.
+    std::vector<size_t> positions(cells.size(), cells.size());
+    for (size_t i = 0; i < cells.size(); i++) {
+        size_t root = find(i);
+        if (positions[root] == cells.size()) {
+            positions[root] = islands.size();
+            islands.emplace_back();
+        }
+        islands[positions[root]].push_back(cells[i]);
+    }
+    return islands;
+}
+
+bool SoupRunner::Classify(Object* object) {
+    object->classified = false;
+    object->phases.assign(1, object->cells);
+    scratch_.Clear();
+    scratch_.set_rule(life_.rule());
+    for (const Point& p : object->cells) {
+        scratch_.AddLivePoint(p);
+    }
+    Point origin;
+    std::vector<Point> first = Normalize(object->cells, &origin);
+    for (int t = 1; t <= MAX_PERIOD; t++) {
+        scratch_.Step();
+        std::vector<Point> cells = scratch_.LivePoints();
+        Point moved;
+        std::vector<Point> phase = Normalize(cells, &moved);
+        if (phase.empty()) {
+            return false;
+        }
+        if (phase.size() == first.size() && std::equal(phase.begin(), phase.end(), first.begin())) {
+            object->displacement = Point(moved.x - origin.x, moved.y - origin.y);
+            object->apgcode = Apgcode(object->phases, !(object->displacement == Point()));
+            object->period = t;
+            object->min = object->max = object->cells[0];
+            for (const std::vector<Point>& cells : object->phases) {
+                for (const Point& p : cells) {
+                    object->min = Point(std::min(object->min.x, p.x), std::min(object->min.y, p.y));
+                    object->max = Point(std::max(object->max.x, p.x), std::max(object->max.y, p.y));
+                }
+            }
+            object->classified = true;
+            return true;
+        }
+        object->phases.push_back(std::move(cells));
+    }
+    return false;
+}
+
+bool SoupRunner::Interact(const Object& a, const Object& b) {
+    scratch_.Clear();
+    scratch_.set_rule(life_.rule());
+    for (const Object* object : {&a, &b}) {
+        for (const Point& p : object->cells) {
+            scratch_.AddLivePoint(p);
+        }
+    }
+    int64_t generations = Lcm(a.period, b.period);
+    for (int64_t t = 1; t <= generations; t++) {
+        scratch_.Step();
+        std::vector<Point> expected;
+        for (const Object* object : {&a, &b}) {
+            int64_t periods = t / object->period;
+            for (const Point& p : object->phases[t % object->period]) {
+                expected.push_back(Point(p.x + periods * object->displacement.x, p.y + periods * object->displacement.y));
+            }
+        }
+        std::vector<Point> cells = scratch_.LivePoints();
+        std::sort(expected.begin(), expected.end(), PointLess);
+        std::sort(cells.begin(), cells.end(), PointLess);
+        if (cells != expected) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool SoupRunner::SameVelocity(const Object& a, const Object& b) {
+    return a.displacement.x * b.period == b.displacement.x * a.period &&
+           a.displacement.y * b.period == b.displacement.y * a.period;
+}
+
+// Each least common multiple of the periods, the bounding box of b moves by a fixed step
+// relative to the one of a. They could collide at the k-th of those steps if the boxes then
+// come within REACH, widened by how far the objects move in between.
+bool SoupRunner::MayCollide(const Object& a, const Object& b) {
+    int64_t generations = Lcm(a.period, b.period);
+    Point a_step(a.displacement.x * (generations / a.period), a.displacement.y * (generations / a.period));
+    Point b_step(b.displacement.x * (generations / b.period), b.displacement.y * (generations / b.period));
+    int64_t margin_x = REACH + std::abs(a_step.x) + std::abs(b_step.x);
+    int64_t margin_y = REACH + std::abs(a_step.y) + std::abs(b_step.y);
+    int64_t first = 0;
+    int64_t last = std::numeric_limits<int64_t>::max();
+    NarrowMeeting(b.min.x, b.max.x, b_step.x - a_step.x, a.min.x - margin_x, a.max.x + margin_x, &first, &last);
+    NarrowMeeting(b.min.y, b.max.y, b_step.y - a_step.y, a.min.y - margin_y, a.max.y + margin_y, &first, &last);
+    return first <= last;
+}
+
+bool SoupRunner::Joined(const Object& a, const Object& b) {
+    if (!a.classified || !b.classified) {
+        return Near(a.cells, b.cells);
+    }
+    // Objects moving apart or towards each other are left to MayCollide.
+    bool near = a.min.x - b.max.x <= REACH && b.min.x - a.max.x <= REACH &&
+                a.min.y - b.max.y <= REACH && b.min.y - a.max.y <= REACH;
+    return near && SameVelocity(a, b) && Interact(a, b);
+}
+
+// Islands are the candidate objects. An island which doesn't repeat alone, e.g. one side of a
+// beacon, is joined with the islands next to it, and so are islands which repeat alone but not
+// side by side, until every object is either classified or alone.
+bool SoupRunner::TakeCensus(std::map<std::string, int>* census, int64_t* period) {
+    std::vector<Object> objects;
+    for (std::vector<Point>& island : SplitIslands(life_.LivePoints())) {
+        objects.emplace_back();
+        objects.back().cells = std::move(island);
+        Classify(&objects.back());
+    }
+    // The joined object may join objects already compared to either part, so start over.
+    bool joined = true;
+    while (joined) {
+        joined = false;
+        for (size_t i = 0; i < objects.size() && !joined; i++) {
+            for (size_t j = i + 1; j < objects.size() && !joined; j++) {
+                if (Joined(objects[i], objects[j])) {
+                    objects[i].cells.insert(objects[i].cells.end(), objects[j].cells.begin(), objects[j].cells.end());
+                    objects.erase(objects.begin() + j);
+                    Classify(&objects[i]);
+                    joined = true;
+                }
+            }
+        }
+    }
+
+    census->clear();
+    *period = 1;
+    bool settled = true;
+    for (const Object& object : objects) {
+        if (object.classified) {
+            (*census)[object.apgcode]++;
+            *period = Lcm(*period, object.period);
+        } else {
+            (*census)["zz_UNKNOWN"]++;
+            settled = false;
+        }
+    }
+    for (size_t i = 0; i < objects.size() && settled; i++) {
+        for (size_t j = i + 1; j < objects.size() && settled; j++) {
+            settled = SameVelocity(objects[i], objects[j]) || !MayCollide(objects[i], objects[j]);
+        }
+    }
+    return settled;
+}
+
+std::string FormatCensus(const std::map<std::string, int>& census) {
+    std::vector<std::pair<std::string, int>> objects(census.begin(), census.end());
+    std::stable_sort(objects.begin(), objects.end(),
+                     [](const std::pair<std::string, int>& a, const std::pair<std::string, int>& b) {
+                         return a.second > b.second;
+                     });
+    std::string text;
+    for (const auto& object : objects) {
+        if (!text.empty()) {
+            text += ' ';
+        }
+        text += object.first + ":" + std::to_string(object.second);
+    }
+    return text;
+}
+
+}  // namespace conway
@@ -0,0 +1,116 @@
+#ifndef CONWAY_CENSUS_H
+#define CONWAY_CENSUS_H
+
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "life.h"
+
+namespace conway {
+
+// How a soup ended up.
+struct SoupOutcome {
+    SoupOutcome() : stable(false), generations(0), population(0), period(0) {}
+
+    // Whether, before the generation cap, the population became periodic, every object in the
+    // census repeats on its own, and no spaceship is headed for another object.
+    bool stable;
+    int64_t generations;
+    uint64_t population;
+    // Once stable, the least common multiple of the periods of the objects, after which the
+    // pattern repeats up to moving spaceships, else 0.
+    int64_t period;
+    // Number of each object, by apgcode, e.g. "xs4_33" for a block, "xp2_7" for a blinker and
+    // "xq4_153" for a glider. Objects which don't repeat within MAX_PERIOD generations on their
+    // own count as "zz_UNKNOWN".
+    std::map<std::string, int> census;
+};
+
+// The canonical apgcode of a lone object: "xs" and the population for still lifes, "xp" and
+// the period for oscillators and "xq" and the period for spaceships, followed by the cells in
+// extended Wechsler format, picking the shortest code, then the first in ASCII order, of any
+// phase in any of the 8 orientations. phases holds the cells of each phase; displaced says
+// whether the object moved by the end of its period.
+std::string Apgcode(const std::vector<std::vector<Point>>& phases, bool displaced);
+
+// Runs soups until they settle, or until a generation cap, and takes their census. Keeps one
+// engine for the soups and one for stepping objects alone, each cleared rather than recreated
+// between soups, so that running millions of small soups doesn't allocate for each. Not
+// thread-safe: use one per thread.
+class SoupRunner {
+    public:
+    // Periods longer than this are neither detected in the population nor in objects.
+    static const int MAX_PERIOD = 64;
+
+    SoupRunner(const Rule& rule, int64_t max_generations);
+
+    // The engine to load the next soup into, emptied by the last Run.
+    Life* life() { return &life_; }
+
+    // Runs the soup loaded into life() and empties it for the next one.
+    SoupOutcome Run();
+    // Empties life() without running it, e.g. after a pattern failed to load part way.
+    void Clear();
+
+    private:
+    // Generations between checks of whether the soup settled.
+    static const int CHECK_EVERY = 64;
+
+    // An object of the census: an island, or islands which only repeat together.
+    struct Object {
+        Object() : classified(false), period(0) {}
+
+        std::vector<Point> cells;
+        // Whether it repeats on its own within MAX_PERIOD generations. The rest is only set
+        // then.
+        bool classified;
+        std::string apgcode;
+        int period;
+        // How far it moves in a period.
+        Point displacement;
+        // Its cells in each generation of its period, and the bounding box of all of them.
+        std::vector<std::vector<Point>> phases;
+        Point min;
+        Point max;
+    };
+
+    // Returns the smallest period of the last generations of populations_, or 0.
+    int PopulationPeriod() const;
+    // Splits the cells into islands, the sets of cells connected through neighboring cells, the
+    // objects apgcodes are given to unless they only repeat together.
+    static std::vector<std::vector<Point>> SplitIslands(const std::vector<Point>& cells);
+    // Steps the cells of object alone until they repeat, and fills in the rest of object.
+    // Returns false if they don't repeat within MAX_PERIOD generations.
+    bool Classify(Object* object);
+    // Whether two repeating objects move at the same speed in the same direction.
+    static bool SameVelocity(const Object& a, const Object& b);
+    // Whether two objects moving together evolve differently side by side than alone, over the
+    // least common multiple of their periods.
+    bool Interact(const Object& a, const Object& b);
+    // Whether two repeating objects moving apart or towards each other could ever come within
+    // reach of each other.
+    static bool MayCollide(const Object& a, const Object& b);
+    // Whether two objects have to be classified as one: one doesn't repeat and the other is
+    // close enough to be part of it, or they move together and interact.
+    bool Joined(const Object& a, const Object& b);
+    // Takes the census of the cells of life_ and the period of the objects together. Returns
+    // true if the soup settled: every object repeats on its own and no spaceship can run into
+    // another object.
+    bool TakeCensus(std::map<std::string, int>* census, int64_t* period);
+
+    Rule rule_;
+    int64_t max_generations_;
+    HybridLife life_;
+    HybridLife scratch_;
+    // Population after each generation of the current soup.
+    std::vector<uint64_t> populations_;
+};
+
+// "apgcode:count" per object, separated by spaces, most common first.
+std::string FormatCensus(const std::map<std::string, int>& census);
+
+}  // namespace conway
+
+#endif
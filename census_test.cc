@@ -0,0 +1,72 @@
+// Checks of the census of settled soups. Exits with 1 and names the failed checks if any.
+//
+// Usage: census_test
+
+#include <iostream>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "census.h"
+
+namespace {
+
+typedef std::vector<std::pair<int64_t, int64_t>> Cells;
+
+// Runs cells as a soup, which has to settle within max_generations.
+conway::SoupOutcome RunSoup(const Cells& cells, int64_t max_generations = 1000) {
+    conway::SoupRunner runner(conway::Rule(), max_generations);
+    for (const auto& cell : cells) {
+        runner.life()->AddLivePoint(conway::Point(cell.first, cell.second));
+    }
+    return runner.Run();
+}
+
+Cells Block(int64_t x, int64_t y) {
+    return Cells{{x, y}, {x + 1, y}, {x, y + 1}, {x + 1, y + 1}};
+}
+
+Cells Join(Cells a, const Cells& b) {
+    a.insert(a.end(), b.begin(), b.end());
+    return a;
+}
+
+int failures = 0;
+
+void Check(bool ok, const std::string& name, const conway::SoupOutcome& outcome) {
+    if (!ok) {
+        std::cerr << "FAILED " << name << ": " << (outcome.stable ? "stable" : "capped") << " after "
+                  << outcome.generations << " generations, " << conway::FormatCensus(outcome.census) << std::endl;
+        failures++;
+    }
+}
+
+}  // namespace
+
+int main() {
+    // A column apart, so the blocks are two islands, each still on its own and side by side.
+    conway::SoupOutcome blocks = RunSoup(Join(Block(0, 0), Block(3, 0)));
+    Check(blocks.stable && blocks.census == std::map<std::string, int>{{"xs4_33", 2}}, "two close blocks", blocks);
+
+    // Neither side of a beacon repeats alone.
+    conway::SoupOutcome beacon = RunSoup(Join(Block(0, 0), Block(2, 2)));
+    Check(beacon.stable && beacon.census == std::map<std::string, int>{{"xp2_318c", 1}}, "beacon", beacon);
+
+    // A glider flying away from a block leaves both in the census.
+    Cells glider{{1, 0}, {2, 1}, {0, 2}, {1, 2}, {2, 2}};
+    conway::SoupOutcome away = RunSoup(Join(glider, Block(-10, -10)));
+    Check(away.stable && away.census == std::map<std::string, int>{{"xq4_153", 1}, {"xs4_33", 1}},
+          "glider leaving a block", away);
+
+    // A glider headed for a block 60 cells away isn't counted as settled before it hits it,
+    // which destroys both.
+    conway::SoupOutcome towards = RunSoup(Join(glider, Block(60, 60)));
+    Check(towards.stable && towards.census.empty(), "glider headed for a block", towards);
+
+    if (failures > 0) {
+        return 1;
+    }
+    std::cout << "All census checks passed." << std::endl;
+    return 0;
+}
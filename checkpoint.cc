@@ -0,0 +1,218 @@
+#include "checkpoint.h"
+
+#include "distributed.h"
+#include "mapped_file.h"
+#include "rle.h"
+
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <thread>
+
+namespace conway {
+
+namespace {
+
+const char MAGIC[8] = {'C', 'O', 'N', 'W', 'A', 'Y', 'C', 'P'};
+// Version 2 added the rule; version 1 checkpoints are read as B3/S23. Version 3 added the
+// torus; older checkpoints are of the plane.
+const uint32_t VERSION = 3;
+
+struct Header {
+    char magic[8];
+    uint32_t version;
+    // Cells per block side.
+    uint32_t block_dim;
+    int64_t generation;
+    uint64_t num_blocks;
+    // Since version 2.
+    uint16_t birth;
+    uint16_t survival;
+    uint32_t reserved;
+    // Since version 3.
+    int64_t torus_width;
+    int64_t torus_height;
+};
+
+size_t HeaderSize(uint32_t version) {
+    return version == 1 ? offsetof(Header, birth) : version == 2 ? offsetof(Header, torus_width) : sizeof(Header);
+}
+
+// How a BitBlock is stored.
+struct BlockRecord {
+    int64_t x;
+    int64_t y;
+    uint64_t rows[64];
+};
+
+bool WriteCheckpoint(const std::string& filename, int64_t generation, const Rule& rule, const Torus& torus,
+                     const std::vector<BitBlock>& blocks) {
+    // Written under another name and renamed once complete, so that a crash while writing
+    // never replaces a good checkpoint with a partial one.
+    std::string temporary = filename + ".tmp";
+    std::ofstream out(temporary, std::ios::binary);
+    Header header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, MAGIC, sizeof(MAGIC));
+    header.version = VERSION;
+    header.block_dim = 64;
+    header.generation = generation;
+    header.num_blocks = blocks.size();
+    header.birth = rule.birth;
+    header.survival = rule.survival;
+    header.torus_width = torus.width;
+    header.torus_height = torus.height;
+    out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    BlockRecord record;
+    for (const BitBlock& block : blocks) {
+        record.x = block.index.x;
+        record.y = block.index.y;
+        memcpy(record.rows, block.rows.data(), sizeof(record.rows));
+        out.write(reinterpret_cast<const char*>(&record), sizeof(record));
+    }
+    out.close();
+    if (!out) {
+        remove(temporary.c_str());
+        return false;
+    }
+    return rename(temporary.c_str(), filename.c_str()) == 0;
+}
+
+// Reads the header of a checkpoint, filling in only the fields of its version, and returns its
+// size, or 0 if file isn't a checkpoint of a supported version.
+size_t ReadHeader(const MappedFile& file, Header* header) {
+    if (!file.ok() || file.size() < HeaderSize(1)) {
+        return 0;
+    }
+    memset(header, 0, sizeof(*header));
+    memcpy(header, file.begin(), HeaderSize(1));
+    if (memcmp(header->magic, MAGIC, sizeof(MAGIC)) != 0 || header->version < 1 || header->version > VERSION ||
+        header->block_dim != 64) {
+        return 0;
+    }
+    size_t header_size = HeaderSize(header->version);
+    if (file.size() < header_size) {
+        return 0;
+    }
+    memcpy(header, file.begin(), header_size);
+    return header_size;
+}
+
+}  // namespace
+
+bool SaveCheckpoint(const std::string& filename, Life* life) {
+    std::vector<BitBlock> blocks;
+    life->CopyBitBlocks(&blocks);
+    return WriteCheckpoint(filename, life->generation(), life->rule(), life->torus(), blocks);
+}
+
+bool ReadCheckpointTorus(const std::string& filename, Torus* torus) {
+    MappedFile file(filename);
+    Header header;
+    if (ReadHeader(file, &header) == 0) {
+        return false;
+    }
+    *torus = Torus(header.torus_width, header.torus_height);
+    return true;
+}
+
+bool LoadCheckpoint(const std::string& filename, Life* life) {
+    MappedFile file(filename);
+    Header header;
+    size_t header_size = ReadHeader(file, &header);
+    if (header_size == 0) {
+        return false;
+    }
+    Rule rule;
+    if (header.version >= 2) {
+        rule = Rule(header.birth, header.survival);
+        if ((rule.birth & 1) != 0 || rule.birth >= (1 << 9) || rule.survival >= (1 << 9)) {
+            return false;
+        }
+    }
+    if (Torus(header.torus_width, header.torus_height) != life->torus()) {
+        return false;
+    }
+    size_t payload = file.size() - header_size;
+    if (header.num_blocks != payload / sizeof(BlockRecord) || payload % sizeof(BlockRecord) != 0) {
+        return false;
+    }
+    // The mapping is page aligned and the header keeps the records 8 byte aligned.
+    const BlockRecord* records = reinterpret_cast<const BlockRecord*>(file.begin() + header_size);
+    life->set_rule(rule);
+    for (uint64_t i = 0; i < header.num_blocks; i++) {
+        life->AddBitBlock(Point(records[i].x, records[i].y), records[i].rows);
+    }
+    life->set_generation(header.generation);
+    return true;
+}
+
+CheckpointWriter::CheckpointWriter() : ok_(true) {}
+
+CheckpointWriter::~CheckpointWriter() {
+    Wait();
+}
+
+void CheckpointWriter::Save(const std::string& filename, Life* life) {
+    Wait();
+    std::vector<BitBlock> blocks;
+    life->CopyBitBlocks(&blocks);
+    thread_ = std::thread([this](const std::string& filename, int64_t generation, const Rule& rule,
+                                 const Torus& torus, const std::vector<BitBlock>& blocks) {
+        ok_ = WriteCheckpoint(filename, generation, rule, torus, blocks);
+    }, filename, life->generation(), life->rule(), life->torus(), std::move(blocks));
+}
+
+bool CheckpointWriter::Wait() {
+    if (thread_.joinable()) {
+        thread_.join();
+    }
+    return ok_;
+}
+
+bool LoadPattern(const std::string& filename, const std::string& rule, int workers,
+                 std::unique_ptr<Life>* life, std::string* error) {
+    bool checkpoint = filename.size() > 5 && filename.compare(filename.size() - 5, 5, ".ckpt") == 0;
+    Rule parsed_rule;
+    Torus torus;
+    if (!rule.empty()) {
+        if (!ParseRule(rule, &parsed_rule, &torus)) {
+            *error = "Unsupported rule " + rule;
+            return false;
+        }
+    } else if (checkpoint) {
+        ReadCheckpointTorus(filename, &torus);
+    } else if (!filename.empty()) {
+        RLEHeader header;
+        if (ReadRLEHeader(filename, &header) && !header.rule.empty()) {
+            Rule file_rule;
+            ParseRule(header.rule, &file_rule, &torus);
+        }
+    }
+
+    if (!torus.bounded() && workers > 0) {
+        life->reset(new DistributedLife(workers));
+    } else if (!torus.bounded()) {
+        // Adapts to sparse and dense regions as the pattern evolves.
+        life->reset(new HybridLife());
+    } else if (DenseTorusLife::Fits(torus)) {
+        DenseTorusLife* dense = new DenseTorusLife(torus);
+        dense->set_num_threads(std::thread::hardware_concurrency());
+        life->reset(dense);
+    } else {
+        *error = "Torus " + std::to_string(torus.width) + "x" + std::to_string(torus.height) + " is too large";
+        return false;
+    }
+    if (!filename.empty() && (checkpoint ? !LoadCheckpoint(filename, life->get()) : !LoadRLE(filename, life->get()))) {
+        *error = "Could not read " + filename;
+        life->reset();
+        return false;
+    }
+    if (!rule.empty()) {
+        (*life)->set_rule(parsed_rule);
+    }
+    return true;
+}
+
+}  // namespace conway
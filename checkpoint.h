@@ -0,0 +1,61 @@
+#ifndef CONWAY_CHECKPOINT_H
+#define CONWAY_CHECKPOINT_H
+
+#include <memory>
+#include <string>
+#include <thread>
+
+#include "life.h"
+
+namespace conway {
+
+// Binary snapshot of a Life: a fixed header holding the format version, the generation, the
+// rule and the torus, followed by the live cells as 64x64 bit blocks (block index, then one 64-bit word per row).
+// Numbers are stored in the byte order of the machine that wrote them. Any engine of the same
+// torus can load a checkpoint written by any other.
+
+// Returns false if the file can't be written.
+bool SaveCheckpoint(const std::string& filename, Life* life);
+
+// Adds the checkpointed cells to life and restores its generation and rule. The file is memory
+// mapped and its blocks are handed to the engine as they are. Returns false if the file can't be
+// read, isn't a checkpoint of a supported version, or is of another torus than life.
+bool LoadCheckpoint(const std::string& filename, Life* life);
+
+// Reads the torus of a checkpoint, e.g. to pick an engine before loading it. Returns false if
+// the file can't be read or isn't a checkpoint of a supported version.
+bool ReadCheckpointTorus(const std::string& filename, Torus* torus);
+
+// Picks an engine for a pattern file, an RLE pattern or a .ckpt checkpoint, and loads the file
+// into it, as the driver and the renderer do. rule, e.g. from a --rule option, overrides the rule
+// of the file unless empty. A torus in the rule, or else in the file, picks DenseTorusLife on
+// every hardware thread; patterns of the plane get HybridLife, or DistributedLife over workers
+// processes when workers > 0. An empty filename only picks the engine, for cells added otherwise.
+// Returns false with the reason in error if the rule isn't supported, the torus is too large or
+// the file can't be read.
+bool LoadPattern(const std::string& filename, const std::string& rule, int workers,
+                 std::unique_ptr<Life>* life, std::string* error);
+
+// Writes checkpoints on a background thread. The simulation only pauses while the live blocks
+// are copied, which is much faster than writing them out.
+class CheckpointWriter {
+    public:
+    CheckpointWriter();
+    // Waits for the last checkpoint to be written.
+    ~CheckpointWriter();
+
+    // Copies the state of life and starts writing it to filename, first waiting for the previous
+    // checkpoint. The file only appears once it is complete.
+    void Save(const std::string& filename, Life* life);
+
+    // Waits for the last checkpoint and returns whether it was written.
+    bool Wait();
+
+    private:
+    std::thread thread_;
+    bool ok_;
+};
+
+}  // namespace conway
+
+#endif
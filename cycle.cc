@@ -0,0 +1,254 @@
+#include "cycle.h"
+
+#include <algorithm>
+
+namespace conway {
+
+namespace {
+
+const uint64_t PRIME = (uint64_t(1) << 61) - 1;
+// Arbitrary generators for the keys of x and y.
+const uint64_t A = 0x1B2F3C4D5E6F7081ULL % PRIME;
+const uint64_t B = 0x3A5C7E9072E4F617ULL % PRIME;
+
+uint64_t AddMod(uint64_t a, uint64_t b) {
+    uint64_t sum = a + b;
+    return sum >= PRIME ? sum - PRIME : sum;
+}
+
+uint64_t SubMod(uint64_t a, uint64_t b) {
+    return a >= b ? a - b : a + PRIME - b;
+}
+
+uint64_t MulMod(uint64_t a, uint64_t b) {
+    unsigned __int128 product = static_cast<unsigned __int128>(a) * b;
+    uint64_t sum = (static_cast<uint64_t>(product) & PRIME) + static_cast<uint64_t>(product >> 61);
+    return sum >= PRIME ? sum - PRIME : sum;
+}
+
+// Powers of a generator, by byte of the exponent: powers[i][b] is base^(b << 8i), so any power
+// takes 8 multiplications.
+struct PowerTable {
+    explicit PowerTable(uint64_t base) {
+        for (int i = 0; i < 8; i++) {
+            powers[i][0] = 1;
+            for (int b = 1; b < 256; b++) {
+                powers[i][b] = MulMod(powers[i][b - 1], base);
+            }
+            base = MulMod(powers[i][255], base);
+        }
+    }
+
+    // base^e for any e, as the exponent of a cyclic group of order PRIME - 1.
+    uint64_t Power(int64_t e) const {
+        const int64_t order = static_cast<int64_t>(PRIME - 1);
+        uint64_t exponent = static_cast<uint64_t>((e % order + order) % order);
+        uint64_t result = powers[0][exponent & 0xFF];
+        for (int i = 1; i < 8 && (exponent >>= 8) != 0; i++) {
+            result = MulMod(result, powers[i][exponent & 0xFF]);
+        }
+        return result;
+    }
+
+    uint64_t powers[8][256];
+};
+
+const PowerTable& XKeys() {
+    static const PowerTable table(A);
+    return table;
+}
+
+const PowerTable& YKeys() {
+    static const PowerTable table(B);
+    return table;
+}
+
+bool PointLess(const Point& a, const Point& b) {
+    return a.y != b.y ? a.y < b.y : a.x < b.x;
+}
+
+uint64_t Key(const Point& p) {
+    return MulMod(XKeys().Power(p.x), YKeys().Power(p.y));
+}
+
+// Solves population * d == difference modulo 2^64 for the d closest to 0, the displacement
+// along one axis of cells whose coordinates sum to difference more than before.
+bool Displacement(uint64_t population, uint64_t difference, int64_t* d) {
+    int shift = __builtin_ctzll(population);
+    if ((difference & ((uint64_t(1) << shift) - 1)) != 0) {
+        return false;
+    }
+    // Inverse of the odd part of the population by Newton's iteration, each step doubling the
+    // correct low bits.
+    uint64_t odd = population >> shift;
+    uint64_t inverse = odd;
+    for (int i = 0; i < 5; i++) {
+        inverse *= 2 - odd * inverse;
+    }
+    // Only the low 64 - shift bits are determined; sign extend from them.
+    uint64_t low = (difference >> shift) * inverse;
+    *d = static_cast<int64_t>(low << shift) >> shift;
+    return true;
+}
+
+}  // namespace
+
+BoardHash BoardHash::OfRows(const Point& origin, const uint64_t* rows, int num_rows) {
+    const PowerTable& x_keys = XKeys();
+    const PowerTable& y_keys = YKeys();
+    BoardHash h;
+    uint64_t local = 0;
+    uint64_t sum_x = 0;
+    uint64_t sum_y = 0;
+    for (int y = 0; y < num_rows; y++) {
+        uint64_t row = 0;
+        for (uint64_t bits = rows[y]; bits != 0; bits &= bits - 1) {
+            int x = __builtin_ctzll(bits);
+            row = AddMod(row, x_keys.powers[0][x]);
+            sum_x += x;
+        }
+        if (rows[y] != 0) {
+            int count = __builtin_popcountll(rows[y]);
+            local = AddMod(local, MulMod(row, y_keys.powers[0][y]));
+            sum_y += static_cast<uint64_t>(y) * count;
+            h.population_ += count;
+        }
+    }
+    h.hash_ = MulMod(local, Key(origin));
+    h.sum_x_ = sum_x + h.population_ * static_cast<uint64_t>(origin.x);
+    h.sum_y_ = sum_y + h.population_ * static_cast<uint64_t>(origin.y);
+    return h;
+}
+
+void BoardHash::Add(const Point& p) {
+    hash_ = AddMod(hash_, Key(p));
+    population_++;
+    sum_x_ += static_cast<uint64_t>(p.x);
+    sum_y_ += static_cast<uint64_t>(p.y);
+}
+
+void BoardHash::Remove(const Point& p) {
+    hash_ = SubMod(hash_, Key(p));
+    population_--;
+    sum_x_ -= static_cast<uint64_t>(p.x);
+    sum_y_ -= static_cast<uint64_t>(p.y);
+}
+
+BoardHash& BoardHash::operator+=(const BoardHash& other) {
+    hash_ = AddMod(hash_, other.hash_);
+    population_ += other.population_;
+    sum_x_ += other.sum_x_;
+    sum_y_ += other.sum_y_;
+    return *this;
+}
+
+BoardHash& BoardHash::operator-=(const BoardHash& other) {
+    hash_ = SubMod(hash_, other.hash_);
+    population_ -= other.population_;
+    sum_x_ -= other.sum_x_;
+    sum_y_ -= other.sum_y_;
+    return *this;
+}
+
+void BoardHash::Translate(const Point& displacement) {
+    hash_ = MulMod(hash_, Key(displacement));
+    sum_x_ += population_ * static_cast<uint64_t>(displacement.x);
+    sum_y_ += population_ * static_cast<uint64_t>(displacement.y);
+}
+
+bool BoardHash::MatchesMoved(const BoardHash& earlier, Point* displacement) const {
+    if (population_ != earlier.population_) {
+        return false;
+    }
+    if (population_ == 0) {
+        *displacement = Point(0, 0);
+        return true;
+    }
+    int64_t dx;
+    int64_t dy;
+    if (!Displacement(population_, sum_x_ - earlier.sum_x_, &dx) ||
+        !Displacement(population_, sum_y_ - earlier.sum_y_, &dy)) {
+        return false;
+    }
+    if (dx == 0 && dy == 0 ? hash_ != earlier.hash_ : hash_ != MulMod(earlier.hash_, Key(Point(dx, dy)))) {
+        return false;
+    }
+    *displacement = Point(dx, dy);
+    return true;
+}
+
+CycleDetector::CycleDetector() : next_(0), candidate_generation_(0) {
+    history_.reserve(MAX_PERIOD);
+}
+
+void CycleDetector::Follow(int64_t generation, const BoardHash& hash, const Rule& rule) {
+    if (!history_.empty()) {
+        const Entry& last = history_[(next_ + history_.size() - 1) % history_.size()];
+        if (last.generation == generation && last.hash == hash && rule == rule_) {
+            return;
+        }
+    }
+    Reset();
+    rule_ = rule;
+    Push(generation, hash);
+}
+
+void CycleDetector::Add(int64_t generation, const BoardHash& hash,
+                        const std::function<std::vector<Point>()>& cells) {
+    if (cycle_.period == 0 && candidate_.period > 0 &&
+        generation == candidate_generation_ + candidate_.period) {
+        std::vector<Point> moved = cells();
+        for (Point& p : moved) {
+            p = Point(static_cast<int64_t>(static_cast<uint64_t>(p.x) - candidate_.displacement.x),
+                      static_cast<int64_t>(static_cast<uint64_t>(p.y) - candidate_.displacement.y));
+        }
+        std::sort(moved.begin(), moved.end(), PointLess);
+        if (moved == candidate_cells_) {
+            cycle_ = candidate_;
+        }
+        candidate_ = Cycle();
+        std::vector<Point>().swap(candidate_cells_);
+    }
+    if (cycle_.period == 0 && candidate_.period == 0) {
+        // The shortest period first.
+        for (size_t i = 1; i <= history_.size(); i++) {
+            const Entry& entry = history_[(next_ + history_.size() - i) % history_.size()];
+            Point displacement;
+            if (hash.MatchesMoved(entry.hash, &displacement)) {
+                candidate_.period = generation - entry.generation;
+                candidate_.displacement = displacement;
+                candidate_generation_ = generation;
+                candidate_cells_ = cells();
+                std::sort(candidate_cells_.begin(), candidate_cells_.end(), PointLess);
+                break;
+            }
+        }
+    }
+    Push(generation, hash);
+}
+
+void CycleDetector::Jump(int64_t generation, const BoardHash& hash) {
+    Cycle cycle = cycle_;
+    Reset();
+    cycle_ = cycle;
+    Push(generation, hash);
+}
+
+void CycleDetector::Reset() {
+    history_.clear();
+    next_ = 0;
+    candidate_ = Cycle();
+    std::vector<Point>().swap(candidate_cells_);
+    cycle_ = Cycle();
+}
+
+void CycleDetector::Push(int64_t generation, const BoardHash& hash) {
+    if (history_.size() < MAX_PERIOD) {
+        history_.push_back(Entry{generation, hash});
+    } else {
+        history_[next_] = Entry{generation, hash};
+        next_ = (next_ + 1) % history_.size();
+    }
+}
+
+}  // namespace conway
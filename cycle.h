@@ -0,0 +1,108 @@
+#ifndef CONWAY_CYCLE_H
+#define CONWAY_CYCLE_H
+
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+#include "point.h"
+#include "rule.h"
+
+namespace conway {
+
+// Zobrist-style hash of a set of live cells: the sum of a key per cell, so engines update it
+// as cells change, cell by cell or a block at a time, without looking at the other cells. The
+// key of (x, y) is A^x * B^y modulo the prime 2^61 - 1, which makes moving every cell by (dx,
+// dy) multiply the hash by A^dx * B^dy, so the hash also tells sets that are the same up to
+// translation apart. Along with the hash it keeps the population and the sums of the
+// coordinates, from which the displacement between two such sets follows. Moves across the
+// wrapping edges of the int64 plane don't keep this relation.
+class BoardHash {
+    public:
+    BoardHash() : hash_(0), population_(0), sum_x_(0), sum_y_(0) {}
+
+    // The hash of the cells of rows from origin: bit x of rows[y] is the cell (origin.x + x,
+    // origin.y + y), with x < 64.
+    static BoardHash OfRows(const Point& origin, const uint64_t* rows, int num_rows);
+
+    uint64_t hash() const { return hash_; }
+    uint64_t population() const { return population_; }
+
+    void Add(const Point& p);
+    void Remove(const Point& p);
+    // Adds or removes every cell of other, e.g. of a block, which mustn't overlap this or must
+    // be part of it.
+    BoardHash& operator+=(const BoardHash& other);
+    BoardHash& operator-=(const BoardHash& other);
+    bool operator==(const BoardHash& o) const {
+        return hash_ == o.hash_ && population_ == o.population_ && sum_x_ == o.sum_x_ && sum_y_ == o.sum_y_;
+    }
+
+    // Moves every cell by displacement.
+    void Translate(const Point& displacement);
+    // Whether these cells are, hash collisions aside, those of earlier moved by some
+    // displacement, which is then stored in displacement.
+    bool MatchesMoved(const BoardHash& earlier, Point* displacement) const;
+
+    private:
+    uint64_t hash_;
+    uint64_t population_;
+    // Sums of the coordinates, wrapping around.
+    uint64_t sum_x_;
+    uint64_t sum_y_;
+};
+
+// A pattern that repeats every period generations, moved by displacement, e.g. (0, 0) for
+// oscillators and (1, 1) per 4 generations for a glider. period is 0 while no cycle is known.
+struct Cycle {
+    Cycle() : period(0) {}
+
+    int64_t period;
+    Point displacement;
+};
+
+// Finds cycles from the BoardHash of every generation: once a hash matches one of the last
+// MAX_PERIOD generations, up to translation, the cells are kept and compared with the cells a
+// period later, so that a cycle is only reported once the cells themselves repeated.
+class CycleDetector {
+    public:
+    static const int MAX_PERIOD = 1024;
+
+    CycleDetector();
+
+    // Forgets the generations added and the cycle unless the hash, rule and generation are
+    // those of the last generation added, i.e. unless the cells or rule were changed since, and
+    // then adds them.
+    void Follow(int64_t generation, const BoardHash& hash, const Rule& rule);
+    // Adds the hash of the generation after the last one added. cells returns the live cells of
+    // generation, and is only called when they need to be compared.
+    void Add(int64_t generation, const BoardHash& hash, const std::function<std::vector<Point>()>& cells);
+    // Continues from generation after a jump along the cycle, keeping it.
+    void Jump(int64_t generation, const BoardHash& hash);
+
+    const Cycle& cycle() const { return cycle_; }
+
+    private:
+    struct Entry {
+        int64_t generation;
+        BoardHash hash;
+    };
+
+    void Reset();
+    void Push(int64_t generation, const BoardHash& hash);
+
+    // The last generations added, oldest first from next_ once full.
+    std::vector<Entry> history_;
+    size_t next_;
+    Rule rule_;
+    // A cycle the hashes suggest, to confirm at candidate_generation_ + candidate_.period
+    // against the cells of candidate_generation_, sorted.
+    Cycle candidate_;
+    int64_t candidate_generation_;
+    std::vector<Point> candidate_cells_;
+    Cycle cycle_;
+};
+
+}  // namespace conway
+
+#endif
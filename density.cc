@@ -0,0 +1,67 @@
+#include "density.h"
+
+namespace conway {
+
+void VisitTiles(int level, PointMap<uint64_t>* tiles, const Range& x_range, const Range& y_range,
+                DensityVisitor* visitor) {
+    if (x_range.first > x_range.second || y_range.first > y_range.second || tiles->empty()) {
+        return;
+    }
+    int64_t x_start = x_range.first >> level;
+    int64_t x_end = x_range.second >> level;
+    int64_t y_start = y_range.first >> level;
+    int64_t y_end = y_range.second >> level;
+    // One less than the tiles across and down, which can't overflow.
+    uint64_t x_span = static_cast<uint64_t>(x_end) - static_cast<uint64_t>(x_start);
+    uint64_t y_span = static_cast<uint64_t>(y_end) - static_cast<uint64_t>(y_start);
+    size_t size = tiles->size();
+    if (x_span < size && y_span < size && (x_span + 1) * (y_span + 1) <= size) {
+        for (uint64_t row = 0; row <= y_span; row++) {
+            for (uint64_t column = 0; column <= x_span; column++) {
+                Point index(x_start + static_cast<int64_t>(column), y_start + static_cast<int64_t>(row));
+                const PointMap<uint64_t>::value_type* tile = tiles->find(index);
+                if (tile != nullptr) {
+                    visitor->Visit(index.x, index.y, tile->second);
+                }
+            }
+        }
+        return;
+    }
+    for (const auto& tile : *tiles) {
+        const Point& index = tile.first;
+        if (index.x >= x_start && index.x <= x_end && index.y >= y_start && index.y <= y_end) {
+            visitor->Visit(index.x, index.y, tile.second);
+        }
+    }
+}
+
+DensityPyramid::DensityPyramid(int base_level)
+    : base_level_(base_level), levels_(MAX_LEVEL - base_level + 1) {
+}
+
+void DensityPyramid::Flush() {
+    for (const auto& set : pending_) {
+        const PointMap<uint64_t>::value_type* base = levels_[0].find(set.first);
+        // Wraps around for fewer cells, which adding to the tiles undoes.
+        uint64_t delta = set.second - (base == nullptr ? 0 : base->second);
+        if (delta == 0) {
+            continue;
+        }
+        for (size_t i = 0; i < levels_.size(); i++) {
+            Point index(set.first.x >> i, set.first.y >> i);
+            uint64_t& live_cells = levels_[i].emplace(index, 0).first->second;
+            live_cells += delta;
+            if (live_cells == 0) {
+                levels_[i].erase(index);
+            }
+        }
+    }
+    pending_.clear();
+}
+
+void DensityPyramid::Visit(int level, const Range& x_range, const Range& y_range, DensityVisitor* visitor) {
+    Flush();
+    VisitTiles(level, &levels_[level - base_level_], x_range, y_range, visitor);
+}
+
+}  // namespace conway
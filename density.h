@@ -0,0 +1,60 @@
+#ifndef CONWAY_DENSITY_H
+#define CONWAY_DENSITY_H
+
+#include <cstdint>
+#include <vector>
+
+#include "point.h"
+#include "point_map.h"
+
+namespace conway {
+
+// Tile (x, y) of level k covers the 2^k x 2^k cells from (x << k, y << k), so a cell's tile is
+// its coordinates shifted right by k.
+class DensityVisitor {
+    public:
+    virtual ~DensityVisitor() {}
+    // Called with the number of live cells in the tile, which is never 0.
+    virtual void Visit(int64_t x, int64_t y, uint64_t live_cells) = 0;
+};
+
+// Calls visitor for every tile of level in tiles that overlaps the rectangle, by looking up each
+// tile position the rectangle covers when there are fewer of those than tiles, and otherwise by
+// scanning tiles.
+void VisitTiles(int level, PointMap<uint64_t>* tiles, const Range& x_range, const Range& y_range,
+                DensityVisitor* visitor);
+
+// Live cells per tile for every level from base_level up to MAX_LEVEL, for drawing a pattern
+// at any zoom with about one value per pixel. Engines report changes to the tiles of the base
+// level, typically their blocks, as they step. Only the last value set for each tile is kept
+// until the next Visit, which then updates the levels above for the tiles that changed, so
+// stepping many generations between frames costs one hash table update per block and step.
+class DensityPyramid {
+    public:
+    // A level 63 tile covers half of the int64 plane in each direction.
+    static const int MAX_LEVEL = 63;
+
+    explicit DensityPyramid(int base_level);
+
+    int base_level() const { return base_level_; }
+
+    // Sets the live cells of tile of the base level.
+    void Set(const Point& tile, uint64_t live_cells) { pending_.emplace(tile, 0).first->second = live_cells; }
+
+    // Calls visitor for every tile of level with live cells that overlaps the rectangle.
+    // level must be at least base_level().
+    void Visit(int level, const Range& x_range, const Range& y_range, DensityVisitor* visitor);
+
+    private:
+    void Flush();
+
+    int base_level_;
+    // levels_[i] holds the tiles of level base_level_ + i that have live cells.
+    std::vector<PointMap<uint64_t>> levels_;
+    // Live cells set for tiles of the base level and not yet applied.
+    PointMap<uint64_t> pending_;
+};
+
+}  // namespace conway
+
+#endif
@@ -0,0 +1,657 @@
+#include "distributed.h"
+
+#include <poll.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <limits>
+
+namespace conway {
+
+namespace {
+
+enum CommandType : int32_t {
+    // Followed by n BlockRecords of cells to add.
+    ADD_BLOCKS,
+    // Steps n generations, then answers with one byte.
+    STEP,
+    SET_RULE,
+    // Answers with the number of blocks overlapping the rectangle, then their BlockRecords.
+    GET_BLOCKS,
+    // Answers with Counts.
+    GET_COUNTS,
+};
+
+// Sent from the coordinator to the workers as it is, so it must stay plain data.
+struct Command {
+    int32_t type;
+    uint16_t birth;
+    uint16_t survival;
+    int64_t n;
+    int64_t x_first;
+    int64_t x_second;
+    int64_t y_first;
+    int64_t y_second;
+};
+
+// How a BitBlock is sent, between the coordinator and the workers and between workers.
+struct BlockRecord {
+    int64_t x;
+    int64_t y;
+    uint64_t rows[64];
+};
+
+struct Counts {
+    uint64_t live_cells;
+    uint64_t blocks;
+};
+
+// A worker that died fails the send instead of killing the sender with SIGPIPE: with
+// MSG_NOSIGNAL where send has it, and otherwise, e.g. on macOS, with SO_NOSIGPIPE on every
+// socket, set by SocketPair.
+#ifdef MSG_NOSIGNAL
+const int SEND_FLAGS = MSG_NOSIGNAL;
+#else
+const int SEND_FLAGS = 0;
+#endif
+
+bool SocketPair(int sv[2]) {
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) != 0) {
+        return false;
+    }
+#if !defined(MSG_NOSIGNAL) && defined(SO_NOSIGPIPE)
+    int one = 1;
+    if (setsockopt(sv[0], SOL_SOCKET, SO_NOSIGPIPE, &one, sizeof(one)) != 0 ||
+        setsockopt(sv[1], SOL_SOCKET, SO_NOSIGPIPE, &one, sizeof(one)) != 0) {
+        close(sv[0]);
+        close(sv[1]);
+        return false;
+    }
+#endif
+    return true;
+}
+
+bool WriteAll(int fd, const void* data, size_t size) {
+    const char* p = static_cast<const char*>(data);
+    while (size > 0) {
+        ssize_t n = send(fd, p, size, SEND_FLAGS);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return false;
+        }
+        p += n;
+        size -= static_cast<size_t>(n);
+    }
+    return true;
+}
+
+bool ReadAll(int fd, void* data, size_t size) {
+    char* p = static_cast<char*>(data);
+    while (size > 0) {
+        ssize_t n = read(fd, p, size);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return false;
+        }
+        p += n;
+        size -= static_cast<size_t>(n);
+    }
+    return true;
+}
+
+// Block indices only span 58 bits, so wrap them the same way cell coordinates wrap at the
+// edges of the int64 space.
+int64_t WrapBlockX(int64_t x) {
+    return static_cast<int64_t>(static_cast<uint64_t>(x) << 6) >> 6;
+}
+
+bool Overlaps(int64_t block_x, int64_t block_y, const Range& x_range, const Range& y_range) {
+    int64_t x = block_x * 64;
+    int64_t y = block_y * 64;
+    return x <= x_range.second && x + 63 >= x_range.first && y <= y_range.second && y + 63 >= y_range.first;
+}
+
+bool IsEmpty(const uint64_t* rows) {
+    uint64_t any = 0;
+    for (int y = 0; y < 64; y++) {
+        any |= rows[y];
+    }
+    return any == 0;
+}
+
+// The loop of a worker process, which keeps the blocks of its stripes in a BitBlockLife and
+// only adds the halo around them for the steps between exchanges.
+class WorkerProcess {
+    public:
+    // peers[i] is the socket to worker i, and -1 for this worker.
+    WorkerProcess(int index, int halo_steps, int coordinator, const std::vector<int>& peers)
+        : index_(index), halo_steps_(halo_steps), coordinator_(coordinator), peers_(peers) {}
+
+    // Serves commands until the coordinator goes away or a peer fails.
+    void Run() {
+        Command command;
+        while (ReadAll(coordinator_, &command, sizeof(command))) {
+            if (!Serve(command)) {
+                return;
+            }
+        }
+    }
+
+    private:
+    // A message to or from one peer: the number of blocks, then their records.
+    struct Transfer {
+        std::vector<char> out;
+        size_t sent;
+        std::vector<char> in;
+        size_t received;
+    };
+
+    bool Owns(int64_t block_x) const {
+        return DistributedLife::WorkerOf(block_x, static_cast<int>(peers_.size())) == index_;
+    }
+
+    bool Serve(const Command& command) {
+        switch (command.type) {
+            case ADD_BLOCKS: {
+                BlockRecord record;
+                for (int64_t i = 0; i < command.n; i++) {
+                    if (!ReadAll(coordinator_, &record, sizeof(record))) {
+                        return false;
+                    }
+                    life_.AddBitBlock(Point(record.x, record.y), record.rows);
+                }
+                return true;
+            }
+            case STEP: {
+                for (int64_t done = 0; done < command.n;) {
+                    int64_t steps = std::min<int64_t>(halo_steps_, command.n - done);
+                    if (!ExchangeHalos()) {
+                        return false;
+                    }
+                    life_.Step(steps);
+                    life_.RetainBlocks([this](const Point& index) { return Owns(index.x); });
+                    done += steps;
+                }
+                char stepped = 1;
+                return WriteAll(coordinator_, &stepped, 1);
+            }
+            case SET_RULE:
+                life_.set_rule(Rule(command.birth, command.survival));
+                return true;
+            case GET_BLOCKS: {
+                Range x_range(command.x_first, command.x_second);
+                Range y_range(command.y_first, command.y_second);
+                std::vector<BlockRecord> records;
+                life_.ForEachBitBlock([&](const Point& index, const uint64_t* rows) {
+                    if (!IsEmpty(rows) && Overlaps(index.x, index.y, x_range, y_range)) {
+                        records.push_back(Record(index, rows));
+                    }
+                });
+                uint64_t count = records.size();
+                return WriteAll(coordinator_, &count, sizeof(count)) &&
+                       WriteAll(coordinator_, records.data(), records.size() * sizeof(BlockRecord));
+            }
+            case GET_COUNTS: {
+                Counts counts = {0, life_.TableSize()};
+                life_.ForEachBitBlock([&](const Point& index, const uint64_t* rows) {
+                    for (int y = 0; y < 64; y++) {
+                        counts.live_cells += __builtin_popcountll(rows[y]);
+                    }
+                });
+                return WriteAll(coordinator_, &counts, sizeof(counts));
+            }
+            default:
+                return false;
+        }
+    }
+
+    static BlockRecord Record(const Point& index, const uint64_t* rows) {
+        BlockRecord record;
+        record.x = index.x;
+        record.y = index.y;
+        memcpy(record.rows, rows, sizeof(record.rows));
+        return record;
+    }
+
+    // Sends the blocks on the edges of this worker's stripes to the workers owning the stripes
+    // next to them, and adds the blocks they send back. Every pair of workers trades one
+    // message, possibly empty, and messages go both ways at once so that large halos never
+    // leave two workers waiting for each other to read.
+    bool ExchangeHalos() {
+        int num_workers = static_cast<int>(peers_.size());
+        if (num_workers == 1) {
+            return true;
+        }
+        std::vector<std::vector<BlockRecord>> halos(num_workers);
+        life_.ForEachBitBlock([&](const Point& index, const uint64_t* rows) {
+            int west = DistributedLife::WorkerOf(WrapBlockX(index.x - 1), num_workers);
+            int east = DistributedLife::WorkerOf(WrapBlockX(index.x + 1), num_workers);
+            if ((west == index_ && east == index_) || IsEmpty(rows)) {
+                return;
+            }
+            if (west != index_) {
+                halos[west].push_back(Record(index, rows));
+            }
+            if (east != index_ && east != west) {
+                halos[east].push_back(Record(index, rows));
+            }
+        });
+        std::vector<Transfer> transfers(num_workers);
+        for (int i = 0; i < num_workers; i++) {
+            if (i == index_) {
+                continue;
+            }
+            Transfer& t = transfers[i];
+            uint64_t count = halos[i].size();
+            t.out.resize(sizeof(count) + count * sizeof(BlockRecord));
+            memcpy(t.out.data(), &count, sizeof(count));
+            if (count > 0) {
+                memcpy(t.out.data() + sizeof(count), halos[i].data(), count * sizeof(BlockRecord));
+            }
+            t.sent = 0;
+            t.in.resize(sizeof(count));
+            t.received = 0;
+        }
+        std::vector<pollfd> fds;
+        std::vector<int> workers;
+        while (true) {
+            fds.clear();
+            workers.clear();
+            for (int i = 0; i < num_workers; i++) {
+                const Transfer& t = transfers[i];
+                short events = (t.sent < t.out.size() ? POLLOUT : 0) | (t.received < t.in.size() ? POLLIN : 0);
+                if (i != index_ && events != 0) {
+                    fds.push_back(pollfd{peers_[i], events, 0});
+                    workers.push_back(i);
+                }
+            }
+            if (fds.empty()) {
+                break;
+            }
+            if (poll(fds.data(), fds.size(), -1) < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                return false;
+            }
+            for (size_t j = 0; j < fds.size(); j++) {
+                Transfer& t = transfers[workers[j]];
+                if (fds[j].revents & (POLLERR | POLLNVAL)) {
+                    return false;
+                }
+                if ((fds[j].revents & POLLOUT) && t.sent < t.out.size()) {
+                    ssize_t n = send(fds[j].fd, t.out.data() + t.sent, t.out.size() - t.sent,
+                                     SEND_FLAGS | MSG_DONTWAIT);
+                    if (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+                        return false;
+                    }
+                    t.sent += n > 0 ? static_cast<size_t>(n) : 0;
+                }
+                if ((fds[j].revents & (POLLIN | POLLHUP)) && t.received < t.in.size()) {
+                    ssize_t n = recv(fds[j].fd, t.in.data() + t.received, t.in.size() - t.received, MSG_DONTWAIT);
+                    if (n == 0 || (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)) {
+                        return false;
+                    }
+                    t.received += n > 0 ? static_cast<size_t>(n) : 0;
+                    if (t.received == sizeof(uint64_t) && t.in.size() == sizeof(uint64_t)) {
+                        uint64_t count;
+                        memcpy(&count, t.in.data(), sizeof(count));
+                        t.in.resize(sizeof(count) + count * sizeof(BlockRecord));
+                    }
+                }
+            }
+        }
+        BlockRecord record;
+        for (int i = 0; i < num_workers; i++) {
+            const std::vector<char>& in = transfers[i].in;
+            for (size_t offset = sizeof(uint64_t); offset < in.size(); offset += sizeof(BlockRecord)) {
+                memcpy(&record, in.data() + offset, sizeof(record));
+                life_.AddBitBlock(Point(record.x, record.y), record.rows);
+            }
+        }
+        return true;
+    }
+
+    int index_;
+    int halo_steps_;
+    int coordinator_;
+    std::vector<int> peers_;
+    BitBlockLife life_;
+};
+
+}  // namespace
+
+DistributedLife::DistributedLife(int num_workers, int halo_steps) : ok_(true) {
+    workers_.resize(std::max(1, num_workers), Worker{-1, -1});
+    Start(std::min(std::max(1, halo_steps), MAX_HALO_STEPS));
+}
+
+DistributedLife::~DistributedLife() {
+    Stop();
+}
+
+int DistributedLife::WorkerOf(int64_t block_x, int num_workers) {
+    // Rounds down for negative columns too, so that stripes don't straddle the origin.
+    int64_t stripe = block_x / STRIPE_BLOCKS - (block_x % STRIPE_BLOCKS < 0 ? 1 : 0);
+    int64_t worker = stripe % num_workers;
+    return static_cast<int>(worker < 0 ? worker + num_workers : worker);
+}
+
+void DistributedLife::Start(int halo_steps) {
+    int n = num_workers();
+    // worker_ends[i] is worker i's end of its socket to the coordinator, and peers[i][j] worker
+    // i's end of its socket to worker j.
+    std::vector<int> worker_ends(n, -1);
+    std::vector<std::vector<int>> peers(n, std::vector<int>(n, -1));
+    bool sockets_ok = true;
+    for (int i = 0; i < n && sockets_ok; i++) {
+        int sv[2];
+        sockets_ok = SocketPair(sv);
+        if (sockets_ok) {
+            workers_[i].fd = sv[0];
+            worker_ends[i] = sv[1];
+        }
+        for (int j = 0; j < i && sockets_ok; j++) {
+            sockets_ok = SocketPair(sv);
+            if (sockets_ok) {
+                peers[i][j] = sv[0];
+                peers[j][i] = sv[1];
+            }
+        }
+    }
+    for (int i = 0; i < n && sockets_ok; i++) {
+        pid_t pid = fork();
+        if (pid == 0) {
+            // Only keep this worker's own sockets, so that every socket closes once the process
+            // at either end is gone.
+            for (int j = 0; j < n; j++) {
+                close(workers_[j].fd);
+                if (j != i) {
+                    close(worker_ends[j]);
+                    for (int k = 0; k < n; k++) {
+                        close(peers[j][k]);
+                    }
+                }
+            }
+            WorkerProcess(i, halo_steps, worker_ends[i], peers[i]).Run();
+            _exit(0);
+        }
+        workers_[i].pid = pid;
+        sockets_ok = pid > 0;
+    }
+    for (int i = 0; i < n; i++) {
+        close(worker_ends[i]);
+        for (int j = 0; j < n; j++) {
+            close(peers[i][j]);
+        }
+    }
+    if (!sockets_ok) {
+        Fail();
+    }
+}
+
+void DistributedLife::Stop() {
+    // Workers exit once their socket to the coordinator closes. One that hangs, or is deep in a
+    // long step, is terminated after STOP_WAIT_MS, and killed after as long again.
+    for (Worker& worker : workers_) {
+        if (worker.fd >= 0) {
+            close(worker.fd);
+            worker.fd = -1;
+        }
+    }
+    if (WaitForWorkers(STOP_WAIT_MS)) {
+        return;
+    }
+    SignalWorkers(SIGTERM);
+    if (WaitForWorkers(STOP_WAIT_MS)) {
+        return;
+    }
+    SignalWorkers(SIGKILL);
+    WaitForWorkers(-1);
+}
+
+bool DistributedLife::WaitForWorkers(int timeout_ms) {
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(std::max(0, timeout_ms));
+    while (true) {
+        bool waiting = false;
+        for (Worker& worker : workers_) {
+            if (worker.pid <= 0) {
+                continue;
+            }
+            int status;
+            pid_t done = waitpid(worker.pid, &status, timeout_ms < 0 ? 0 : WNOHANG);
+            if (done == worker.pid || (done < 0 && errno != EINTR)) {
+                worker.pid = -1;
+            } else {
+                waiting = true;
+            }
+        }
+        if (!waiting) {
+            return true;
+        }
+        if (timeout_ms >= 0 && std::chrono::steady_clock::now() >= deadline) {
+            return false;
+        }
+        if (timeout_ms >= 0) {
+            usleep(10 * 1000);
+        }
+    }
+}
+
+void DistributedLife::SignalWorkers(int signal) {
+    for (const Worker& worker : workers_) {
+        if (worker.pid > 0) {
+            kill(worker.pid, signal);
+        }
+    }
+}
+
+void DistributedLife::Fail() {
+    ok_ = false;
+    pending_.clear();
+    Stop();
+}
+
+bool DistributedLife::Broadcast(const void* command, size_t size) {
+    if (!ok_) {
+        return false;
+    }
+    for (const Worker& worker : workers_) {
+        if (!WriteAll(worker.fd, command, size)) {
+            Fail();
+            return false;
+        }
+    }
+    return true;
+}
+
+void DistributedLife::set_rule(const Rule& rule) {
+    Life::set_rule(rule);
+    Command command = Command();
+    command.type = SET_RULE;
+    command.birth = rule.birth;
+    command.survival = rule.survival;
+    Broadcast(&command, sizeof(command));
+}
+
+void DistributedLife::AddLivePoint(const Point& p) {
+    BlockArray& rows = pending_.emplace(Point(p.x >> 6, p.y >> 6), BlockArray{{0}}).first->second;
+    rows[p.y & 63] |= uint64_t(1) << (p.x & 63);
+}
+
+void DistributedLife::AddBitBlock(const Point& block_index, const uint64_t* rows) {
+    BlockArray& block = pending_.emplace(block_index, BlockArray{{0}}).first->second;
+    for (int y = 0; y < 64; y++) {
+        block[y] |= rows[y];
+    }
+}
+
+void DistributedLife::SendPending() {
+    if (!ok_ || pending_.empty()) {
+        pending_.clear();
+        return;
+    }
+    int n = num_workers();
+    std::vector<std::vector<BlockRecord>> records(n);
+    for (const auto& p : pending_) {
+        BlockRecord record;
+        record.x = p.first.x;
+        record.y = p.first.y;
+        memcpy(record.rows, p.second.data(), sizeof(record.rows));
+        records[WorkerOf(p.first.x, n)].push_back(record);
+    }
+    pending_.clear();
+    for (int i = 0; i < n; i++) {
+        if (records[i].empty()) {
+            continue;
+        }
+        Command command = Command();
+        command.type = ADD_BLOCKS;
+        command.n = static_cast<int64_t>(records[i].size());
+        if (!WriteAll(workers_[i].fd, &command, sizeof(command)) ||
+            !WriteAll(workers_[i].fd, records[i].data(), records[i].size() * sizeof(BlockRecord))) {
+            Fail();
+            return;
+        }
+    }
+}
+
+void DistributedLife::DoStep() {
+    DoSteps(1);
+}
+
+void DistributedLife::DoSteps(int64_t n) {
+    SendPending();
+    Command command = Command();
+    command.type = STEP;
+    command.n = n;
+    if (!Broadcast(&command, sizeof(command))) {
+        return;
+    }
+    for (const Worker& worker : workers_) {
+        char stepped;
+        if (!ReadAll(worker.fd, &stepped, 1)) {
+            Fail();
+            return;
+        }
+    }
+}
+
+template <typename F>
+void DistributedLife::GatherBlocks(const Range& x_range, const Range& y_range, F f) {
+    SendPending();
+    Command command = Command();
+    command.type = GET_BLOCKS;
+    command.x_first = x_range.first;
+    command.x_second = x_range.second;
+    command.y_first = y_range.first;
+    command.y_second = y_range.second;
+    if (!Broadcast(&command, sizeof(command))) {
+        return;
+    }
+    // Workers answer in full before the next command, so reading them one by one is safe.
+    BlockRecord record;
+    for (const Worker& worker : workers_) {
+        uint64_t count;
+        if (!ReadAll(worker.fd, &count, sizeof(count))) {
+            Fail();
+            return;
+        }
+        for (uint64_t i = 0; i < count; i++) {
+            if (!ReadAll(worker.fd, &record, sizeof(record))) {
+                Fail();
+                return;
+            }
+            f(record);
+        }
+    }
+}
+
+std::vector<Point> DistributedLife::LivePoints() {
+    std::vector<Point> live_points;
+    Range everything(std::numeric_limits<int64_t>::min(), std::numeric_limits<int64_t>::max());
+    ForEachLivePoint(everything, everything, [&](int64_t x, int64_t y) { live_points.emplace_back(x, y); });
+    return live_points;
+}
+
+void DistributedLife::CopyBitBlocks(std::vector<BitBlock>* blocks) {
+    Range everything(std::numeric_limits<int64_t>::min(), std::numeric_limits<int64_t>::max());
+    GatherBlocks(everything, everything, [blocks](const BlockRecord& record) {
+        blocks->push_back(BitBlock{Point(record.x, record.y), {{0}}});
+        memcpy(blocks->back().rows.data(), record.rows, sizeof(record.rows));
+    });
+}
+
+void DistributedLife::VisitLivePoints(const Range& x_range, const Range& y_range, LivePointVisitor* visitor) {
+    if (x_range.first > x_range.second || y_range.first > y_range.second) {
+        return;
+    }
+    GatherBlocks(x_range, y_range, [&](const BlockRecord& record) {
+        int64_t x_origin = record.x * 64;
+        int64_t y_origin = record.y * 64;
+        int x0 = x_range.first > x_origin ? static_cast<int>(x_range.first - x_origin) : 0;
+        int x1 = x_range.second < x_origin + 63 ? static_cast<int>(x_range.second - x_origin) : 63;
+        int y0 = y_range.first > y_origin ? static_cast<int>(y_range.first - y_origin) : 0;
+        int y1 = y_range.second < y_origin + 63 ? static_cast<int>(y_range.second - y_origin) : 63;
+        uint64_t columns = (~uint64_t(0) >> (63 - x1)) & (~uint64_t(0) << x0);
+        for (int y = y0; y <= y1; y++) {
+            for (uint64_t row = record.rows[y] & columns; row != 0; row &= row - 1) {
+                visitor->Visit(x_origin + __builtin_ctzll(row), y_origin + y);
+            }
+        }
+    });
+}
+
+void DistributedLife::GatherCounts(uint64_t* live_cells, uint64_t* blocks) {
+    *live_cells = 0;
+    *blocks = 0;
+    SendPending();
+    Command command = Command();
+    command.type = GET_COUNTS;
+    if (!Broadcast(&command, sizeof(command))) {
+        return;
+    }
+    for (const Worker& worker : workers_) {
+        Counts counts;
+        if (!ReadAll(worker.fd, &counts, sizeof(counts))) {
+            Fail();
+            *live_cells = 0;
+            *blocks = 0;
+            return;
+        }
+        *live_cells += counts.live_cells;
+        *blocks += counts.blocks;
+    }
+}
+
+uint64_t DistributedLife::Population() {
+    uint64_t live_cells;
+    uint64_t blocks;
+    GatherCounts(&live_cells, &blocks);
+    return live_cells;
+}
+
+size_t DistributedLife::TableSize() {
+    uint64_t live_cells;
+    uint64_t blocks;
+    GatherCounts(&live_cells, &blocks);
+    return blocks;
+}
+
+void DistributedLife::CollectStats(StepStats* stats) {
+    uint64_t blocks;
+    GatherCounts(&stats->live_cells, &blocks);
+    stats->table_size = blocks;
+}
+
+}  // namespace conway
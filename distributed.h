@@ -0,0 +1,101 @@
+#ifndef CONWAY_DISTRIBUTED_H
+#define CONWAY_DISTRIBUTED_H
+
+#include <sys/types.h>
+
+#include <array>
+#include <cstdint>
+#include <vector>
+
+#include "life.h"
+
+namespace conway {
+
+// Splits the plane across worker processes, for universes that outgrow one process. The plane
+// is cut into vertical stripes of STRIPE_BLOCKS columns of 64x64 blocks, dealt out to the
+// workers in turn so that a pattern near the origin still spreads across all of them. Each
+// worker steps the blocks of its stripes with a BitBlockLife, along with a halo: copies of the
+// blocks just outside its stripes, which the workers owning them send it directly. Errors from
+// outside a halo creep in one cell per generation and take 64 generations to cross it, so
+// workers exchange halos only every halo_steps generations, up to MAX_HALO_STEPS, and results
+// are the same as stepping in one process. The Life itself is the coordinator: it sends cells
+// to the workers that own them, and asks all of them for steps, live cells and counts.
+//
+// Workers are forked, and talk to the coordinator and to each other over Unix domain sockets,
+// so this runs on one machine. Create it before starting other threads, which fork doesn't
+// copy.
+class DistributedLife : public Life {
+    public:
+    static const int STRIPE_BLOCKS = 8;
+    static const int MAX_HALO_STEPS = 64;
+
+    // Starts num_workers >= 1 workers. halo_steps is clamped to [1, MAX_HALO_STEPS].
+    explicit DistributedLife(int num_workers, int halo_steps = 16);
+    // Stops the workers.
+    ~DistributedLife();
+
+    void set_rule(const Rule& rule) override;
+
+    void AddLivePoint(const Point& p) override;
+    void AddBitBlock(const Point& block_index, const uint64_t* rows) override;
+    std::vector<Point> LivePoints() override;
+    void CopyBitBlocks(std::vector<BitBlock>* blocks) override;
+    void VisitLivePoints(const Range& x_range, const Range& y_range, LivePointVisitor* visitor) override;
+    // Blocks summed over the workers, without their halos.
+    size_t TableSize() override;
+
+    // Live cells summed over the workers.
+    uint64_t Population();
+
+    int num_workers() const { return static_cast<int>(workers_.size()); }
+    // False once a worker couldn't be started or stopped answering, after which the workers
+    // are no longer asked anything and the Life appears empty.
+    bool ok() const { return ok_; }
+
+    // The worker computing the blocks of column block_x, i.e. cells with x >> 6 == block_x.
+    static int WorkerOf(int64_t block_x, int num_workers);
+
+    protected:
+    void DoStep() override;
+    // Every worker runs all n generations, exchanging halos as needed, before answering.
+    void DoSteps(int64_t n) override;
+    void CollectStats(StepStats* stats) override;
+
+    private:
+    typedef std::array<uint64_t, 64> BlockArray;
+
+    struct Worker {
+        pid_t pid;
+        // The coordinator's end of the socket to the worker.
+        int fd;
+    };
+
+    // How long Stop waits for the workers to exit before signalling them.
+    static const int STOP_WAIT_MS = 2000;
+
+    void Start(int halo_steps);
+    void Stop();
+    // Reaps the workers that exit within timeout_ms, or waits for all of them if it is
+    // negative. Returns whether every worker exited.
+    bool WaitForWorkers(int timeout_ms);
+    void SignalWorkers(int signal);
+    // Sends the cells added since the last command to their workers.
+    void SendPending();
+    // Sends command to every worker, failing the Life if any can't be reached.
+    bool Broadcast(const void* command, size_t size);
+    // Asks every worker for its blocks overlapping the rectangle and calls f(block) for each.
+    template <typename F>
+    void GatherBlocks(const Range& x_range, const Range& y_range, F f);
+    // Sums the live cells and blocks of the workers.
+    void GatherCounts(uint64_t* live_cells, uint64_t* blocks);
+    void Fail();
+
+    std::vector<Worker> workers_;
+    // Cells added and not yet sent, by block index.
+    PointMap<BlockArray> pending_;
+    bool ok_;
+};
+
+}  // namespace conway
+
+#endif
@@ -1,18 +1,26 @@
 #include <algorithm>
-#include <fstream>
 #include <cmath>
+#include <cstdlib>
 #include <memory>
 #include <iostream>
+#include <limits>
 #include <regex>
 
 #include <GLUT/glut.h>
 
+#include "checkpoint.h"
 #include "life.h"
+#include "rle.h"
+#include "simulation.h"
 
 static bool paused = true;
-static std::unique_ptr<conway::Life> life;
+// Only used from the simulation thread, so it has to outlive simulation.
+static conway::CheckpointWriter checkpoint_writer;
+static std::unique_ptr<conway::Simulation> simulation;
 static int scaleFactor = 8;
 static int delay_ms = 100;
+static std::string rule_string;
+static bool show_stats = false;
 static std::pair<int64_t, int64_t> viewport_center{0, 0};
 static std::pair<int64_t, int64_t> x_range{-1L << scaleFactor, 1L << scaleFactor};
 static std::pair<int64_t, int64_t> y_range{-1L << scaleFactor, 1L << scaleFactor};
@@ -26,30 +34,59 @@ void displayCallback() {
     // Display goes wild at the edges of the int64 space so try to downsample to 2^16
     int downscale = std::max(0, scaleFactor - 16);
     int window_dim = 1 << (scaleFactor - 1 - downscale);
-    glBegin(GL_POINTS);
-    glColor4f(1.0, 1.0, 1.0, 1.0);
-    for (const auto& p : life->LivePoints()) {
-        glVertex2d((double)((p.x - viewport_center.first) >> downscale) / window_dim,
-                   (double)((p.y - viewport_center.second) >> downscale) / window_dim);
+    const conway::Snapshot& snapshot = simulation->LatestSnapshot();
+    if (snapshot.density_level == 0) {
+        glPointSize(1);
+        glBegin(GL_POINTS);
+        glColor4f(1.0, 1.0, 1.0, 1.0);
+        for (const auto& p : snapshot.live_points) {
+            glVertex2d((double)((p.x - viewport_center.first) >> downscale) / window_dim,
+                       (double)((p.y - viewport_center.second) >> downscale) / window_dim);
+        }
+        glEnd();
+    } else {
+        // One point per tile at its center, brighter the more of its cells are alive. The square
+        // root keeps sparse regions, such as a trail of gliders, visible.
+        int level = snapshot.density_level;
+        double half_tile = std::ldexp(1.0, level - scaleFactor);
+        glPointSize((GLfloat)std::max(1.0, std::ceil(800 * half_tile)));
+        glBegin(GL_POINTS);
+        for (const auto& tile : snapshot.tiles) {
+            double brightness = std::sqrt(std::min(1.0, std::ldexp((double)tile.live_cells, -2 * level)));
+            glColor4f(brightness, brightness, brightness, 1.0);
+            // Wrapping differences, which fit int64 for every tile in view.
+            int64_t dx = (int64_t)(((uint64_t)tile.index.x << level) - (uint64_t)viewport_center.first);
+            int64_t dy = (int64_t)(((uint64_t)tile.index.y << level) - (uint64_t)viewport_center.second);
+            glVertex2d((double)(dx >> downscale) / window_dim + half_tile,
+                       (double)(dy >> downscale) / window_dim + half_tile);
+        }
+        glEnd();
     }
-    glEnd();
 
     glRasterPos2d(-0.95, 0.9);
     char buf[512];
-    sprintf(buf, "Generation: %lld - Delay: %dms - Scale: 2^%d [(%lld, %lld), (%lld, %lld)]",
-            life->generation(), delay_ms, scaleFactor, x_range.first, y_range.second, x_range.second, y_range.first);
+    sprintf(buf, "Generation: %lld - Rule: %s - Delay: %dms - Scale: 2^%d [(%lld, %lld), (%lld, %lld)]",
+            snapshot.generation, rule_string.c_str(), delay_ms, scaleFactor, x_range.first, y_range.second,
+            x_range.second, y_range.first);
     for (char c : buf) {
         if (c == '\0') { break; }
         glutBitmapCharacter(GLUT_BITMAP_HELVETICA_12, c);
     }
-    glutSwapBuffers();
-}
-
-void timerCallback(int unused) {
-    if (!paused) {
-        life->Step();
+    if (show_stats && snapshot.has_stats) {
+        // One counter per line below the status line.
+        std::string stats = conway::FormatStats(snapshot.stats, '\n');
+        double y = 0.85;
+        glRasterPos2d(-0.95, y);
+        for (char c : stats) {
+            if (c == '\n') {
+                y -= 0.04;
+                glRasterPos2d(-0.95, y);
+            } else {
+                glutBitmapCharacter(GLUT_BITMAP_HELVETICA_12, c);
+            }
+        }
     }
-    glutTimerFunc(delay_ms, timerCallback, 0);
+    glutSwapBuffers();
 }
 
 void displayRateCallback(int unused) {
@@ -58,14 +95,20 @@ void displayRateCallback(int unused) {
 }
 
 void fpsCallback(int unused) {
-    std::cout << "Generation: " << life->generation() << std::endl;
+    const conway::Snapshot& snapshot = simulation->LatestSnapshot();
+    if (show_stats && snapshot.has_stats) {
+        std::cout << conway::FormatStats(snapshot.stats) << std::endl;
+    } else {
+        std::cout << "Generation: " << snapshot.generation << std::endl;
+    }
     glutTimerFunc(1000, fpsCallback, 0);
 }
 
-void PrintLivePoints() {
-    for (const conway::Point p : life->LivePoints()) {
-        std::cout << "LivePoint: (" << p.x << ", " << p.y << ")" << std::endl;
-    }
+void PrintLivePoints(conway::Life* life) {
+    conway::Range everything(std::numeric_limits<int64_t>::min(), std::numeric_limits<int64_t>::max());
+    life->ForEachLivePoint(everything, everything, [](int64_t x, int64_t y) {
+        std::cout << "LivePoint: (" << x << ", " << y << ")" << std::endl;
+    });
 }
 
 void correctZoom() {
@@ -82,6 +125,27 @@ void correctZoom() {
         x_range = std::make_pair(viewport_center.first - window_dim, viewport_center.first + window_dim);
         y_range = std::make_pair(viewport_center.second - window_dim, viewport_center.second + window_dim);
     }
+    // Past about a cell per pixel, publish the live cells per tile instead of every live cell,
+    // with at most 512 tiles across the window.
+    simulation->SetViewport(x_range, y_range, std::max(0, scaleFactor - 9));
+}
+
+void ExportRLE(conway::Life* life) {
+    std::string filename = "generation-" + std::to_string(life->generation()) + ".rle";
+    if (conway::SaveRLE(filename, life)) {
+        std::cout << "Exported " << filename << std::endl;
+    } else {
+        std::cerr << "Could not write " << filename << std::endl;
+    }
+}
+
+void ExportCheckpoint(conway::Life* life) {
+    if (!checkpoint_writer.Wait()) {
+        std::cerr << "Could not write the previous checkpoint" << std::endl;
+    }
+    std::string filename = "generation-" + std::to_string(life->generation()) + ".ckpt";
+    checkpoint_writer.Save(filename, life);
+    std::cout << "Writing " << filename << std::endl;
 }
 
 void keyCallback(unsigned char key, int x, int y) {
@@ -112,75 +176,38 @@ void keyCallback(unsigned char key, int x, int y) {
             break;
         case '{':
             delay_ms += 10;
+            simulation->SetDelay(delay_ms);
             break;
         case '}':
             delay_ms = std::max(0, delay_ms - 10);
+            simulation->SetDelay(delay_ms);
             break;
         case 'p':
             paused = !paused;
+            simulation->SetPaused(paused);
             break;
         case 'n':
-            life->Step();
+            simulation->Step();
             break;
         case 'l':
-            PrintLivePoints();
+            simulation->Run(PrintLivePoints);
+            break;
+        case 'e':
+            simulation->Run(ExportRLE);
+            break;
+        case 'c':
+            simulation->Run(ExportCheckpoint);
+            break;
+        case 'i':
+            show_stats = !show_stats;
+            simulation->SetStatsEnabled(show_stats);
             break;
         default:
             break;
     }
 }
 
-void LoadRLE(std::string filename, conway::Life* life) {
-    std::regex comment_re("#.*");
-    std::regex header_re("x = ([0-9]+), y = ([0-9]+).*");
-    std::regex rle_re("(?:(?:[0-9]+)?(?:[ob$])|!)");
-    std::regex rle_token_re("([0-9]+)([ob$])");
-    std::smatch match;
-    int x, y;
-    int x_pos, y_pos;
-
-    std::ifstream in(filename);
-    std::string line;
-    while (std::getline(in, line)) {
-        if (std::regex_match(line, match, comment_re)) {
-            continue;
-        } else if (std::regex_match(line, match, header_re)) {
-            x = std::stoi(match[1].str());
-            y = std::stoi(match[2].str());
-            x_pos = -x / 2;
-            y_pos = y / 2;
-        } else {
-            std::sregex_iterator next(line.begin(), line.end(), rle_re);
-            std::sregex_iterator end;
-            while (next != end) {
-                std::string token = next->str();
-                if (token == "o" || token == "b" || token == "$") {
-                    token = "1" + token;
-                }
-                if (std::regex_match(token, match, rle_token_re)) {
-                    int n = std::stoi(match[1].str());
-                    std::string type = match[2].str();
-                    if (type == "b") {
-                        x_pos += n;
-                    } else if (type == "o") {
-                        for (int i = 0; i < n; i++) {
-                            life->AddLivePoint(x_pos++, y_pos);
-                        }
-                    } else if (type == "$") {
-                        x_pos = -x / 2;
-                        y_pos -= n;
-                    }
-                }
-                if (token == "!") {
-                    return;
-                }
-                next++;
-            }
-        }
-    }
-}
-
-void ReadInput() {
+void ReadInput(conway::Life* life) {
     std::regex point_re("[(](-?[0-9]+), (-?[0-9-]+)[)] *");
     std::string line;
     std::smatch match;
@@ -196,23 +223,57 @@ void ReadInput() {
 int main(int argc, char** argv) {
     std::cout << "Starting Conway!" << std::endl;
 
+    // Usage: life [--rule RULE] [--workers N] [FILE], where RULE overrides the rule of the file. A
+    // torus in the rule, e.g. "B3/S23:T512,512", picks DenseTorusLife when the torus fits in
+    // memory, and RULE can put a pattern of the plane on a torus. --workers splits a pattern of
+    // the plane across N worker processes.
+    std::string filename;
+    std::string rule_arg;
+    int workers = 0;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--rule" && i + 1 < argc) {
+            rule_arg = argv[++i];
+        } else if (arg == "--workers" && i + 1 < argc) {
+            workers = std::max(1, std::atoi(argv[++i]));
+        } else if (arg.size() > 1 && arg[0] == '-' && arg[1] != '-') {
+            // Left to glutInit, e.g. -geometry 400x400.
+            if ((arg == "-display" || arg == "-geometry") && i + 1 < argc) {
+                i++;
+            }
+        } else {
+            filename = arg;
+        }
+    }
+
+    // life.reset(new conway::LiveLife());
+    // life.reset(new conway::BlockLife());
+    // life.reset(new conway::HashLife());
+    // DistributedLife forks its workers here, before GLUT starts, since forking a process that
+    // set up Cocoa isn't safe on macOS, and before the simulation thread starts.
+    std::unique_ptr<conway::Life> life;
+    std::string error;
+    if (!conway::LoadPattern(filename, rule_arg, workers, &life, &error)) {
+        std::cerr << error << std::endl;
+        return 1;
+    }
+    if (filename.empty()) {
+        ReadInput(life.get());
+    }
+
     glutInit(&argc, argv);
     glutInitDisplayMode(GLUT_RGB);
     glutInitWindowSize(800, 800);
     glutCreateWindow("Conway's Game of Life");
 
-    // life.reset(new conway::LiveLife());
-    life.reset(new conway::BlockLife());
-    if (argc == 2) {
-        LoadRLE(argv[1], life.get());
-    } else {
-        ReadInput();
-    }
+    rule_string = conway::RuleString(life->rule(), life->torus());
+    simulation.reset(new conway::Simulation(std::move(life)));
+    simulation->SetDelay(delay_ms);
+    correctZoom();
 
     glClearColor(0.0,0.0,0.3,1.0);
     glutDisplayFunc(displayCallback);
     glutTimerFunc(30, displayRateCallback, 0);
-    glutTimerFunc(delay_ms, timerCallback, 0);
     glutTimerFunc(1000, fpsCallback, 0);
     glutKeyboardFunc(keyCallback);
 
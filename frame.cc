@@ -0,0 +1,444 @@
+#include "frame.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <limits>
+
+#include "density.h"
+
+namespace conway {
+
+namespace {
+
+const uint8_t LIVE[3] = {255, 255, 255};
+// glClearColor(0.0, 0.0, 0.3, 1.0) in the driver.
+const uint8_t BACKGROUND[3] = {0, 0, 77};
+
+// Fills the size x size pixel square centered on (x, y), in the normalized coordinates of the
+// driver's gluOrtho2D(-1, 1, -1, 1), with color, covering the pixels whose centers fall inside
+// the square like an OpenGL point of that size. As with OpenGL points, squares whose center is
+// outside the frame aren't drawn at all.
+void FillSquare(double x, double y, double size, const uint8_t* color, Frame* frame) {
+    if (x < -1 || x > 1 || y < -1 || y > 1) {
+        return;
+    }
+    double window_x = (x + 1) * frame->width / 2;
+    double window_y = (y + 1) * frame->height / 2;
+    int left = std::max(0, static_cast<int>(std::ceil(window_x - size / 2 - 0.5)));
+    int right = std::min(frame->width - 1, static_cast<int>(std::floor(window_x + size / 2 - 0.5)));
+    int bottom = std::max(0, static_cast<int>(std::ceil(window_y - size / 2 - 0.5)));
+    int top = std::min(frame->height - 1, static_cast<int>(std::floor(window_y + size / 2 - 0.5)));
+    for (int row = bottom; row <= top; row++) {
+        // OpenGL counts rows from the bottom.
+        uint8_t* pixel = &frame->rgb[3 * ((frame->height - 1 - row) * static_cast<size_t>(frame->width) + left)];
+        for (int column = left; column <= right; column++, pixel += 3) {
+            std::copy(color, color + 3, pixel);
+        }
+    }
+}
+
+class TilePainter : public DensityVisitor {
+    public:
+    TilePainter(const Point& center, int level, int scale_factor, Frame* frame)
+        : center_(center), level_(level), frame_(frame) {
+        downscale_ = std::max(0, scale_factor - 16);
+        window_dim_ = std::ldexp(1.0, scale_factor - 1 - downscale_);
+        half_tile_ = std::ldexp(1.0, level - scale_factor);
+        size_ = std::max(1.0, std::ceil(frame->width * half_tile_));
+    }
+
+    void Visit(int64_t x, int64_t y, uint64_t live_cells) override {
+        double brightness = std::sqrt(std::min(1.0, std::ldexp(static_cast<double>(live_cells), -2 * level_)));
+        uint8_t gray = static_cast<uint8_t>(std::lround(brightness * 255));
+        const uint8_t color[3] = {gray, gray, gray};
+        // Wrapping differences, which fit int64 for every tile in view.
+        int64_t dx = static_cast<int64_t>((static_cast<uint64_t>(x) << level_) - static_cast<uint64_t>(center_.x));
+        int64_t dy = static_cast<int64_t>((static_cast<uint64_t>(y) << level_) - static_cast<uint64_t>(center_.y));
+        FillSquare(static_cast<double>(dx >> downscale_) / window_dim_ + half_tile_,
+                   static_cast<double>(dy >> downscale_) / window_dim_ + half_tile_, size_, color, frame_);
+    }
+
+    private:
+    Point center_;
+    int level_;
+    int downscale_;
+    double window_dim_;
+    double half_tile_;
+    double size_;
+    Frame* frame_;
+};
+
+// Writes the bits of a deflate stream, which fills bytes from their least significant bit.
+class BitWriter {
+    public:
+    explicit BitWriter(std::vector<uint8_t>* out) : out_(out), bits_(0), count_(0) {}
+
+    // The low n bits of value, least significant first, as for extra bits and headers.
+    void Put(uint32_t value, int n) {
+        bits_ |= static_cast<uint64_t>(value) << count_;
+        count_ += n;
+        while (count_ >= 8) {
+            out_->push_back(static_cast<uint8_t>(bits_));
+            bits_ >>= 8;
+            count_ -= 8;
+        }
+    }
+
+    // A Huffman code of n bits, which goes most significant bit first.
+    void PutCode(uint32_t code, int n) {
+        uint32_t reversed = 0;
+        for (int i = 0; i < n; i++) {
+            reversed |= ((code >> i) & 1) << (n - 1 - i);
+        }
+        Put(reversed, n);
+    }
+
+    void Flush() {
+        if (count_ > 0) {
+            Put(0, 8 - count_);
+        }
+    }
+
+    private:
+    std::vector<uint8_t>* out_;
+    uint64_t bits_;
+    int count_;
+};
+
+const int LENGTH_BASE[29] = {3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+                             35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258};
+const int LENGTH_EXTRA[29] = {0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+                              3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0};
+const int DISTANCE_BASE[30] = {1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385,
+                               513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577};
+const int DISTANCE_EXTRA[30] = {0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7,
+                                8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13};
+const int MAX_MATCH = 258;
+const size_t MAX_DISTANCE = 32768;
+
+// A literal, the end of block or a length code in the fixed Huffman code of deflate.
+void PutSymbol(int symbol, BitWriter* bits) {
+    if (symbol < 144) {
+        bits->PutCode(0x30 + symbol, 8);
+    } else if (symbol < 256) {
+        bits->PutCode(0x190 + symbol - 144, 9);
+    } else if (symbol < 280) {
+        bits->PutCode(symbol - 256, 7);
+    } else {
+        bits->PutCode(0xC0 + symbol - 280, 8);
+    }
+}
+
+// Index of the last entry of base that is at most value.
+int CodeOf(const int* base, int size, int value) {
+    int code = 0;
+    while (code + 1 < size && base[code + 1] <= value) {
+        code++;
+    }
+    return code;
+}
+
+void PutMatch(int length, int distance, BitWriter* bits) {
+    int code = CodeOf(LENGTH_BASE, 29, length);
+    PutSymbol(257 + code, bits);
+    bits->Put(length - LENGTH_BASE[code], LENGTH_EXTRA[code]);
+    code = CodeOf(DISTANCE_BASE, 30, distance);
+    bits->PutCode(code, 5);
+    bits->Put(distance - DISTANCE_BASE[code], DISTANCE_EXTRA[code]);
+}
+
+// zlib stream of data in one block of fixed Huffman codes, matching each byte only against
+// the byte a pixel back and the byte a row of stride bytes back, the longest of the two.
+void Deflate(const std::vector<uint8_t>& data, size_t stride, std::vector<uint8_t>* out) {
+    out->push_back(0x78);
+    out->push_back(0x01);
+    BitWriter bits(out);
+    // Final block, fixed codes.
+    bits.Put(1, 1);
+    bits.Put(1, 2);
+    const size_t distances[2] = {3, stride};
+    size_t i = 0;
+    while (i < data.size()) {
+        size_t best = 0;
+        size_t best_distance = 0;
+        for (size_t distance : distances) {
+            if (distance > i || distance > MAX_DISTANCE) {
+                continue;
+            }
+            size_t limit = std::min<size_t>(MAX_MATCH, data.size() - i);
+            size_t length = 0;
+            while (length < limit && data[i + length] == data[i + length - distance]) {
+                length++;
+            }
+            if (length > best) {
+                best = length;
+                best_distance = distance;
+            }
+        }
+        if (best >= 3) {
+            PutMatch(static_cast<int>(best), static_cast<int>(best_distance), &bits);
+            i += best;
+        } else {
+            PutSymbol(data[i], &bits);
+            i++;
+        }
+    }
+    PutSymbol(256, &bits);
+    bits.Flush();
+
+    uint32_t a = 1;
+    uint32_t b = 0;
+    for (uint8_t byte : data) {
+        a = (a + byte) % 65521;
+        b = (b + a) % 65521;
+    }
+    uint32_t adler = (b << 16) | a;
+    for (int shift = 24; shift >= 0; shift -= 8) {
+        out->push_back(static_cast<uint8_t>(adler >> shift));
+    }
+}
+
+struct CrcTable {
+    CrcTable() {
+        for (uint32_t n = 0; n < 256; n++) {
+            uint32_t c = n;
+            for (int k = 0; k < 8; k++) {
+                c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+            }
+            entries[n] = c;
+        }
+    }
+
+    uint32_t entries[256];
+};
+
+uint32_t Crc32(const uint8_t* data, size_t size) {
+    static const CrcTable table;
+    uint32_t c = 0xFFFFFFFFu;
+    for (size_t i = 0; i < size; i++) {
+        c = table.entries[(c ^ data[i]) & 0xFF] ^ (c >> 8);
+    }
+    return c ^ 0xFFFFFFFFu;
+}
+
+void PutBigEndian(uint32_t value, std::vector<uint8_t>* out) {
+    for (int shift = 24; shift >= 0; shift -= 8) {
+        out->push_back(static_cast<uint8_t>(value >> shift));
+    }
+}
+
+void PutChunk(const char* type, const std::vector<uint8_t>& data, std::vector<uint8_t>* out) {
+    PutBigEndian(static_cast<uint32_t>(data.size()), out);
+    size_t start = out->size();
+    out->insert(out->end(), type, type + 4);
+    out->insert(out->end(), data.begin(), data.end());
+    PutBigEndian(Crc32(&(*out)[start], out->size() - start), out);
+}
+
+void EncodePNG(const Frame& frame, std::vector<uint8_t>* out) {
+    static const uint8_t SIGNATURE[8] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n'};
+    out->insert(out->end(), SIGNATURE, SIGNATURE + 8);
+
+    std::vector<uint8_t> header;
+    PutBigEndian(frame.width, &header);
+    PutBigEndian(frame.height, &header);
+    // 8 bits per channel, RGB, deflate, adaptive filters, not interlaced.
+    const uint8_t rest[5] = {8, 2, 0, 0, 0};
+    header.insert(header.end(), rest, rest + 5);
+    PutChunk("IHDR", header, out);
+
+    // Every row unfiltered, behind its filter type byte.
+    size_t stride = 1 + 3 * static_cast<size_t>(frame.width);
+    std::vector<uint8_t> rows;
+    rows.reserve(stride * frame.height);
+    for (int y = 0; y < frame.height; y++) {
+        rows.push_back(0);
+        const uint8_t* row = &frame.rgb[3 * static_cast<size_t>(frame.width) * y];
+        rows.insert(rows.end(), row, row + 3 * frame.width);
+    }
+    std::vector<uint8_t> compressed;
+    Deflate(rows, stride, &compressed);
+    PutChunk("IDAT", compressed, out);
+    PutChunk("IEND", std::vector<uint8_t>(), out);
+}
+
+const char* Extension(FrameFormat format) {
+    switch (format) {
+        case FrameFormat::RAW:
+            return "rgb";
+        case FrameFormat::PPM:
+            return "ppm";
+        case FrameFormat::PNG:
+            return "png";
+    }
+    return "";
+}
+
+}  // namespace
+
+void RenderFrame(Life* life, Point center, int scale_factor, Frame* frame) {
+    frame->generation = life->generation();
+    for (size_t i = 0; i < frame->rgb.size(); i += 3) {
+        std::copy(BACKGROUND, BACKGROUND + 3, &frame->rgb[i]);
+    }
+
+    // The viewport of correctZoom in the driver.
+    Range x_range;
+    Range y_range;
+    if (scale_factor == 64) {
+        center = Point(0, 0);
+        x_range = Range(std::numeric_limits<int64_t>::min(), std::numeric_limits<int64_t>::max());
+        y_range = x_range;
+    } else {
+        int64_t window_dim = int64_t(1) << (scale_factor - 1);
+        center.x = std::max(center.x, std::numeric_limits<int64_t>::min() + window_dim);
+        center.x = std::min(center.x, std::numeric_limits<int64_t>::max() - window_dim);
+        center.y = std::max(center.y, std::numeric_limits<int64_t>::min() + window_dim);
+        center.y = std::min(center.y, std::numeric_limits<int64_t>::max() - window_dim);
+        x_range = Range(center.x - window_dim, center.x + window_dim);
+        y_range = Range(center.y - window_dim, center.y + window_dim);
+    }
+
+    // And the points of displayCallback.
+    int level = std::max(0, scale_factor - 9);
+    if (level == 0) {
+        double window_dim = std::ldexp(1.0, scale_factor - 1);
+        life->ForEachLivePoint(x_range, y_range, [&](int64_t x, int64_t y) {
+            FillSquare(static_cast<double>(x - center.x) / window_dim, static_cast<double>(y - center.y) / window_dim,
+                       1, LIVE, frame);
+        });
+    } else {
+        TilePainter painter(center, level, scale_factor, frame);
+        life->VisitDensity(level, x_range, y_range, &painter);
+    }
+}
+
+bool ParseFrameFormat(const std::string& text, FrameFormat* format) {
+    if (text == "raw") {
+        *format = FrameFormat::RAW;
+    } else if (text == "ppm") {
+        *format = FrameFormat::PPM;
+    } else if (text == "png") {
+        *format = FrameFormat::PNG;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+void EncodeFrame(const Frame& frame, FrameFormat format, std::vector<uint8_t>* out) {
+    switch (format) {
+        case FrameFormat::RAW:
+            out->insert(out->end(), frame.rgb.begin(), frame.rgb.end());
+            break;
+        case FrameFormat::PPM: {
+            std::string header = "P6\n" + std::to_string(frame.width) + " " + std::to_string(frame.height) + "\n255\n";
+            out->insert(out->end(), header.begin(), header.end());
+            out->insert(out->end(), frame.rgb.begin(), frame.rgb.end());
+            break;
+        }
+        case FrameFormat::PNG:
+            EncodePNG(frame, out);
+            break;
+    }
+}
+
+FrameWriter::FrameWriter(FrameFormat format, const std::string& directory, int num_threads, int max_pending)
+    : format_(format),
+      directory_(directory),
+      max_pending_(std::max(1, max_pending)),
+      next_frame_(0),
+      next_to_write_(0),
+      done_(0),
+      writing_(false),
+      stopping_(false),
+      ok_(true) {
+    for (int i = 0; i < std::max(1, num_threads); i++) {
+        threads_.emplace_back(&FrameWriter::Encode, this);
+    }
+}
+
+FrameWriter::~FrameWriter() {
+    Finish();
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stopping_ = true;
+    }
+    queue_changed_.notify_all();
+    for (std::thread& thread : threads_) {
+        thread.join();
+    }
+}
+
+void FrameWriter::Write(Frame&& frame) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    frame_done_.wait(lock, [this] { return next_frame_ - done_ < max_pending_; });
+    queue_.emplace_back(next_frame_++, std::move(frame));
+    queue_changed_.notify_one();
+}
+
+bool FrameWriter::Finish() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    frame_done_.wait(lock, [this] { return done_ == next_frame_; });
+    return ok_;
+}
+
+void FrameWriter::Encode() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (true) {
+        queue_changed_.wait(lock, [this] { return stopping_ || !queue_.empty(); });
+        if (queue_.empty()) {
+            return;
+        }
+        int64_t number = queue_.front().first;
+        Frame frame = std::move(queue_.front().second);
+        queue_.pop_front();
+        lock.unlock();
+
+        std::vector<uint8_t> bytes;
+        EncodeFrame(frame, format_, &bytes);
+        if (directory_.empty()) {
+            lock.lock();
+            encoded_[number] = std::move(bytes);
+            WriteInOrder(&lock);
+            continue;
+        }
+        char name[32];
+        std::snprintf(name, sizeof(name), "frame-%06lld.%s", (long long)number, Extension(format_));
+        std::ofstream out(directory_ + "/" + name, std::ios::binary);
+        out.write(reinterpret_cast<const char*>(bytes.data()), bytes.size());
+        out.close();
+        bool written = static_cast<bool>(out);
+
+        lock.lock();
+        ok_ = ok_ && written;
+        done_++;
+        frame_done_.notify_all();
+    }
+}
+
+void FrameWriter::WriteInOrder(std::unique_lock<std::mutex>* lock) {
+    // Whoever is writing already picks up this frame once it is next.
+    if (writing_) {
+        return;
+    }
+    writing_ = true;
+    for (auto it = encoded_.find(next_to_write_); it != encoded_.end(); it = encoded_.find(next_to_write_)) {
+        std::vector<uint8_t> bytes = std::move(it->second);
+        encoded_.erase(it);
+        lock->unlock();
+        std::cout.write(reinterpret_cast<const char*>(bytes.data()), bytes.size());
+        bool written = static_cast<bool>(std::cout.flush());
+        lock->lock();
+        ok_ = ok_ && written;
+        next_to_write_++;
+        done_++;
+        frame_done_.notify_all();
+    }
+    writing_ = false;
+}
+
+}  // namespace conway
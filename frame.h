@@ -0,0 +1,96 @@
+#ifndef CONWAY_FRAME_H
+#define CONWAY_FRAME_H
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "life.h"
+
+namespace conway {
+
+// An RGB image in memory, 3 bytes per pixel, rows from the top.
+struct Frame {
+    Frame() : generation(0), width(0), height(0) {}
+    Frame(int width, int height) : generation(0), width(width), height(height), rgb(3 * width * height) {}
+
+    int64_t generation;
+    int width;
+    int height;
+    std::vector<uint8_t> rgb;
+};
+
+// Draws the cells of life around center into frame the way the window of the driver does at
+// scaleFactor scale_factor, i.e. 2^scale_factor cells across, without OpenGL: one pixel per live
+// cell up to scale 9, and past it a square per tile of level scale_factor - 9 at its center,
+// brighter the more of its cells are alive, over a dark blue background. center is moved, as
+// in the driver, so that the view doesn't cross the edges of the int64 plane.
+void RenderFrame(Life* life, Point center, int scale_factor, Frame* frame);
+
+enum class FrameFormat {
+    // The pixels alone, e.g. for ffmpeg -f rawvideo -pixel_format rgb24.
+    RAW,
+    // Binary PPM (P6).
+    PPM,
+    // PNG, compressed with runs of the pixel to the left or the one above only, which is cheap
+    // and does well on the large uniform areas of a Life frame.
+    PNG,
+};
+
+// Parses "raw", "ppm" or "png".
+bool ParseFrameFormat(const std::string& text, FrameFormat* format);
+
+// Appends frame in format to out.
+void EncodeFrame(const Frame& frame, FrameFormat format, std::vector<uint8_t>* out);
+
+// Encodes and writes frames on a pool of threads, so that the simulation goes on while earlier
+// frames are encoded. Frames are numbered from 0 in the order they are written. With a directory
+// each frame goes to its own file, e.g. frame-000042.png, otherwise they are written one after
+// the other to stdout, in order.
+class FrameWriter {
+    public:
+    // Holds at most max_pending frames that aren't written yet, so that Write waits for the
+    // encoders rather than filling memory when they fall behind.
+    FrameWriter(FrameFormat format, const std::string& directory, int num_threads, int max_pending);
+    // Waits for every frame to be written.
+    ~FrameWriter();
+
+    void Write(Frame&& frame);
+
+    // Waits for every frame to be written and returns whether they all were.
+    bool Finish();
+
+    private:
+    void Encode();
+    // Writes the encoded frames to stdout in order, from whichever encoder finished the next one.
+    void WriteInOrder(std::unique_lock<std::mutex>* lock);
+
+    FrameFormat format_;
+    std::string directory_;
+    int max_pending_;
+    std::vector<std::thread> threads_;
+
+    std::mutex mutex_;
+    std::condition_variable queue_changed_;
+    std::condition_variable frame_done_;
+    // Frames waiting for an encoder, with their numbers.
+    std::deque<std::pair<int64_t, Frame>> queue_;
+    // Encoded frames waiting for their turn on stdout.
+    std::map<int64_t, std::vector<uint8_t>> encoded_;
+    int64_t next_frame_;
+    int64_t next_to_write_;
+    // Frames written, or failed.
+    int64_t done_;
+    bool writing_;
+    bool stopping_;
+    bool ok_;
+};
+
+}  // namespace conway
+
+#endif
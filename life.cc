@@ -1,21 +1,308 @@
 #include "life.h"
 
+#include "thread_pool.h"
+
+#include <algorithm>
+#include <chrono>
 #include <cstdlib>
+#include <cstring>
 #include <iostream>
+#include <limits>
+#include <type_traits>
 
 namespace conway {
 
+namespace {
+
+#if defined(__GNUC__)
+#define CONWAY_ALWAYS_INLINE inline __attribute__((always_inline))
+#else
+#define CONWAY_ALWAYS_INLINE inline
+#endif
+
+const uint64_t ONES = 0x0101010101010101ULL;
+const uint64_t LOW_BITS = 0x7F7F7F7F7F7F7F7FULL;
+
+// Neighbor counts of cells, one bit of the count per word.
+template <typename V>
+struct Counts {
+    V ones;
+    V twos;
+    V fours;
+    V eights;
+
+    // Sets cells to the cells with exactly n live neighbors.
+    CONWAY_ALWAYS_INLINE void Equal(int n, V* cells) const {
+        *cells = ((n & 1) ? ones : ~ones) & ((n & 2) ? twos : ~twos) &
+                 ((n & 4) ? fours : ~fours) & ((n & 8) ? eights : ~eights);
+    }
+};
+
+// Clears the top bit of each byte of weights that holds a weight w with bit w of LIVE set.
+// Weights stay below 0x20, so adding 0x7F to a byte sets its top bit exactly when the byte
+// isn't zero.
+template <uint32_t LIVE>
+CONWAY_ALWAYS_INLINE uint64_t DeadBytes(uint64_t weights, std::integral_constant<int, -1>) {
+    return ~uint64_t(0);
+}
+template <uint32_t LIVE, int W>
+CONWAY_ALWAYS_INLINE uint64_t DeadBytes(uint64_t weights, std::integral_constant<int, W>) {
+    uint64_t dead = DeadBytes<LIVE>(weights, std::integral_constant<int, W - 1>());
+    if ((LIVE >> W) & 1) {
+        dead &= (weights ^ (W * ONES)) + LOW_BITS;
+    }
+    return dead;
+}
+
+// LiveLife and BlockLife weigh a live cell with n live neighbors as 11 + n and a dead one as n.
+// Returns the weights which are alive in the next generation, bit w for weight w.
+inline uint32_t LiveWeights(const Rule& rule) {
+    return rule.birth | (static_cast<uint32_t>(rule.survival) << 11);
+}
+
+// The kernels take the rule as a type with LiveCells for weights and Next for neighbor counts.
+// FixedRule is a rule fixed at compile time, so that kernels for it fold the rule into their
+// code.
+template <uint16_t B, uint16_t S>
+struct FixedRule {
+    static const uint16_t BIRTH = B;
+    static const uint16_t SURVIVAL = S;
+    static const uint32_t LIVE_WEIGHTS = B | (static_cast<uint32_t>(S) << 11);
+
+    explicit FixedRule(const Rule& rule) {}
+
+    // Converts eight weights at once into cells: a byte of the result is 1 if the cell of the
+    // weight in that byte is alive, else 0.
+    CONWAY_ALWAYS_INLINE uint64_t LiveCells(uint64_t weights) const {
+        return (~DeadBytes<LIVE_WEIGHTS>(weights, std::integral_constant<int, 19>()) >> 7) & ONES;
+    }
+
+    // Sets next to the next generation of the alive cells given their neighbor counts.
+    template <typename V>
+    CONWAY_ALWAYS_INLINE void Next(const V& alive, const Counts<V>& counts, V* next) const {
+        *next = V();
+        AddTerms(alive, counts, next, std::integral_constant<int, 8>());
+    }
+
+    private:
+    template <typename V>
+    static CONWAY_ALWAYS_INLINE void AddTerms(const V& alive, const Counts<V>& counts, V* next, std::integral_constant<int, -1>) {}
+    template <typename V, int N>
+    static CONWAY_ALWAYS_INLINE void AddTerms(const V& alive, const Counts<V>& counts, V* next, std::integral_constant<int, N>) {
+        AddTerms(alive, counts, next, std::integral_constant<int, N - 1>());
+        const bool born = (B >> N) & 1;
+        const bool survives = (S >> N) & 1;
+        if (born || survives) {
+            V equal;
+            counts.Equal(N, &equal);
+            if (born && survives) {
+                *next |= equal;
+            } else if (born) {
+                *next |= equal & ~alive;
+            } else {
+                *next |= equal & alive;
+            }
+        }
+    }
+};
+
+typedef FixedRule<1 << 3, (1 << 2) | (1 << 3)> LifeRule;
+typedef FixedRule<(1 << 3) | (1 << 6), (1 << 2) | (1 << 3)> HighLifeRule;
+typedef FixedRule<(1 << 3) | (1 << 6) | (1 << 7) | (1 << 8),
+                  (1 << 3) | (1 << 4) | (1 << 6) | (1 << 7) | (1 << 8)> DayAndNightRule;
+typedef FixedRule<1 << 2, 0> SeedsRule;
+
+// Any other rule, looked up at run time.
+struct AnyRule {
+    explicit AnyRule(const Rule& rule) : rule(rule), live_weights(LiveWeights(rule)) {}
+
+    uint64_t LiveCells(uint64_t weights) const {
+        uint64_t cells = 0;
+        for (int i = 0; i < 64; i += 8) {
+            cells |= static_cast<uint64_t>((live_weights >> ((weights >> i) & 0x1F)) & 1) << i;
+        }
+        return cells;
+    }
+
+    template <typename V>
+    CONWAY_ALWAYS_INLINE void Next(const V& alive, const Counts<V>& counts, V* next) const {
+        *next = V();
+        for (int n = 0; n <= 8; n++) {
+            uint64_t born = ((rule.birth >> n) & 1) != 0 ? ~uint64_t(0) : 0;
+            uint64_t survives = ((rule.survival >> n) & 1) != 0 ? ~uint64_t(0) : 0;
+            if ((born | survives) != 0) {
+                V equal;
+                counts.Equal(n, &equal);
+                *next |= equal & ((alive & survives) | (~alive & born));
+            }
+        }
+    }
+
+    Rule rule;
+    uint32_t live_weights;
+};
+
+// Kernels come in one version per rule type, listed by CONWAY_RULE_KERNELS in the order of
+// RuleIndex.
+#define CONWAY_RULE_KERNELS(kernel) \
+    {kernel<LifeRule>, kernel<HighLifeRule>, kernel<DayAndNightRule>, kernel<SeedsRule>, kernel<AnyRule>}
+const int NUM_RULE_KERNELS = 5;
+
+int RuleIndex(const Rule& rule) {
+    if (rule == Rule(LifeRule::BIRTH, LifeRule::SURVIVAL)) {
+        return 0;
+    } else if (rule == Rule(HighLifeRule::BIRTH, HighLifeRule::SURVIVAL)) {
+        return 1;
+    } else if (rule == Rule(DayAndNightRule::BIRTH, DayAndNightRule::SURVIVAL)) {
+        return 2;
+    } else if (rule == Rule(SeedsRule::BIRTH, SeedsRule::SURVIVAL)) {
+        return 3;
+    }
+    return 4;
+}
+
+}  // namespace
+
+void Life::AddLiveRow(int64_t x, int64_t y, const uint64_t* bits, size_t num_cells) {
+    for (size_t i = 0; i < num_cells; i += 64) {
+        uint64_t word = bits[i / 64];
+        if (num_cells - i < 64) {
+            word &= (uint64_t(1) << (num_cells - i)) - 1;
+        }
+        for (; word != 0; word &= word - 1) {
+            uint64_t column = static_cast<uint64_t>(x) + i + __builtin_ctzll(word);
+            AddLivePoint(static_cast<int64_t>(column), y);
+        }
+    }
+}
+
+void Life::AddBitBlock(const Point& block_index, const uint64_t* rows) {
+    for (int y = 0; y < 64; y++) {
+        if (rows[y] != 0) {
+            AddLiveRow(block_index.x * 64, block_index.y * 64 + y, &rows[y], 64);
+        }
+    }
+}
+
+void Life::CopyBitBlocks(std::vector<BitBlock>* blocks) {
+    // Position of each block in blocks.
+    PointMap<size_t> positions;
+    Range everything(std::numeric_limits<int64_t>::min(), std::numeric_limits<int64_t>::max());
+    ForEachLivePoint(everything, everything, [&](int64_t x, int64_t y) {
+        Point index(x >> 6, y >> 6);
+        auto position = positions.emplace(index, blocks->size());
+        if (position.second) {
+            blocks->push_back(BitBlock{index, {{0}}});
+        }
+        (*blocks)[position.first->second].rows[y & 63] |= uint64_t(1) << (x & 63);
+    });
+}
+
+void Life::VisitDensity(int level, const Range& x_range, const Range& y_range, DensityVisitor* visitor) {
+    PointMap<uint64_t> tiles;
+    ForEachLivePoint(x_range, y_range, [&](int64_t x, int64_t y) {
+        tiles.emplace(Point(x >> level, y >> level), 0).first->second++;
+    });
+    VisitTiles(level, &tiles, x_range, y_range, visitor);
+}
+
+void Life::DoSteps(int64_t n) {
+    for (int64_t i = 0; i < n; i++) {
+        this->DoStep();
+    }
+}
+
+void Life::CountBlocks(uint64_t* blocks, uint64_t* created) {
+    *blocks = 0;
+    *created = 0;
+}
+
+void Life::StepWithStats(int64_t n) {
+    uint64_t blocks_before;
+    uint64_t created_before;
+    CountBlocks(&blocks_before, &created_before);
+    stats_ = StepStats();
+    auto start = std::chrono::steady_clock::now();
+    if (n == 1) {
+        this->DoStep();
+    } else {
+        this->DoSteps(n);
+    }
+    stats_.step_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    stats_.generation = generation_;
+    stats_.steps = n;
+    uint64_t created;
+    CountBlocks(&stats_.blocks, &created);
+    stats_.blocks_created = created - created_before;
+    stats_.blocks_destroyed = blocks_before + stats_.blocks_created - stats_.blocks;
+    CollectStats(&stats_);
+}
+
+void Life::set_cycle_detection(bool enabled) {
+    if (!enabled) {
+        cycles_.reset();
+    } else if (!cycles_) {
+        cycles_.reset(new CycleDetector());
+        ResetHash();
+    }
+}
+
+void Life::ResetHash() {
+    hash_ = BoardHash();
+    Range everything(std::numeric_limits<int64_t>::min(), std::numeric_limits<int64_t>::max());
+    ForEachLivePoint(everything, everything, [this](int64_t x, int64_t y) { hash_.Add(Point(x, y)); });
+}
+
+// Steps one generation at a time, so that every generation's hash is compared, except for
+// jumping over whole periods once the cycle is confirmed.
+void Life::StepDetectingCycles(int64_t n) {
+    UpdateHash();
+    cycles_->Follow(generation_, hash_, rule_);
+    while (n > 0) {
+        Cycle cycle = cycles_->cycle();
+        if (cycle.period > 0 && n >= cycle.period) {
+            int64_t periods = n / cycle.period;
+            Point displacement(static_cast<int64_t>(static_cast<uint64_t>(cycle.displacement.x) * periods),
+                               static_cast<int64_t>(static_cast<uint64_t>(cycle.displacement.y) * periods));
+            if (displacement == Point(0, 0) || Translate(displacement)) {
+                generation_ += periods * cycle.period;
+                n -= periods * cycle.period;
+                cycles_->Jump(generation_, hash_);
+                continue;
+            }
+        }
+        generation_ += 1;
+        if (stats_enabled_) {
+            StepWithStats(1);
+        } else {
+            this->DoStep();
+        }
+        n--;
+        UpdateHash();
+        cycles_->Add(generation_, hash_, [this]() { return LivePoints(); });
+    }
+}
+
 LiveLife::LiveLife()
-    : live_points_(new std::vector<const Point>()),
-      weights_(new std::unordered_map<const Point, int>()) {
+    : live_points_(new std::vector<Point>()),
+      weights_(new PointMap<int>()),
+      live_weights_(LiveWeights(rule_)) {
     // Picked via experimentation.
-    weights_->max_load_factor(0.33);
+    weights_->max_load_factor(0.75);
 }
 
 LiveLife::~LiveLife() {}
 
 void LiveLife::AddLivePoint(const Point& p) {
     live_points_->push_back(p);
+    if (hashing()) {
+        hash_.Add(p);
+    }
+}
+
+void LiveLife::set_rule(const Rule& rule) {
+    Life::set_rule(rule);
+    live_weights_ = LiveWeights(rule);
 }
 
 // Iterates over all the live points and applies influence to the 3x3 block surrounding it.
@@ -38,37 +325,184 @@ void LiveLife::DoStep() {
         weights_->emplace(Point(p.x + 1, p.y + 1), 0).first->second++;
     }
     live_points_->clear();
-    for (auto it = weights_->begin(); it != weights_->end();) {
+    bool hashing = this->hashing();
+    weights_->Retain([this, hashing](PointMap<int>::value_type& weight) {
         // Basic generational garbage collection --
         // if the weight is still zero on this generation, erase it.
         // Helps reduce memory allocations because most points need
         // to be rechecked from generation to generation.
-        if (it->second == 0) {
-            it = weights_->erase(it);
-            continue;
+        if (weight.second == 0) {
+            return false;
         }
-        if (it->second == 3 || it->second == 13 || it->second == 14) {
-            live_points_->push_back(it->first);
+        bool live = (live_weights_ >> weight.second) & 1;
+        if (live) {
+            live_points_->push_back(weight.first);
         }
-        it->second = 0;
-        it++;
+        // Weights of 11 and up are live cells.
+        if (hashing && live != (weight.second >= 11)) {
+            if (live) {
+                hash_.Add(weight.first);
+            } else {
+                hash_.Remove(weight.first);
+            }
+        }
+        weight.second = 0;
+        return true;
+    });
+}
+
+bool LiveLife::Translate(const Point& displacement) {
+    for (Point& p : *live_points_) {
+        p = Point(static_cast<int64_t>(static_cast<uint64_t>(p.x) + displacement.x),
+                  static_cast<int64_t>(static_cast<uint64_t>(p.y) + displacement.y));
     }
+    hash_.Translate(displacement);
+    return true;
 }
 
-std::vector<const Point> LiveLife::LivePoints() {
+std::vector<Point> LiveLife::LivePoints() {
     return *live_points_;
 }
 
+void LiveLife::VisitLivePoints(const Range& x_range, const Range& y_range, LivePointVisitor* visitor) {
+    for (const Point& p : *live_points_) {
+        if (p.x >= x_range.first && p.x <= x_range.second && p.y >= y_range.first && p.y <= y_range.second) {
+            visitor->Visit(p.x, p.y);
+        }
+    }
+}
+
+size_t LiveLife::TableSize() {
+    return weights_->size();
+}
+
+void LiveLife::CollectStats(StepStats* stats) {
+    stats->live_cells = live_points_->size();
+    stats->table_size = weights_->size();
+    stats->table_capacity = weights_->capacity();
+    weights_->AddProbeLengths(&stats->total_probe_length, &stats->max_probe_length);
+}
+
+
+namespace {
+
+// Converts the weights of a block into its next cells, and sets CHANGED and CHANGED2 bits in
+// changes if they differ from the current and the previous cells.
+typedef void (*CellsKernel)(const Rule& rule, const char* weights, const char* cells, char* next, uint8_t* changes);
+
+template <typename R>
+void NextCells(const Rule& rule, const char* weights, const char* cells, char* next, uint8_t* changes) {
+    R r(rule);
+    uint64_t changed = 0;
+    uint64_t changed2 = 0;
+    for (int i = 0; i < 32 * 32; i += 8) {
+        uint64_t w, current, previous;
+        memcpy(&w, weights + i, 8);
+        memcpy(&current, cells + i, 8);
+        memcpy(&previous, next + i, 8);
+        uint64_t cell = r.LiveCells(w);
+        changed |= cell ^ current;
+        changed2 |= cell ^ previous;
+        memcpy(next + i, &cell, 8);
+    }
+    *changes = (changed != 0 ? 1 : 0) | (changed2 != 0 ? 2 : 0);
+}
+
+const CellsKernel CELLS_KERNELS[NUM_RULE_KERNELS] = CONWAY_RULE_KERNELS(NextCells);
+
+// Phases of BlockLife steps. Phases are told apart by address, so each name is defined once.
+const char* const WAKE_PHASE = "wake";
+const char* const STEP_PHASE = "step";
+const char* const PASS_PHASE = "pass";
+const char* const FINISH_PHASE = "finish";
+const char* const SPILL_PHASE = "spill";
+
+// Packs a row of 32 cells into bits, cell x into bit x. Multiplying gathers the low bit of each
+// byte of a little-endian word into the top byte.
+inline uint32_t PackCells(const char* cells) {
+    uint32_t bits = 0;
+    for (int i = 0; i < 32; i += 8) {
+        uint64_t word;
+        memcpy(&word, cells + i, 8);
+        bits |= static_cast<uint32_t>((word * 0x0102040810204080ULL) >> 56) << i;
+    }
+    return bits;
+}
+
+// The inverse of PackCells: copies each bit into its own byte and then tests the bytes like
+// LiveCells.
+inline void UnpackCells(uint32_t bits, char* cells) {
+    for (int i = 0; i < 32; i += 8) {
+        uint64_t spread = (((bits >> i) & 0xFF) * ONES) & 0x8040201008040201ULL;
+        uint64_t word = ((spread + 0x7F7F7F7F7F7F7F7FULL) >> 7) & ONES;
+        memcpy(cells + i, &word, 8);
+    }
+}
+
+}  // namespace
 
 const BlockLife::BlockArray BlockLife::EMPTY_BLOCK = BlockArray{{0}};
 
 BlockLife::BlockLife()
-  : blocks_(new std::unordered_map<const Point, BlockArray>()),
-    new_blocks_(new std::unordered_map<const Point, BlockArray>()) {
+  : blocks_(1),
+    pools_(1),
+    empty_blocks_(1),
+    step_count_(0),
+    new_blocks_(1),
+    changed_(1),
+    wake_(1),
+    created_(1),
+    retired_(1),
+    passes_(1),
+    hash_changes_(1),
+    edited_(false),
+    max_resident_blocks_(0),
+    spilled_cells_(),
+    next_spill_scan_(0),
+    evictions_(0),
+    faults_(0) {
 }
 
 BlockLife::~BlockLife() {}
 
+void BlockLife::set_num_threads(int num_threads) {
+    num_threads = std::max(1, num_threads);
+    pool_.reset(num_threads > 1 ? new WorkStealingPool(num_threads) : nullptr);
+    // More shards than threads so that merging the shards balances well.
+    std::vector<BlockMap> blocks(num_threads > 1 ? num_threads * 4 : 1);
+    std::vector<BlockPool<Block>> pools(blocks.size());
+    blocks_.swap(blocks);
+    pools_.swap(pools);
+    changed_.assign(blocks_.size(), std::vector<Point>());
+    empty_blocks_.assign(blocks_.size(), std::vector<EmptyBlock>());
+    // Blocks retired and not yet freed go with the old pools, and every block is linked anew.
+    created_.assign(blocks_.size(), std::vector<Block*>());
+    retired_.assign(blocks_.size(), std::vector<Block*>());
+    for (auto& shard : blocks) {
+        for (const auto& p : shard) {
+            size_t new_shard = shardOf(p.first);
+            Block* block = pools_[new_shard].Allocate();
+            *block = *p.second;
+            blocks_[new_shard].emplace(p.first, block);
+            created_[new_shard].push_back(block);
+            if (block->changes != 0) {
+                changed_[new_shard].push_back(p.first);
+            }
+            if (block->queued) {
+                empty_blocks_[new_shard].push_back(EmptyBlock{p.first, block->empty_since + RECYCLE_STEPS});
+            }
+        }
+    }
+    for (auto& queue : empty_blocks_) {
+        std::sort(queue.begin(), queue.end(), [](const EmptyBlock& a, const EmptyBlock& b) { return a.due < b.due; });
+    }
+    new_blocks_.assign(blocks_.size(), std::vector<std::pair<Point, BlockArray>>());
+    wake_.assign(blocks_.size(), PointMap<uint8_t>());
+    passes_.assign(blocks_.size(), std::vector<PassResult>());
+    hash_changes_.assign(blocks_.size(), BoardHash());
+    LinkBlocks();
+}
+
 Point BlockLife::toBlockIndex(const Point& p) {
     return Point(p.x & BLOCK_MASK, p.y & BLOCK_MASK);
 }
@@ -77,210 +511,2474 @@ Point BlockLife::toBlockCoordinates(const Point& p) {
     return Point(p.x & (~BLOCK_MASK), p.y & (~BLOCK_MASK));
 }
 
+size_t BlockLife::shardOf(const Point& block_index) {
+    if (blocks_.size() == 1) {
+        return 0;
+    }
+    uint64_t hash = static_cast<uint64_t>(block_index.x >> BLOCK_SHIFT) * 0x9E3779B97F4A7C15ULL;
+    hash ^= static_cast<uint64_t>(block_index.y >> BLOCK_SHIFT) * 0xC2B2AE3D27D4EB4FULL;
+    return (hash ^ (hash >> 32)) % blocks_.size();
+}
+
+// Returns the block for adding points to, marking it as changed. Its previous cells are
+// filled with a value cells never take, since they no longer lead to its current cells:
+// that keeps the block and its neighbors from being skipped until it has been computed
+// twice.
+BlockLife::Block& BlockLife::EditBlock(const Point& block_index) {
+    size_t shard = shardOf(block_index);
+    BlockMap::value_type* entry = blocks_[shard].find(block_index);
+    Block* found = entry != nullptr ? entry->second : spilled_.empty() ? nullptr : PageIn(block_index);
+    Block& block = found != nullptr ? *found : *NewBlock(shard, block_index);
+    if (block.changes == 0) {
+        changed_[shard].push_back(block_index);
+    }
+    block.previous().fill(2);
+    block.changes = CHANGED | CHANGED2;
+    block.empty_since = -1;
+    edited_ = true;
+    return block;
+}
+
+// Adds an empty block from the shard's pool.
+BlockLife::Block* BlockLife::NewBlock(size_t shard, const Point& block_index) {
+    Block* block = pools_[shard].Allocate();
+    block->empty_since = -1;
+    block->active_at = step_count_;
+    block->hash = BoardHash();
+    block->index = block_index;
+    std::fill(std::begin(block->neighbors), std::end(block->neighbors), nullptr);
+    created_[shard].push_back(block);
+    blocks_[shard].emplace(block_index, block);
+    return block;
+}
+
+void BlockLife::LinkBlocks() {
+    for (size_t shard = 0; shard < blocks_.size(); shard++) {
+        for (Block* block : retired_[shard]) {
+            for (int slot = 0; slot < 9; slot++) {
+                if (slot != NeighborSlot(0, 0) && block->neighbors[slot] != nullptr) {
+                    block->neighbors[slot]->neighbors[8 - slot] = nullptr;
+                }
+            }
+            pools_[shard].Free(block);
+        }
+        retired_[shard].clear();
+    }
+    for (size_t shard = 0; shard < blocks_.size(); shard++) {
+        for (Block* block : created_[shard]) {
+            for (int dy = -1; dy <= 1; dy++) {
+                for (int dx = -1; dx <= 1; dx++) {
+                    int slot = NeighborSlot(dx, dy);
+                    Point index(block->index.x + dx * BLOCK_DIM, block->index.y + dy * BLOCK_DIM);
+                    BlockMap::value_type* neighbor = blocks_[shardOf(index)].find(index);
+                    block->neighbors[slot] = neighbor != nullptr ? neighbor->second : nullptr;
+                    // The opposite slot of the neighbor.
+                    if (neighbor != nullptr) {
+                        neighbor->second->neighbors[8 - slot] = block;
+                    }
+                }
+            }
+        }
+        created_[shard].clear();
+    }
+}
+
 void BlockLife::AddLivePoint(const Point& p) {
-    BlockArray& block = blocks_->emplace(toBlockIndex(p), EMPTY_BLOCK).first->second;
+    Block& block = EditBlock(toBlockIndex(p));
     Point blockCoord = toBlockCoordinates(p);
-    block[blockCoord.y * BLOCK_DIM + blockCoord.x] = 1;
+    block.cells()[blockCoord.y * BLOCK_DIM + blockCoord.x] = 1;
 }
 
+void BlockLife::AddLiveRow(int64_t x, int64_t y, const uint64_t* bits, size_t num_cells) {
+    // Consecutive cells mostly share a block, so only look the block up when it changes.
+    Block* block = nullptr;
+    Point index;
+    int row = static_cast<int>(y & ~BLOCK_MASK) * BLOCK_DIM;
+    for (size_t i = 0; i < num_cells; i += 64) {
+        uint64_t word = bits[i / 64];
+        if (num_cells - i < 64) {
+            word &= (uint64_t(1) << (num_cells - i)) - 1;
+        }
+        for (; word != 0; word &= word - 1) {
+            int64_t column = static_cast<int64_t>(static_cast<uint64_t>(x) + i + __builtin_ctzll(word));
+            Point cell_index(column & BLOCK_MASK, y & BLOCK_MASK);
+            if (block == nullptr || !(cell_index == index)) {
+                index = cell_index;
+                block = &EditBlock(index);
+            }
+            block->cells()[row + (column & ~BLOCK_MASK)] = 1;
+        }
+    }
+}
+
+// Only blocks next to a change since both one and two generations ago are computed. Each sums
+// its own neighborhood, which it finds through its links, and writes only its own previous
+// cells, so the shards are computed in parallel without locking. The blocks flip to their new
+// cells once all are computed, since their neighbors read their current cells until then.
 void BlockLife::DoStep() {
-    for (const auto& p : *blocks_) {
-        DoStepForBlock(p.first, p.second);
+    ScopedTimer wake_timer(PhaseSeconds(WAKE_PHASE));
+    PageInNearChanges();
+    step_count_ += 1;
+    LinkBlocks();
+    WakeNeighbors();
+    wake_timer.Stop();
+
+    auto compute = [&](size_t shard) {
+        for (const auto& p : wake_[shard]) {
+            if (p.second == (CHANGED | CHANGED2)) {
+                DoStepForBlock(shard, p.first);
+            }
+        }
+    };
+    {
+        ScopedTimer timer(PhaseSeconds(STEP_PHASE));
+        if (!pool_) {
+            compute(0);
+        } else {
+            pool_->ParallelFor(blocks_.size(), [&](size_t shard, int thread) { compute(shard); });
+        }
+    }
+    if (stats_enabled()) {
+        for (const auto& wake : wake_) {
+            for (const auto& p : wake) {
+                stats_.active_blocks += p.second == (CHANGED | CHANGED2);
+            }
+        }
+    }
+    ScopedTimer timer(PhaseSeconds(FINISH_PHASE));
+    if (!pool_) {
+        FinishShard(0);
+    } else {
+        pool_->ParallelFor(blocks_.size(), [&](size_t shard, int thread) { FinishShard(shard); });
     }
+    LinkBlocks();
+    SpillColdBlocks();
+}
+
+// Marks the blocks around each changed block with its changes.
+void BlockLife::WakeNeighbors() {
+    for (size_t shard = 0; shard < blocks_.size(); shard++) {
+        for (const Point& index : changed_[shard]) {
+            uint8_t changes = blocks_[shard].find(index)->second->changes;
+            for (int dy = -1; dy <= 1; dy++) {
+                for (int dx = -1; dx <= 1; dx++) {
+                    Point neighbor(index.x + dx * BLOCK_DIM, index.y + dy * BLOCK_DIM);
+                    wake_[shardOf(neighbor)].emplace(neighbor, 0).first->second |= changes;
+                }
+            }
+        }
+        changed_[shard].clear();
+    }
+}
 
-    // Iterate over new_blocks_ converting weights into live and dead points.
-    // Remove any blocks that do not have any live points so we don't have bother checking them next generation.
-    for (auto it = new_blocks_->begin(); it != new_blocks_->end();) {
-        bool block_has_points = false;
-        for (int i = 0; i < it->second.size(); i++) {
-            it->second[i] = it->second[i] == 3 || it->second[i] == 13 || it->second[i] == 14;
-            block_has_points |= it->second[i];
+// Advances the shard's blocks next to changes: computed blocks take the cells DoStepForBlock
+// left in their previous cells, the others take their current or previous cells. Then creates
+// the blocks cells were born in.
+void BlockLife::FinishShard(size_t shard) {
+    BlockMap& blocks = blocks_[shard];
+    for (const auto& p : wake_[shard]) {
+        BlockMap::value_type* entry = blocks.find(p.first);
+        if (entry == nullptr) {
+            continue;
         }
-        if (!block_has_points) {
-            it = new_blocks_->erase(it);
+        Block* block = entry->second;
+        if (p.second == (CHANGED | CHANGED2)) {
+            block->current ^= 1;
+            if (hashing() && (block->changes & CHANGED)) {
+                RehashBlock(shard, p.first, block);
+            }
+        } else if (p.second & CHANGED) {
+            // Nothing around changed since two generations ago, so this is a period 2 block
+            // and differs from its previous cells as much as it did last generation.
+            block->current ^= 1;
+            block->changes &= CHANGED;
+            if (hashing() && block->changes != 0) {
+                RehashBlock(shard, p.first, block);
+            }
         } else {
-            ++it;
+            // Nothing around changed since the last generation, so neither did this block.
+            block->changes = 0;
         }
+        SettleBlock(shard, p.first, block);
     }
-    new_blocks_.swap(blocks_);
-    new_blocks_->clear();
+    for (const auto& p : new_blocks_[shard]) {
+        Block* block = NewBlock(shard, p.first);
+        block->previous() = p.second;
+        block->current ^= 1;
+        block->changes = CHANGED | CHANGED2;
+        if (hashing()) {
+            RehashBlock(shard, p.first, block);
+        }
+        SettleBlock(shard, p.first, block);
+    }
+    new_blocks_[shard].clear();
+    wake_[shard].clear();
+    RecycleEmptyBlocks(shard);
 }
 
-// Apply influence to each block of 9 cells around any live cell.
-// Uses a 32x32 (1024 byte) block of memory which eliminates the need for hashtable
-// lookups for the inner 30x30 square and reduces the number of hashtable lookups
-// for the outer region to just one per neighboring region.
-// Like LiveLife, this supports much larger boards than the simple matrix based approach,
-// but it trades additional memory use and unrolled loops for speed in computing the next generation.
-void BlockLife::DoStepForBlock(const Point& block_index, const BlockArray& block) {
-    BlockArray *b1,*b2,*b3;
-    BlockArray *b4,*b5,*b6;
-    BlockArray *b7,*b8,*b9;
-
-    // Determine the blocks we need.
-    if (block[(BLOCK_DIM - 1) * BLOCK_DIM + 0] == 1) { b1 = &(new_blocks_->emplace(Point(block_index.x - BLOCK_DIM, block_index.y + BLOCK_DIM), EMPTY_BLOCK).first->second); }
-    if (block[(BLOCK_DIM - 1) * BLOCK_DIM + (BLOCK_DIM - 1)] == 1) { b3 = &(new_blocks_->emplace(Point(block_index.x + BLOCK_DIM, block_index.y + BLOCK_DIM), EMPTY_BLOCK).first->second); }
-    if (block[0 * BLOCK_DIM + 0] == 1) { b7 = &(new_blocks_->emplace(Point(block_index.x - BLOCK_DIM, block_index.y - BLOCK_DIM), EMPTY_BLOCK).first->second); }
-    if (block[0 * BLOCK_DIM + (BLOCK_DIM - 1)] == 1) { b9 = &(new_blocks_->emplace(Point(block_index.x + BLOCK_DIM, block_index.y - BLOCK_DIM), EMPTY_BLOCK).first->second); }
-    bool needs_b2 = false;
-    bool needs_b4 = false;
-    bool needs_b6 = false;
-    bool needs_b8 = false;
-    for (int i = 0; i < BLOCK_DIM; i++) {
-        needs_b2 |= block[(BLOCK_DIM - 1) * BLOCK_DIM + i] == 1;
-        needs_b4 |= block[i * BLOCK_DIM + 0] == 1;
-        needs_b6 |= block[i * BLOCK_DIM + (BLOCK_DIM - 1)] == 1;
-        needs_b8 |= block[0 * BLOCK_DIM + i] == 1;
+// Queues a block with changes for the next step, and a block that just became empty and
+// unchanged for recycling.
+void BlockLife::SettleBlock(size_t shard, const Point& block_index, Block* block) {
+    if (block->changes != 0) {
+        changed_[shard].push_back(block_index);
+        block->empty_since = -1;
+    } else if (block->empty_since < 0 && block->cells() == EMPTY_BLOCK) {
+        block->empty_since = step_count_;
+        if (!block->queued) {
+            block->queued = true;
+            empty_blocks_[shard].push_back(EmptyBlock{block_index, step_count_ + RECYCLE_STEPS});
+        }
     }
-    if (needs_b2) { b2 = &(new_blocks_->emplace(Point(block_index.x - 0, block_index.y + BLOCK_DIM), EMPTY_BLOCK).first->second); }
-    if (needs_b4) { b4 = &(new_blocks_->emplace(Point(block_index.x - BLOCK_DIM, block_index.y - 0), EMPTY_BLOCK).first->second); }
-    if (needs_b6) { b6 = &(new_blocks_->emplace(Point(block_index.x + BLOCK_DIM, block_index.y - 0), EMPTY_BLOCK).first->second); }
-    if (needs_b8) { b8 = &(new_blocks_->emplace(Point(block_index.x - 0, block_index.y - BLOCK_DIM), EMPTY_BLOCK).first->second); }
+}
 
-    b5 = &(new_blocks_->emplace(Point(block_index.x, block_index.y), EMPTY_BLOCK).first->second);
+// Returns the blocks of the shard which stayed empty and unchanged for RECYCLE_STEPS
+// generations to the pool. Blocks which filled up again in the meantime leave the queue, and
+// blocks which emptied out again later go back to the end of it.
+void BlockLife::RecycleEmptyBlocks(size_t shard) {
+    std::vector<EmptyBlock>& queue = empty_blocks_[shard];
+    size_t done = 0;
+    for (; done < queue.size() && queue[done].due <= step_count_; done++) {
+        Point index = queue[done].index;
+        BlockMap::value_type* entry = blocks_[shard].find(index);
+        if (entry == nullptr || !entry->second->queued) {
+            continue;
+        }
+        Block* block = entry->second;
+        if (block->empty_since < 0) {
+            block->queued = false;
+        } else if (step_count_ - block->empty_since < RECYCLE_STEPS) {
+            queue.push_back(EmptyBlock{index, block->empty_since + RECYCLE_STEPS});
+        } else {
+            block->queued = false;
+            blocks_[shard].erase(index);
+            retired_[shard].push_back(block);
+        }
+    }
+    queue.erase(queue.begin(), queue.begin() + done);
+}
 
-    // Inner block.
-    for (int y = 1; y < BLOCK_DIM - 1; y++) {
-        for (int x = 1; x < BLOCK_DIM - 1; x++) {
-            if (block[y * BLOCK_DIM + x] == 1) {
-                (*b5)[(y - 1) * BLOCK_DIM + (x - 1)] += 1;
-                (*b5)[(y - 1) * BLOCK_DIM + (x - 0)] += 1;
-                (*b5)[(y - 1) * BLOCK_DIM + (x + 1)] += 1;
-                (*b5)[(y - 0) * BLOCK_DIM + (x - 1)] += 1;
-                (*b5)[(y - 0) * BLOCK_DIM + (x - 0)] += 11;  // Same +10 trick as above.
-                (*b5)[(y - 0) * BLOCK_DIM + (x + 1)] += 1;
-                (*b5)[(y + 1) * BLOCK_DIM + (x - 1)] += 1;
-                (*b5)[(y + 1) * BLOCK_DIM + (x - 0)] += 1;
-                (*b5)[(y + 1) * BLOCK_DIM + (x + 1)] += 1;
-            }
-        }
-    }
-
-    // Top Left Corner
-    if (block[(BLOCK_DIM - 1) * BLOCK_DIM + 0] == 1) {
-        (*b1)[0 * BLOCK_DIM + (BLOCK_DIM - 1)] += 1;
-        (*b2)[0 * BLOCK_DIM + 0] += 1;
-        (*b2)[0 * BLOCK_DIM + 1] += 1;
-        (*b4)[(BLOCK_DIM - 1) * BLOCK_DIM + (BLOCK_DIM - 1)] += 1;
-        (*b5)[(BLOCK_DIM - 1) * BLOCK_DIM + 0] += 11;
-        (*b5)[(BLOCK_DIM - 1) * BLOCK_DIM + 1] += 1;
-        (*b4)[(BLOCK_DIM - 2) * BLOCK_DIM + (BLOCK_DIM - 1)] += 1;
-        (*b5)[(BLOCK_DIM - 2) * BLOCK_DIM + 0] += 1;
-        (*b5)[(BLOCK_DIM - 2) * BLOCK_DIM + 1] += 1;
-    }
-
-    // Top Right Corner
-    if (block[(BLOCK_DIM - 1) * BLOCK_DIM + (BLOCK_DIM - 1)]) {
-        (*b2)[0 * BLOCK_DIM + (BLOCK_DIM - 2)] += 1;
-        (*b2)[0 * BLOCK_DIM + (BLOCK_DIM - 1)] += 1;
-        (*b3)[0 * BLOCK_DIM + 0] += 1;
-        (*b5)[(BLOCK_DIM - 1) * BLOCK_DIM + (BLOCK_DIM - 2)] += 1;
-        (*b5)[(BLOCK_DIM - 1) * BLOCK_DIM + (BLOCK_DIM - 1)] += 11;
-        (*b6)[(BLOCK_DIM - 1) * BLOCK_DIM + 0] += 1;
-        (*b5)[(BLOCK_DIM - 2) * BLOCK_DIM + (BLOCK_DIM - 2)] += 1;
-        (*b5)[(BLOCK_DIM - 2) * BLOCK_DIM + (BLOCK_DIM - 1)] += 1;
-        (*b6)[(BLOCK_DIM - 2) * BLOCK_DIM + 0] += 1;
-    }
-
-    // Lower Left Corner
-    if (block[0 * BLOCK_DIM + 0]) {
-        (*b4)[1 * BLOCK_DIM + (BLOCK_DIM - 1)] += 1;
-        (*b5)[1 * BLOCK_DIM + 0] += 1;
-        (*b5)[1 * BLOCK_DIM + 1] += 1;
-        (*b4)[0 * BLOCK_DIM + (BLOCK_DIM - 1)] += 1;
-        (*b5)[0 * BLOCK_DIM + 0] += 11;
-        (*b5)[0 * BLOCK_DIM + 1] += 1;
-        (*b7)[(BLOCK_DIM - 1) * BLOCK_DIM + (BLOCK_DIM - 1)] += 1;
-        (*b8)[(BLOCK_DIM - 1) * BLOCK_DIM + 0] += 1;
-        (*b8)[(BLOCK_DIM - 1) * BLOCK_DIM + 1] += 1;
-    }
-
-    // Lower Right Corner
-    if (block[0 * BLOCK_DIM + (BLOCK_DIM - 1)]) {
-        (*b5)[1 * BLOCK_DIM + (BLOCK_DIM - 2)] += 1;
-        (*b5)[1 * BLOCK_DIM + (BLOCK_DIM - 1)] += 1;
-        (*b6)[1 * BLOCK_DIM + 0] += 1;
-        (*b5)[0 * BLOCK_DIM + (BLOCK_DIM - 2)] += 1;
-        (*b5)[0 * BLOCK_DIM + (BLOCK_DIM - 1)] += 11;
-        (*b6)[0 * BLOCK_DIM + 0] += 1;
-        (*b8)[(BLOCK_DIM - 1) * BLOCK_DIM + (BLOCK_DIM - 2)] += 1;
-        (*b8)[(BLOCK_DIM - 1) * BLOCK_DIM + (BLOCK_DIM - 1)] += 1;
-        (*b9)[(BLOCK_DIM - 1) * BLOCK_DIM + 0] += 1;
-    }
-
-    // Top row
-    for (int i = 1; i < BLOCK_DIM - 1; i++) {
-        if (block[(BLOCK_DIM - 1) * BLOCK_DIM + i] == 1) {
-            (*b2)[0 * BLOCK_DIM + (i - 1)] += 1;
-            (*b2)[0 * BLOCK_DIM + (i - 0)] += 1;
-            (*b2)[0 * BLOCK_DIM + (i + 1)] += 1;
-            (*b5)[(BLOCK_DIM - 1) * BLOCK_DIM + (i - 1)] += 1;
-            (*b5)[(BLOCK_DIM - 1) * BLOCK_DIM + (i - 0)] += 11;
-            (*b5)[(BLOCK_DIM - 1) * BLOCK_DIM + (i + 1)] += 1;
-            (*b5)[(BLOCK_DIM - 2) * BLOCK_DIM + (i - 1)] += 1;
-            (*b5)[(BLOCK_DIM - 2) * BLOCK_DIM + (i - 0)] += 1;
-            (*b5)[(BLOCK_DIM - 2) * BLOCK_DIM + (i + 1)] += 1;
-        }
-    }
-
-    // Bottom row
-    for (int i = 1; i < BLOCK_DIM - 1; i++) {
-        if (block[0 * BLOCK_DIM + i] == 1) {
-            (*b5)[1 * BLOCK_DIM + (i - 1)] += 1;
-            (*b5)[1 * BLOCK_DIM + (i - 0)] += 1;
-            (*b5)[1 * BLOCK_DIM + (i + 1)] += 1;
-            (*b5)[0 * BLOCK_DIM + (i - 1)] += 1;
-            (*b5)[0 * BLOCK_DIM + (i - 0)] += 11;
-            (*b5)[0 * BLOCK_DIM + (i + 1)] += 1;
-            (*b8)[(BLOCK_DIM - 1) * BLOCK_DIM + (i - 1)] += 1;
-            (*b8)[(BLOCK_DIM - 1) * BLOCK_DIM + (i - 0)] += 1;
-            (*b8)[(BLOCK_DIM - 1) * BLOCK_DIM + (i + 1)] += 1;
-        }
-    }
-
-    // Left column
-    for (int i = 1; i < BLOCK_DIM - 1; i++) {
-        if (block[i * BLOCK_DIM + 0] == 1) {
-            (*b4)[(i - 1) * BLOCK_DIM + (BLOCK_DIM - 1)] += 1;
-            (*b5)[(i - 1) * BLOCK_DIM + 0] += 1;
-            (*b5)[(i - 1) * BLOCK_DIM + 1] += 1;
-            (*b4)[(i - 0) * BLOCK_DIM + (BLOCK_DIM - 1)] += 1;
-            (*b5)[(i - 0) * BLOCK_DIM + 0] += 11;
-            (*b5)[(i - 0) * BLOCK_DIM + 1] += 1;
-            (*b4)[(i + 1) * BLOCK_DIM + (BLOCK_DIM - 1)] += 1;
-            (*b5)[(i + 1) * BLOCK_DIM + 0] += 1;
-            (*b5)[(i + 1) * BLOCK_DIM + 1] += 1;
-        }
-    }
-
-    // Right column
-    for (int i = 1; i < BLOCK_DIM - 1; i++) {
-        if (block[i * BLOCK_DIM + (BLOCK_DIM - 1)] == 1) {
-            (*b5)[(i - 1) * BLOCK_DIM + (BLOCK_DIM - 2)] += 1;
-            (*b5)[(i - 1) * BLOCK_DIM + (BLOCK_DIM - 1)] += 1;
-            (*b6)[(i - 1) * BLOCK_DIM + 0] += 1;
-            (*b5)[(i - 0) * BLOCK_DIM + (BLOCK_DIM - 2)] += 1;
-            (*b5)[(i - 0) * BLOCK_DIM + (BLOCK_DIM - 1)] += 11;
-            (*b6)[(i - 0) * BLOCK_DIM + 0] += 1;
-            (*b5)[(i + 1) * BLOCK_DIM + (BLOCK_DIM - 2)] += 1;
-            (*b5)[(i + 1) * BLOCK_DIM + (BLOCK_DIM - 1)] += 1;
-            (*b6)[(i + 1) * BLOCK_DIM + 0] += 1;
-        }
-    }
-}
-
-std::vector<const Point> BlockLife::LivePoints() {
-    std::vector<const Point> live_points;
-    for (auto pair : *blocks_) {
-        for (int y = 0; y < BLOCK_DIM; y++) {
-            for (int x = 0; x < BLOCK_DIM; x++) {
-                if (pair.second[y * BLOCK_DIM + x] == 1) {
-                    live_points.emplace_back(pair.first.x + x, pair.first.y + y);
+void BlockLife::RehashBlock(size_t shard, const Point& block_index, Block* block) {
+    uint64_t rows[BLOCK_DIM];
+    for (int y = 0; y < BLOCK_DIM; y++) {
+        rows[y] = PackCells(block->cells().data() + y * BLOCK_DIM);
+    }
+    BoardHash hash = BoardHash::OfRows(block_index, rows, BLOCK_DIM);
+    hash_changes_[shard] += hash;
+    hash_changes_[shard] -= block->hash;
+    block->hash = hash;
+}
+
+// Spilled period 2 blocks come back into memory, where their hashes follow their cells.
+void BlockLife::ResetHash() {
+    std::vector<Point> period_2;
+    uint32_t record[SpillStore::MAX_RECORD / sizeof(uint32_t)];
+    for (const auto& p : spilled_) {
+        store_->Read(p.second, record);
+        if (record[0] & SPILLED_PERIOD_2) {
+            period_2.push_back(p.first);
+        }
+    }
+    for (const Point& index : period_2) {
+        PageIn(index);
+    }
+    hash_ = BoardHash();
+    for (size_t shard = 0; shard < blocks_.size(); shard++) {
+        hash_changes_[shard] = BoardHash();
+        for (const auto& p : blocks_[shard]) {
+            p.second->hash = BoardHash();
+            RehashBlock(shard, p.first, p.second);
+        }
+        hash_ += hash_changes_[shard];
+        hash_changes_[shard] = BoardHash();
+    }
+    uint32_t rows[BLOCK_DIM];
+    uint32_t previous[BLOCK_DIM];
+    uint64_t bits[BLOCK_DIM];
+    for (const auto& p : spilled_) {
+        ReadSpilled(p.second, rows, previous);
+        std::copy(rows, rows + BLOCK_DIM, bits);
+        hash_ += BoardHash::OfRows(p.first, bits, BLOCK_DIM);
+    }
+    edited_ = false;
+}
+
+void BlockLife::UpdateHash() {
+    for (size_t shard = 0; shard < blocks_.size(); shard++) {
+        // Blocks with added cells are among the changed blocks.
+        if (edited_) {
+            for (const Point& index : changed_[shard]) {
+                RehashBlock(shard, index, blocks_[shard].find(index)->second);
+            }
+        }
+        hash_ += hash_changes_[shard];
+        hash_changes_[shard] = BoardHash();
+    }
+    edited_ = false;
+}
+
+// Empties every block into its pool and adds the cells again, moved.
+bool BlockLife::Translate(const Point& displacement) {
+    LinkBlocks();
+    std::vector<Point> cells = LivePoints();
+    for (size_t shard = 0; shard < blocks_.size(); shard++) {
+        for (const auto& p : blocks_[shard]) {
+            Block* block = p.second;
+            block->generations[0].fill(0);
+            block->generations[1].fill(0);
+            block->changes = 0;
+            block->queued = false;
+            pools_[shard].Free(block);
+        }
+        blocks_[shard].clear();
+        changed_[shard].clear();
+        empty_blocks_[shard].clear();
+    }
+    for (const auto& p : spilled_) {
+        store_->Free(p.second);
+    }
+    spilled_.clear();
+    spilled_cells_[0] = 0;
+    spilled_cells_[1] = 0;
+    for (const Point& p : cells) {
+        AddLivePoint(Point(static_cast<int64_t>(static_cast<uint64_t>(p.x) + displacement.x),
+                           static_cast<int64_t>(static_cast<uint64_t>(p.y) + displacement.y)));
+    }
+    ResetHash();
+    return true;
+}
+
+bool BlockLife::set_memory_budget(size_t bytes) {
+    if (bytes == 0) {
+        std::vector<Point> spilled;
+        for (const auto& p : spilled_) {
+            spilled.push_back(p.first);
+        }
+        for (const Point& index : spilled) {
+            PageIn(index);
+        }
+        LinkBlocks();
+        max_resident_blocks_ = 0;
+        store_.reset();
+        return true;
+    }
+    if (!store_) {
+        std::unique_ptr<SpillStore> store(new SpillStore());
+        if (!store->ok()) {
+            return false;
+        }
+        store_ = std::move(store);
+    }
+    max_resident_blocks_ = std::max<size_t>(1, bytes / sizeof(Block));
+    next_spill_scan_ = 0;
+    return true;
+}
+
+BlockLife::SpillStats BlockLife::spill_stats() {
+    SpillStats stats = {spilled_.size(), 0, evictions_, faults_, store_ ? store_->bytes() : 0};
+    for (const auto& pool : pools_) {
+        stats.resident_blocks += pool.size();
+    }
+    return stats;
+}
+
+// A step reads the blocks around the blocks next to changes, and a pass of up to MAX_PASS_STEPS
+// generations doesn't reach further either. Blocks next to period 2 blocks alone only flip
+// between their cells, so blocks around those can stay spilled, e.g. blocks of still lifes
+// next to blinkers, and so can period 2 blocks themselves. Paged in period 2 blocks join the
+// changed blocks, which are visited by index for that reason.
+void BlockLife::PageInNearChanges() {
+    if (max_resident_blocks_ == 0) {
+        return;
+    }
+    for (size_t shard = 0; shard < blocks_.size(); shard++) {
+        for (size_t i = 0; i < changed_[shard].size(); i++) {
+            Point index = changed_[shard][i];
+            if ((blocks_[shard].find(index)->second->changes & CHANGED2) == 0) {
+                continue;
+            }
+            for (int dy = -2; dy <= 2; dy++) {
+                for (int dx = -2; dx <= 2; dx++) {
+                    Point near(index.x + dx * BLOCK_DIM, index.y + dy * BLOCK_DIM);
+                    BlockMap::value_type* entry = blocks_[shardOf(near)].find(near);
+                    Block* block = entry != nullptr ? entry->second : spilled_.empty() ? nullptr : PageIn(near);
+                    if (block != nullptr) {
+                        block->active_at = step_count_;
+                    }
                 }
             }
         }
     }
-    return live_points;
+}
+
+BlockLife::Block* BlockLife::PageIn(const Point& block_index) {
+    PointMap<SpillStore::Handle>::value_type* entry = spilled_.find(block_index);
+    if (entry == nullptr) {
+        return nullptr;
+    }
+    uint32_t rows[BLOCK_DIM];
+    uint32_t previous[BLOCK_DIM];
+    ReadSpilled(entry->second, rows, previous);
+    store_->Free(entry->second);
+    spilled_.erase(block_index);
+    size_t shard = shardOf(block_index);
+    Block* block = NewBlock(shard, block_index);
+    uint64_t bits[BLOCK_DIM];
+    block->changes = 0;
+    for (int y = 0; y < BLOCK_DIM; y++) {
+        UnpackCells(rows[y], block->cells().data() + y * BLOCK_DIM);
+        UnpackCells(previous[y], block->previous().data() + y * BLOCK_DIM);
+        bits[y] = rows[y];
+        spilled_cells_[step_count_ & 1] -= __builtin_popcount(rows[y]);
+        spilled_cells_[(step_count_ + 1) & 1] -= __builtin_popcount(previous[y]);
+        if (rows[y] != previous[y]) {
+            block->changes = CHANGED;
+        }
+    }
+    if (block->changes != 0) {
+        changed_[shard].push_back(block_index);
+    }
+    // The hash of the cells is still part of hash_.
+    if (hashing()) {
+        block->hash = BoardHash::OfRows(block_index, bits, BLOCK_DIM);
+    }
+    faults_++;
+    if (stats_enabled()) {
+        stats_.blocks_paged_in++;
+    }
+    return block;
+}
+
+// Only blocks without changes, or with period 2 while not hashing, which aren't empty and on
+// their way back to the pool, are spilled. Finding them takes a pass over every block, so after
+// finding too few, i.e. when the blocks near changes alone don't fit the budget,
+// SpillColdBlocks waits SPILL_AFTER_STEPS generations before looking again. Spilled period 2
+// blocks leave the changed blocks.
+void BlockLife::SpillColdBlocks() {
+    if (max_resident_blocks_ == 0 || step_count_ < next_spill_scan_) {
+        return;
+    }
+    size_t resident = 0;
+    for (const auto& pool : pools_) {
+        resident += pool.size();
+    }
+    if (resident <= max_resident_blocks_) {
+        return;
+    }
+    ScopedTimer timer(PhaseSeconds(SPILL_PHASE));
+    std::vector<Block*> cold;
+    for (const auto& shard : blocks_) {
+        for (const auto& p : shard) {
+            const Block* block = p.second;
+            bool period_2 = block->changes == CHANGED && !hashing();
+            if ((block->changes == 0 || period_2) && block->empty_since < 0 && !block->queued &&
+                step_count_ - block->active_at >= SPILL_AFTER_STEPS) {
+                cold.push_back(p.second);
+            }
+        }
+    }
+    size_t target = resident - max_resident_blocks_ * 3 / 4;
+    if (cold.size() > target) {
+        std::nth_element(cold.begin(), cold.begin() + target, cold.end(),
+                         [](const Block* a, const Block* b) { return a->active_at < b->active_at; });
+        cold.resize(target);
+    }
+    next_spill_scan_ = cold.size() < target ? step_count_ + SPILL_AFTER_STEPS : 0;
+
+    uint32_t record[1 + 2 * (1 + BLOCK_DIM)];
+    bool spilled_period_2 = false;
+    for (Block* block : cold) {
+        bool period_2 = block->changes != 0;
+        record[0] = (period_2 ? SPILLED_PERIOD_2 : 0) | static_cast<uint32_t>(step_count_ & 1) << 1;
+        int size = 1 + PackRows(block->cells(), record + 1);
+        if (period_2) {
+            size += PackRows(block->previous(), record + size);
+        }
+        SpillStore::Handle handle;
+        if (!store_->Write(record, size * sizeof(uint32_t), &handle)) {
+            break;
+        }
+        spilled_.emplace(block->index, handle);
+        for (int y = 0; y < BLOCK_DIM; y++) {
+            const char* row = block->cells().data() + y * BLOCK_DIM;
+            const char* previous_row = block->previous().data() + y * BLOCK_DIM;
+            spilled_cells_[step_count_ & 1] += __builtin_popcount(PackCells(row));
+            spilled_cells_[(step_count_ + 1) & 1] += __builtin_popcount(PackCells(previous_row));
+        }
+        spilled_period_2 |= period_2;
+        // Back to the pool empty, like recycled blocks.
+        size_t shard = shardOf(block->index);
+        blocks_[shard].erase(block->index);
+        block->generations[0].fill(0);
+        block->generations[1].fill(0);
+        block->changes = 0;
+        retired_[shard].push_back(block);
+        evictions_++;
+        if (stats_enabled()) {
+            stats_.blocks_evicted++;
+        }
+    }
+    if (spilled_period_2) {
+        for (size_t shard = 0; shard < blocks_.size(); shard++) {
+            BlockMap& blocks = blocks_[shard];
+            std::vector<Point>& changed = changed_[shard];
+            changed.erase(std::remove_if(changed.begin(), changed.end(),
+                                         [&](const Point& index) { return blocks.find(index) == nullptr; }),
+                          changed.end());
+        }
+    }
+    LinkBlocks();
+    store_->Release();
+}
+
+// A spilled period 2 block went on alternating between its cells every generation since.
+void BlockLife::ReadSpilled(const SpillStore::Handle& handle, uint32_t* rows, uint32_t* previous) {
+    uint32_t record[1 + 2 * (1 + BLOCK_DIM)];
+    store_->Read(handle, record);
+    const uint32_t* next = UnpackRows(record + 1, rows);
+    if ((record[0] & SPILLED_PERIOD_2) == 0) {
+        std::copy(rows, rows + BLOCK_DIM, previous);
+        return;
+    }
+    UnpackRows(next, previous);
+    if (((record[0] >> 1) ^ static_cast<uint32_t>(step_count_)) & 1) {
+        std::swap_ranges(rows, rows + BLOCK_DIM, previous);
+    }
+}
+
+int BlockLife::PackRows(const BlockArray& cells, uint32_t* record) {
+    uint32_t mask = 0;
+    int size = 1;
+    for (int y = 0; y < BLOCK_DIM; y++) {
+        uint32_t row = PackCells(cells.data() + y * BLOCK_DIM);
+        if (row != 0) {
+            mask |= uint32_t(1) << y;
+            record[size++] = row;
+        }
+    }
+    record[0] = mask;
+    return size;
+}
+
+const uint32_t* BlockLife::UnpackRows(const uint32_t* record, uint32_t* rows) {
+    uint32_t mask = *record++;
+    for (int y = 0; y < BLOCK_DIM; y++) {
+        rows[y] = (mask >> y) & 1 ? *record++ : 0;
+    }
+    return record;
+}
+
+template <typename F>
+void BlockLife::ForEachSpilledBlock(F f) {
+    BlockArray cells;
+    uint32_t rows[BLOCK_DIM];
+    uint32_t previous[BLOCK_DIM];
+    for (const auto& p : spilled_) {
+        ReadSpilled(p.second, rows, previous);
+        for (int y = 0; y < BLOCK_DIM; y++) {
+            UnpackCells(rows[y], cells.data() + y * BLOCK_DIM);
+        }
+        f(p.first, cells);
+    }
+}
+
+// The block and a cell of its neighbors on each side go into a tile, whose cells are summed
+// eight at a time: three across, then three of those sums down. Sums stay below 256, so they
+// don't carry from one byte into the next.
+void BlockLife::SumNeighborhood(const BlockArray* const neighborhood[9], BlockArray* weights) {
+    const int TILE_DIM = BLOCK_DIM + 2;
+    char tile[TILE_DIM * TILE_DIM] = {0};
+    for (int dy = -1; dy <= 1; dy++) {
+        // Rows and columns of the neighbor inside the tile.
+        int first_y = dy < 0 ? BLOCK_DIM - 1 : 0;
+        int last_y = dy > 0 ? 1 : BLOCK_DIM;
+        for (int dx = -1; dx <= 1; dx++) {
+            const BlockArray* cells = neighborhood[NeighborSlot(dx, dy)];
+            if (cells == nullptr) {
+                continue;
+            }
+            int first_x = dx < 0 ? BLOCK_DIM - 1 : 0;
+            int last_x = dx > 0 ? 1 : BLOCK_DIM;
+            for (int y = first_y; y < last_y; y++) {
+                char* row = tile + (dy * BLOCK_DIM + y + 1) * TILE_DIM + dx * BLOCK_DIM + 1;
+                memcpy(row + first_x, cells->data() + y * BLOCK_DIM + first_x, last_x - first_x);
+            }
+        }
+    }
+
+    uint64_t across[TILE_DIM][BLOCK_DIM / 8];
+    for (int y = 0; y < TILE_DIM; y++) {
+        for (int i = 0; i < BLOCK_DIM / 8; i++) {
+            uint64_t west, mid, east;
+            memcpy(&west, tile + y * TILE_DIM + i * 8, 8);
+            memcpy(&mid, tile + y * TILE_DIM + i * 8 + 1, 8);
+            memcpy(&east, tile + y * TILE_DIM + i * 8 + 2, 8);
+            across[y][i] = west + mid + east;
+        }
+    }
+    for (int y = 0; y < BLOCK_DIM; y++) {
+        for (int i = 0; i < BLOCK_DIM / 8; i++) {
+            uint64_t self;
+            memcpy(&self, tile + (y + 1) * TILE_DIM + i * 8 + 1, 8);
+            // Same +10 trick as LiveLife.
+            uint64_t sum = across[y][i] + across[y + 1][i] + across[y + 2][i] + self * 10;
+            memcpy(weights->data() + y * BLOCK_DIM + i * 8, &sum, 8);
+        }
+    }
+}
+
+// Blocks next to changes mostly exist, and then link to their neighbors. The others look their
+// neighbors up, and are mostly left empty.
+void BlockLife::DoStepForBlock(size_t shard, const Point& block_index) {
+    const BlockArray* neighborhood[9];
+    const BlockMap::value_type* center = blocks_[shard].find(block_index);
+    bool any = center != nullptr;
+    for (int dy = -1; dy <= 1; dy++) {
+        for (int dx = -1; dx <= 1; dx++) {
+            const Block* block;
+            if (center != nullptr) {
+                block = center->second->neighbors[NeighborSlot(dx, dy)];
+            } else {
+                Point neighbor(block_index.x + dx * BLOCK_DIM, block_index.y + dy * BLOCK_DIM);
+                const BlockMap::value_type* entry = blocks_[shardOf(neighbor)].find(neighbor);
+                block = entry != nullptr ? entry->second : nullptr;
+            }
+            // Blocks known to be empty have no cells to count.
+            bool empty = block == nullptr || block->empty_since >= 0;
+            neighborhood[NeighborSlot(dx, dy)] = empty ? nullptr : &block->cells();
+            any |= !empty;
+        }
+    }
+    if (!any) {
+        return;
+    }
+
+    BlockArray weights;
+    SumNeighborhood(neighborhood, &weights);
+    const CellsKernel cells_kernel = CELLS_KERNELS[RuleIndex(rule_)];
+    if (center != nullptr) {
+        Block* block = center->second;
+        // The next generation replaces the previous one.
+        cells_kernel(rule_, weights.data(), block->cells().data(), block->previous().data(), &block->changes);
+        return;
+    }
+    BlockArray next = EMPTY_BLOCK;
+    uint8_t changes;
+    cells_kernel(rule_, weights.data(), EMPTY_BLOCK.data(), next.data(), &changes);
+    if (changes != 0) {
+        new_blocks_[shard].emplace_back(block_index, next);
+    }
+}
+
+std::vector<Point> BlockLife::LivePoints() {
+    std::vector<Point> live_points;
+    auto add = [&](const Point& block_index, const BlockArray& cells) {
+        for (int y = 0; y < BLOCK_DIM; y++) {
+            for (int x = 0; x < BLOCK_DIM; x++) {
+                if (cells[y * BLOCK_DIM + x] == 1) {
+                    live_points.emplace_back(block_index.x + x, block_index.y + y);
+                }
+            }
+        }
+    };
+    for (const auto& shard : blocks_) {
+        for (const auto& pair : shard) {
+            add(pair.first, pair.second->cells());
+        }
+    }
+    ForEachSpilledBlock(add);
+    return live_points;
+}
+
+// Each 64x64 block is made of four 32x32 blocks.
+void BlockLife::CopyBitBlocks(std::vector<BitBlock>* blocks) {
+    PointMap<size_t> positions;
+    auto add = [&](const Point& block_index, const BlockArray& cells) {
+        Point index(block_index.x >> 6, block_index.y >> 6);
+        int x_offset = static_cast<int>(block_index.x & 63);
+        int y_offset = static_cast<int>(block_index.y & 63);
+        auto position = positions.emplace(index, blocks->size());
+        if (position.second) {
+            blocks->push_back(BitBlock{index, {{0}}});
+        }
+        BitBlock& bit_block = (*blocks)[position.first->second];
+        for (int y = 0; y < BLOCK_DIM; y++) {
+            uint64_t row = 0;
+            for (int x = 0; x < BLOCK_DIM; x++) {
+                row |= static_cast<uint64_t>(cells[y * BLOCK_DIM + x] == 1) << x;
+            }
+            bit_block.rows[y_offset + y] |= row << x_offset;
+        }
+    };
+    for (const auto& shard : blocks_) {
+        for (const auto& pair : shard) {
+            add(pair.first, pair.second->cells());
+        }
+    }
+    ForEachSpilledBlock(add);
+}
+
+// Small rectangles look up each block position they cover, larger ones scan every block.
+void BlockLife::VisitLivePoints(const Range& x_range, const Range& y_range, LivePointVisitor* visitor) {
+    if (x_range.first > x_range.second || y_range.first > y_range.second) {
+        return;
+    }
+    uint64_t x_start = static_cast<uint64_t>(x_range.first & BLOCK_MASK);
+    uint64_t y_start = static_cast<uint64_t>(y_range.first & BLOCK_MASK);
+    uint64_t columns = (static_cast<uint64_t>(x_range.second & BLOCK_MASK) - x_start) / BLOCK_DIM + 1;
+    uint64_t rows = (static_cast<uint64_t>(y_range.second & BLOCK_MASK) - y_start) / BLOCK_DIM + 1;
+    size_t blocks = TableSize() + spilled_.size();
+    if (columns <= blocks && rows <= blocks && columns * rows <= blocks) {
+        BlockArray cells;
+        uint32_t packed[BLOCK_DIM];
+        uint32_t previous[BLOCK_DIM];
+        for (uint64_t row = 0; row < rows; row++) {
+            for (uint64_t column = 0; column < columns; column++) {
+                Point index(static_cast<int64_t>(x_start + column * BLOCK_DIM),
+                            static_cast<int64_t>(y_start + row * BLOCK_DIM));
+                const BlockMap::value_type* block = blocks_[shardOf(index)].find(index);
+                if (block != nullptr) {
+                    VisitBlock(block->first, block->second->cells(), x_range, y_range, visitor);
+                    continue;
+                }
+                const PointMap<SpillStore::Handle>::value_type* spilled = spilled_.empty() ? nullptr : spilled_.find(index);
+                if (spilled != nullptr) {
+                    ReadSpilled(spilled->second, packed, previous);
+                    for (int y = 0; y < BLOCK_DIM; y++) {
+                        UnpackCells(packed[y], cells.data() + y * BLOCK_DIM);
+                    }
+                    VisitBlock(index, cells, x_range, y_range, visitor);
+                }
+            }
+        }
+        return;
+    }
+    for (const auto& shard : blocks_) {
+        for (const auto& pair : shard) {
+            VisitBlock(pair.first, pair.second->cells(), x_range, y_range, visitor);
+        }
+    }
+    ForEachSpilledBlock([&](const Point& block_index, const BlockArray& cells) {
+        VisitBlock(block_index, cells, x_range, y_range, visitor);
+    });
+}
+
+void BlockLife::VisitBlock(const Point& block_index, const BlockArray& block,
+                           const Range& x_range, const Range& y_range, LivePointVisitor* visitor) {
+    int64_t x_end = block_index.x + (BLOCK_DIM - 1);
+    int64_t y_end = block_index.y + (BLOCK_DIM - 1);
+    if (block_index.x > x_range.second || x_end < x_range.first ||
+        block_index.y > y_range.second || y_end < y_range.first) {
+        return;
+    }
+    int x0 = x_range.first > block_index.x ? static_cast<int>(x_range.first - block_index.x) : 0;
+    int x1 = x_range.second < x_end ? static_cast<int>(x_range.second - block_index.x) : BLOCK_DIM - 1;
+    int y0 = y_range.first > block_index.y ? static_cast<int>(y_range.first - block_index.y) : 0;
+    int y1 = y_range.second < y_end ? static_cast<int>(y_range.second - block_index.y) : BLOCK_DIM - 1;
+    for (int y = y0; y <= y1; y++) {
+        for (int x = x0; x <= x1; x++) {
+            if (block[y * BLOCK_DIM + x] == 1) {
+                visitor->Visit(block_index.x + x, block_index.y + y);
+            }
+        }
+    }
+}
+
+size_t BlockLife::TableSize() {
+    size_t size = 0;
+    for (const auto& shard : blocks_) {
+        size += shard.size();
+    }
+    return size;
+}
+
+double BlockLife::TimeBlockKernel(const uint64_t* rows, int iterations) {
+    // The four blocks of rows in the middle of a 4x4 grid of blocks, all of which are computed.
+    BlockArray blocks[4][4];
+    for (int by = 0; by < 4; by++) {
+        for (int bx = 0; bx < 4; bx++) {
+            blocks[by][bx] = EMPTY_BLOCK;
+            if (bx < 1 || bx > 2 || by < 1 || by > 2) {
+                continue;
+            }
+            int column = (bx - 1) * BLOCK_DIM;
+            int row = (by - 1) * BLOCK_DIM;
+            for (int y = 0; y < BLOCK_DIM; y++) {
+                for (int x = 0; x < BLOCK_DIM; x++) {
+                    blocks[by][bx][y * BLOCK_DIM + x] = (rows[row + y] >> (column + x)) & 1;
+                }
+            }
+        }
+    }
+    const CellsKernel cells_kernel = CELLS_KERNELS[RuleIndex(rule_)];
+    const BlockArray* neighborhood[9];
+    BlockArray weights;
+    BlockArray next = EMPTY_BLOCK;
+    uint8_t changes;
+    auto start = std::chrono::steady_clock::now();
+    for (int n = 0; n < iterations; n++) {
+        for (int by = 0; by < 4; by++) {
+            for (int bx = 0; bx < 4; bx++) {
+                for (int dy = -1; dy <= 1; dy++) {
+                    for (int dx = -1; dx <= 1; dx++) {
+                        bool inside = bx + dx >= 0 && bx + dx < 4 && by + dy >= 0 && by + dy < 4;
+                        neighborhood[NeighborSlot(dx, dy)] = inside ? &blocks[by + dy][bx + dx] : nullptr;
+                    }
+                }
+                SumNeighborhood(neighborhood, &weights);
+                cells_kernel(rule_, weights.data(), blocks[by][bx].data(), next.data(), &changes);
+            }
+        }
+    }
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+void BlockLife::CountBlocks(uint64_t* blocks, uint64_t* created) {
+    *blocks = 0;
+    *created = 0;
+    for (const auto& pool : pools_) {
+        *blocks += pool.size();
+        *created += pool.allocated();
+    }
+}
+
+void BlockLife::CollectStats(StepStats* stats) {
+    for (const auto& shard : blocks_) {
+        for (const auto& p : shard) {
+            const char* cells = p.second->cells().data();
+            for (int i = 0; i < BLOCK_DIM * BLOCK_DIM; i += 8) {
+                uint64_t word;
+                memcpy(&word, cells + i, 8);
+                // Sums the bytes into the top byte.
+                stats->live_cells += (word * ONES) >> 56;
+            }
+        }
+        stats->table_size += shard.size();
+        stats->table_capacity += shard.capacity();
+        shard.AddProbeLengths(&stats->total_probe_length, &stats->max_probe_length);
+    }
+    stats->live_cells += spilled_cells_[step_count_ & 1];
+    stats->spilled_blocks = spilled_.size();
+}
+
+BlockLife::AllocationStats BlockLife::allocation_stats() {
+    AllocationStats stats = {0, 0, 0, 0};
+    for (const auto& pool : pools_) {
+        stats.block_chunks += pool.chunks();
+        stats.blocks += pool.size();
+        stats.free_blocks += pool.free_size();
+    }
+    for (const auto& shard : blocks_) {
+        stats.table_allocations += shard.allocations();
+    }
+    for (const auto& wake : wake_) {
+        stats.table_allocations += wake.allocations();
+    }
+    return stats;
+}
+
+namespace {
+
+// Computes the next generation of BitBlockLife rows under rule. Row y of a block is out[y], and
+// for the padded input arrays index y + 1 holds the row itself, y the row below and y + 2 the
+// row above. west[i] and east[i] are mid[i] shifted so that each bit lines up with its
+// west/east neighbor.
+typedef void (*RowKernel)(const Rule& rule, const uint64_t* west, const uint64_t* mid, const uint64_t* east, uint64_t* out);
+
+// Computes out[y] and the rows after it that fit in V, summing the eight neighbors of every bit
+// with full adders and applying the rule. V is either a single 64-bit row or a GCC vector of
+// several rows. Always inlined so the vector code is generated with the instruction set of the
+// calling kernel.
+template <typename V, typename R>
+CONWAY_ALWAYS_INLINE void StepRowsAt(const R& rule, const uint64_t* west, const uint64_t* mid, const uint64_t* east,
+                                     int y, uint64_t* out) {
+    V w0, m0, e0, w1, m1, e1, w2, m2, e2;
+    memcpy(&w0, west + y, sizeof(V));
+    memcpy(&m0, mid + y, sizeof(V));
+    memcpy(&e0, east + y, sizeof(V));
+    memcpy(&w1, west + y + 1, sizeof(V));
+    memcpy(&m1, mid + y + 1, sizeof(V));
+    memcpy(&e1, east + y + 1, sizeof(V));
+    memcpy(&w2, west + y + 2, sizeof(V));
+    memcpy(&m2, mid + y + 2, sizeof(V));
+    memcpy(&e2, east + y + 2, sizeof(V));
+
+    V below_ones = w0 ^ m0 ^ e0;
+    V below_twos = (w0 & m0) | (e0 & (w0 ^ m0));
+    V above_ones = w2 ^ m2 ^ e2;
+    V above_twos = (w2 & m2) | (e2 & (w2 ^ m2));
+    V side_ones = w1 ^ e1;
+    V side_twos = w1 & e1;
+
+    Counts<V> counts;
+    counts.ones = below_ones ^ above_ones ^ side_ones;
+    V ones_carry = (below_ones & above_ones) | (side_ones & (below_ones ^ above_ones));
+    V twos_sum = below_twos ^ above_twos ^ side_twos;
+    V twos_carry = (below_twos & above_twos) | (side_twos & (below_twos ^ above_twos));
+    counts.twos = twos_sum ^ ones_carry;
+    V carry = twos_sum & ones_carry;
+    counts.fours = twos_carry ^ carry;
+    counts.eights = twos_carry & carry;
+
+    V next;
+    rule.Next(m1, counts, &next);
+    memcpy(out + y, &next, sizeof(V));
+}
+
+template <typename V, typename R>
+CONWAY_ALWAYS_INLINE void StepRows(const R& rule, const uint64_t* west, const uint64_t* mid, const uint64_t* east, uint64_t* out) {
+    const int lanes = sizeof(V) / sizeof(uint64_t);
+    for (int y = 0; y < 64; y += lanes) {
+        StepRowsAt<V>(rule, west, mid, east, y, out);
+    }
+}
+
+template <typename R>
+void StepRowsScalar(const Rule& rule, const uint64_t* west, const uint64_t* mid, const uint64_t* east, uint64_t* out) {
+    StepRows<uint64_t>(R(rule), west, mid, east, out);
+}
+
+#if defined(__GNUC__)
+// Two rows per operation, which is SSE2 on x86-64 and NEON on ARM.
+typedef uint64_t Rows2 __attribute__((vector_size(16)));
+
+template <typename R>
+void StepRowsVector(const Rule& rule, const uint64_t* west, const uint64_t* mid, const uint64_t* east, uint64_t* out) {
+    StepRows<Rows2>(R(rule), west, mid, east, out);
+}
+#endif
+
+#if defined(__GNUC__) && defined(__x86_64__)
+typedef uint64_t Rows4 __attribute__((vector_size(32)));
+
+template <typename R>
+__attribute__((target("avx2")))
+void StepRowsAvx2(const Rule& rule, const uint64_t* west, const uint64_t* mid, const uint64_t* east, uint64_t* out) {
+    StepRows<Rows4>(R(rule), west, mid, east, out);
+}
+#endif
+
+// The kernels of one instruction set, one per rule type.
+struct KernelChoice {
+    RowKernel kernels[NUM_RULE_KERNELS];
+    const char* name;
+};
+
+// The CONWAY_KERNEL environment variable may force a kernel, e.g. to compare them.
+KernelChoice PickRowKernel() {
+    const char* forced = getenv("CONWAY_KERNEL");
+    if (forced != nullptr && strcmp(forced, "scalar") == 0) {
+        return KernelChoice{CONWAY_RULE_KERNELS(StepRowsScalar), "scalar"};
+    }
+#if defined(__GNUC__) && defined(__x86_64__)
+    if ((forced == nullptr || strcmp(forced, "avx2") == 0) && __builtin_cpu_supports("avx2")) {
+        return KernelChoice{CONWAY_RULE_KERNELS(StepRowsAvx2), "avx2"};
+    }
+#endif
+#if defined(__GNUC__)
+    return KernelChoice{CONWAY_RULE_KERNELS(StepRowsVector), "vector"};
+#else
+    return KernelChoice{CONWAY_RULE_KERNELS(StepRowsScalar), "scalar"};
+#endif
+}
+
+const KernelChoice ROW_KERNEL = PickRowKernel();
+
+RowKernel RowKernelFor(const Rule& rule) {
+    return ROW_KERNEL.kernels[RuleIndex(rule)];
+}
+
+// Like a RowKernel, but only computes the rows of out set in rows, one at a time, for blocks
+// with live cells near few rows. The other rows of out are left as they were.
+typedef void (*SomeRowsKernel)(const Rule& rule, const uint64_t* west, const uint64_t* mid, const uint64_t* east,
+                               uint64_t rows, uint64_t* out);
+
+template <typename R>
+void StepSomeRows(const Rule& rule, const uint64_t* west, const uint64_t* mid, const uint64_t* east, uint64_t rows,
+                  uint64_t* out) {
+    R r(rule);
+    for (; rows != 0; rows &= rows - 1) {
+        StepRowsAt<uint64_t>(r, west, mid, east, __builtin_ctzll(rows), out);
+    }
+}
+
+const SomeRowsKernel SOME_ROWS_KERNELS[NUM_RULE_KERNELS] = CONWAY_RULE_KERNELS(StepSomeRows);
+
+// Times the row kernel of rule on a 64x64 block surrounded by empty cells.
+double TimeRowKernel(const Rule& rule, const uint64_t* rows, int iterations) {
+    uint64_t west[64 + 2] = {0};
+    uint64_t mid[64 + 2] = {0};
+    uint64_t east[64 + 2] = {0};
+    for (int i = 0; i < 64; i++) {
+        mid[i + 1] = rows[i];
+        west[i + 1] = rows[i] << 1;
+        east[i + 1] = rows[i] >> 1;
+    }
+    const RowKernel kernel = RowKernelFor(rule);
+    uint64_t next[64];
+    auto start = std::chrono::steady_clock::now();
+    for (int n = 0; n < iterations; n++) {
+        kernel(rule, west, mid, east, next);
+    }
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+}  // namespace
+
+const BitBlockLife::BlockArray BitBlockLife::EMPTY_BLOCK = BlockArray{{0}};
+const HybridLife::BlockArray HybridLife::EMPTY_BLOCK = BlockArray{{0}};
+
+// BlockLife passes over several generations use the row kernels of BitBlockLife.
+
+void BlockLife::DoSteps(int64_t n) {
+    while (n >= 2) {
+        int steps = static_cast<int>(std::min<int64_t>(n, MAX_PASS_STEPS));
+        DoPass(steps);
+        n -= steps;
+    }
+    if (n == 1) {
+        DoStep();
+    }
+}
+
+// A change travels one cell per generation, so for up to BLOCK_DIM generations a block only
+// depends on its neighbors, and the same skipping as in DoStep applies: blocks whose
+// neighborhood didn't change since one generation ago stay as they are, and blocks whose
+// neighborhood didn't change since two generations ago alternate between their current and
+// previous cells. Every other block next to a change is computed from its neighbors as they
+// were at the start of the pass, so the new cells are only stored once all are computed.
+void BlockLife::DoPass(int steps) {
+    {
+        ScopedTimer timer(PhaseSeconds(WAKE_PHASE));
+        PageInNearChanges();
+        step_count_ += steps;
+        LinkBlocks();
+        WakeNeighbors();
+    }
+    auto compute = [&](size_t shard) {
+        std::vector<PassResult>& results = passes_[shard];
+        results.clear();
+        for (const auto& p : wake_[shard]) {
+            if (p.second == (CHANGED | CHANGED2)) {
+                results.emplace_back();
+                DoPassForBlock(p.first, steps, &results.back());
+            }
+        }
+    };
+    {
+        ScopedTimer timer(PhaseSeconds(PASS_PHASE));
+        if (!pool_) {
+            compute(0);
+        } else {
+            pool_->ParallelFor(blocks_.size(), [&](size_t shard, int thread) { compute(shard); });
+        }
+    }
+    if (stats_enabled()) {
+        for (const auto& results : passes_) {
+            stats_.active_blocks += results.size();
+        }
+    }
+    ScopedTimer timer(PhaseSeconds(FINISH_PHASE));
+    if (!pool_) {
+        FinishPass(0, steps);
+    } else {
+        pool_->ParallelFor(blocks_.size(), [&](size_t shard, int thread) { FinishPass(shard, steps); });
+    }
+    LinkBlocks();
+    SpillColdBlocks();
+}
+
+// Runs the block and steps cells around it for steps generations. Garbage from outside the
+// tile moves inwards one cell per generation, so it never reaches the block itself.
+void BlockLife::DoPassForBlock(const Point& block_index, int steps, PassResult* result) {
+    const int TILE_ROWS = 2 * BLOCK_DIM;
+    // Row y of the tile is in mid[y + 1], with the cell x of the tile in bit x. The block
+    // starts at row and column steps.
+    uint64_t west[TILE_ROWS + 2];
+    uint64_t mid[TILE_ROWS + 2] = {0};
+    uint64_t east[TILE_ROWS + 2];
+    uint64_t next[TILE_ROWS];
+    // Blocks next to changes mostly exist, and then link to their neighbors.
+    const BlockMap::value_type* center = blocks_[shardOf(block_index)].find(block_index);
+    for (int dy = -1; dy <= 1; dy++) {
+        // Rows of the neighbor inside the tile.
+        int first = dy < 0 ? BLOCK_DIM - steps : 0;
+        int last = dy > 0 ? steps : BLOCK_DIM;
+        for (int dx = -1; dx <= 1; dx++) {
+            const Block* block;
+            if (center != nullptr) {
+                block = center->second->neighbors[NeighborSlot(dx, dy)];
+            } else {
+                Point neighbor(block_index.x + dx * BLOCK_DIM, block_index.y + dy * BLOCK_DIM);
+                const BlockMap::value_type* entry = blocks_[shardOf(neighbor)].find(neighbor);
+                block = entry != nullptr ? entry->second : nullptr;
+            }
+            if (block == nullptr) {
+                continue;
+            }
+            const char* cells = block->cells().data();
+            int shift = dx * BLOCK_DIM + steps;
+            for (int y = first; y < last; y++) {
+                uint64_t bits = PackCells(cells + y * BLOCK_DIM);
+                mid[dy * BLOCK_DIM + y + steps + 1] |= shift < 0 ? bits >> -shift : bits << shift;
+            }
+        }
+    }
+
+    const RowKernel kernel = RowKernelFor(rule_);
+    for (int generation = 0; generation <= steps; generation++) {
+        if (generation > 0) {
+            for (int y = 0; y < TILE_ROWS + 2; y++) {
+                west[y] = mid[y] << 1;
+                east[y] = mid[y] >> 1;
+            }
+            kernel(rule_, west, mid, east, next);
+            memcpy(mid + 1, next, sizeof(next));
+        }
+        if (generation >= steps - 2) {
+            uint32_t* rows = result->rows[steps - generation];
+            for (int y = 0; y < BLOCK_DIM; y++) {
+                rows[y] = static_cast<uint32_t>(mid[y + steps + 1] >> steps);
+            }
+        }
+    }
+}
+
+// Stores the results of the pass for the shard's blocks, and advances the blocks which weren't
+// computed like FinishShard does.
+void BlockLife::FinishPass(size_t shard, int steps) {
+    BlockMap& blocks = blocks_[shard];
+    const PassResult* result = passes_[shard].data();
+    for (const auto& p : wake_[shard]) {
+        BlockMap::value_type* entry = blocks.find(p.first);
+        Block* block = entry != nullptr ? entry->second : nullptr;
+        if (p.second == (CHANGED | CHANGED2)) {
+            const PassResult& r = *result++;
+            uint32_t live = 0;
+            uint32_t any = 0;
+            uint32_t changed = 0;
+            uint32_t changed2 = 0;
+            for (int y = 0; y < BLOCK_DIM; y++) {
+                live |= r.rows[0][y];
+                any |= r.rows[0][y] | r.rows[1][y] | r.rows[2][y];
+                changed |= r.rows[0][y] ^ r.rows[1][y];
+                changed2 |= r.rows[0][y] ^ r.rows[2][y];
+            }
+            if (block == nullptr) {
+                if (any == 0) {
+                    continue;
+                }
+                block = NewBlock(shard, p.first);
+            }
+            for (int y = 0; y < BLOCK_DIM; y++) {
+                UnpackCells(r.rows[0][y], block->previous().data() + y * BLOCK_DIM);
+                UnpackCells(r.rows[1][y], block->cells().data() + y * BLOCK_DIM);
+            }
+            block->current ^= 1;
+            block->changes = (changed != 0 ? CHANGED : 0) | (changed2 != 0 ? CHANGED2 : 0);
+            if (live != 0) {
+                // Over several generations an empty block may fill up and settle without
+                // changes at the end.
+                block->empty_since = -1;
+            }
+            // The cells may have changed during the pass even without changes at its end.
+            if (hashing()) {
+                RehashBlock(shard, p.first, block);
+            }
+        } else if (block == nullptr) {
+            continue;
+        } else if (p.second & CHANGED) {
+            // A period 2 block, which ends up on its previous cells after an odd number of
+            // generations.
+            if (steps % 2 == 1) {
+                block->current ^= 1;
+                if (hashing()) {
+                    RehashBlock(shard, p.first, block);
+                }
+            }
+            block->changes &= CHANGED;
+        } else {
+            block->changes = 0;
+        }
+        SettleBlock(shard, p.first, block);
+    }
+    wake_[shard].clear();
+    RecycleEmptyBlocks(shard);
+}
+
+BitBlockLife::BitBlockLife()
+  : blocks_(new PointMap<BlockArray>()),
+    new_blocks_(new PointMap<BlockArray>()),
+    visited_(new PointMap<bool>()),
+    blocks_created_(0) {
+}
+
+BitBlockLife::~BitBlockLife() {}
+
+const char* BitBlockLife::KernelName() {
+    return ROW_KERNEL.name;
+}
+
+double BitBlockLife::TimeBlockKernel(const uint64_t* rows, int iterations) {
+    return TimeRowKernel(rule_, rows, iterations);
+}
+
+Point BitBlockLife::toBlockIndex(const Point& p) {
+    return Point(p.x >> BLOCK_SHIFT, p.y >> BLOCK_SHIFT);
+}
+
+void BitBlockLife::AddLivePoint(const Point& p) {
+    BlockArray& block = blocks_->emplace(toBlockIndex(p), EMPTY_BLOCK).first->second;
+    block[p.y & (BLOCK_DIM - 1)] |= uint64_t(1) << (p.x & (BLOCK_DIM - 1));
+}
+
+// Each word of bits covers at most two blocks, so it is ORed into them with two shifts.
+void BitBlockLife::AddLiveRow(int64_t x, int64_t y, const uint64_t* bits, size_t num_cells) {
+    int shift = static_cast<int>(x & (BLOCK_DIM - 1));
+    int row = static_cast<int>(y & (BLOCK_DIM - 1));
+    for (size_t i = 0; i < num_cells; i += 64) {
+        uint64_t word = bits[i / 64];
+        if (num_cells - i < 64) {
+            word &= (uint64_t(1) << (num_cells - i)) - 1;
+        }
+        if (word == 0) {
+            continue;
+        }
+        Point index = toBlockIndex(Point(static_cast<int64_t>(static_cast<uint64_t>(x) + i), y));
+        blocks_->emplace(index, EMPTY_BLOCK).first->second[row] |= word << shift;
+        if (shift != 0 && (word >> (BLOCK_DIM - shift)) != 0) {
+            Point next = wrapBlockIndex(index.x + 1, index.y);
+            blocks_->emplace(next, EMPTY_BLOCK).first->second[row] |= word >> (BLOCK_DIM - shift);
+        }
+    }
+}
+
+void BitBlockLife::AddBitBlock(const Point& block_index, const uint64_t* rows) {
+    BlockArray& block = blocks_->emplace(wrapBlockIndex(block_index.x, block_index.y), EMPTY_BLOCK).first->second;
+    for (int y = 0; y < BLOCK_DIM; y++) {
+        block[y] |= rows[y];
+    }
+}
+
+// Block indices only span 64 - BLOCK_SHIFT bits, so wrap them the same way cell coordinates
+// wrap at the edges of the int64 space.
+Point BitBlockLife::wrapBlockIndex(int64_t x, int64_t y) {
+    return Point(static_cast<int64_t>(static_cast<uint64_t>(x) << BLOCK_SHIFT) >> BLOCK_SHIFT,
+                 static_cast<int64_t>(static_cast<uint64_t>(y) << BLOCK_SHIFT) >> BLOCK_SHIFT);
+}
+
+const BitBlockLife::BlockArray& BitBlockLife::FindBlock(int64_t x, int64_t y) {
+    auto block = blocks_->find(wrapBlockIndex(x, y));
+    return block == nullptr ? EMPTY_BLOCK : block->second;
+}
+
+void BitBlockLife::DoStep() {
+    for (const auto& p : *blocks_) {
+        const Point& index = p.first;
+        const BlockArray& block = p.second;
+        DoStepForBlock(index);
+
+        // Live cells on the edges may give birth in neighboring blocks which don't exist yet.
+        uint64_t columns = 0;
+        for (uint64_t row : block) {
+            columns |= row;
+        }
+        bool edges[3][3] = {
+            {(block[0] & 1) != 0, block[0] != 0, (block[0] >> 63) != 0},
+            {(columns & 1) != 0, false, (columns >> 63) != 0},
+            {(block[BLOCK_DIM - 1] & 1) != 0, block[BLOCK_DIM - 1] != 0, (block[BLOCK_DIM - 1] >> 63) != 0},
+        };
+        for (int dy = -1; dy <= 1; dy++) {
+            for (int dx = -1; dx <= 1; dx++) {
+                if (!edges[dy + 1][dx + 1]) {
+                    continue;
+                }
+                Point neighbor = wrapBlockIndex(index.x + dx, index.y + dy);
+                if (blocks_->count(neighbor) == 0 && visited_->emplace(neighbor, true).second) {
+                    DoStepForBlock(neighbor);
+                }
+            }
+        }
+    }
+    if (stats_enabled()) {
+        stats_.active_blocks += blocks_->size() + visited_->size();
+    }
+    new_blocks_.swap(blocks_);
+    new_blocks_->clear();
+    visited_->clear();
+}
+
+void BitBlockLife::DoStepForBlock(const Point& block_index) {
+    int64_t x = block_index.x;
+    int64_t y = block_index.y;
+    const BlockArray& sw = FindBlock(x - 1, y - 1);
+    const BlockArray& s = FindBlock(x, y - 1);
+    const BlockArray& se = FindBlock(x + 1, y - 1);
+    const BlockArray& w = FindBlock(x - 1, y);
+    const BlockArray& c = FindBlock(x, y);
+    const BlockArray& e = FindBlock(x + 1, y);
+    const BlockArray& nw = FindBlock(x - 1, y + 1);
+    const BlockArray& n = FindBlock(x, y + 1);
+    const BlockArray& ne = FindBlock(x + 1, y + 1);
+
+    // Pad the block with the adjacent row of its south and north neighbors and line up each
+    // cell with its west and east neighbors, pulling in the edge columns of adjacent blocks.
+    uint64_t west[BLOCK_DIM + 2];
+    uint64_t mid[BLOCK_DIM + 2];
+    uint64_t east[BLOCK_DIM + 2];
+    mid[0] = s[BLOCK_DIM - 1];
+    west[0] = (mid[0] << 1) | (sw[BLOCK_DIM - 1] >> 63);
+    east[0] = (mid[0] >> 1) | (se[BLOCK_DIM - 1] << 63);
+    for (int i = 0; i < BLOCK_DIM; i++) {
+        mid[i + 1] = c[i];
+        west[i + 1] = (c[i] << 1) | (w[i] >> 63);
+        east[i + 1] = (c[i] >> 1) | (e[i] << 63);
+    }
+    mid[BLOCK_DIM + 1] = n[0];
+    west[BLOCK_DIM + 1] = (n[0] << 1) | (nw[0] >> 63);
+    east[BLOCK_DIM + 1] = (n[0] >> 1) | (ne[0] << 63);
+
+    BlockArray next;
+    RowKernelFor(rule_)(rule_, west, mid, east, next.data());
+    uint64_t any = 0;
+    for (uint64_t row : next) {
+        any |= row;
+    }
+    if (any != 0) {
+        new_blocks_->emplace(block_index, next);
+        if (&c == &EMPTY_BLOCK) {
+            blocks_created_++;
+        }
+    }
+}
+
+std::vector<Point> BitBlockLife::LivePoints() {
+    std::vector<Point> live_points;
+    for (const auto& pair : *blocks_) {
+        for (int y = 0; y < BLOCK_DIM; y++) {
+            for (uint64_t row = pair.second[y]; row != 0; row &= row - 1) {
+                live_points.emplace_back(pair.first.x * BLOCK_DIM + __builtin_ctzll(row),
+                                         pair.first.y * BLOCK_DIM + y);
+            }
+        }
+    }
+    return live_points;
+}
+
+void BitBlockLife::CopyBitBlocks(std::vector<BitBlock>* blocks) {
+    blocks->reserve(blocks->size() + blocks_->size());
+    for (const auto& pair : *blocks_) {
+        uint64_t any = 0;
+        for (uint64_t row : pair.second) {
+            any |= row;
+        }
+        if (any != 0) {
+            blocks->push_back(BitBlock{pair.first, pair.second});
+        }
+    }
+}
+
+// Small rectangles look up each block position they cover, larger ones scan every block.
+void BitBlockLife::VisitLivePoints(const Range& x_range, const Range& y_range, LivePointVisitor* visitor) {
+    if (x_range.first > x_range.second || y_range.first > y_range.second) {
+        return;
+    }
+    int64_t x_start = x_range.first >> BLOCK_SHIFT;
+    int64_t y_start = y_range.first >> BLOCK_SHIFT;
+    uint64_t columns = static_cast<uint64_t>((x_range.second >> BLOCK_SHIFT) - x_start) + 1;
+    uint64_t rows = static_cast<uint64_t>((y_range.second >> BLOCK_SHIFT) - y_start) + 1;
+    size_t blocks = blocks_->size();
+    if (columns <= blocks && rows <= blocks && columns * rows <= blocks) {
+        for (uint64_t row = 0; row < rows; row++) {
+            for (uint64_t column = 0; column < columns; column++) {
+                Point index(x_start + static_cast<int64_t>(column), y_start + static_cast<int64_t>(row));
+                const PointMap<BlockArray>::value_type* block = blocks_->find(index);
+                if (block != nullptr) {
+                    VisitBlock(block->first, block->second, x_range, y_range, visitor);
+                }
+            }
+        }
+        return;
+    }
+    for (const auto& pair : *blocks_) {
+        VisitBlock(pair.first, pair.second, x_range, y_range, visitor);
+    }
+}
+
+void BitBlockLife::VisitBlock(const Point& block_index, const BlockArray& block,
+                              const Range& x_range, const Range& y_range, LivePointVisitor* visitor) {
+    int64_t x_origin = block_index.x * BLOCK_DIM;
+    int64_t y_origin = block_index.y * BLOCK_DIM;
+    int64_t x_end = x_origin + (BLOCK_DIM - 1);
+    int64_t y_end = y_origin + (BLOCK_DIM - 1);
+    if (x_origin > x_range.second || x_end < x_range.first ||
+        y_origin > y_range.second || y_end < y_range.first) {
+        return;
+    }
+    int x0 = x_range.first > x_origin ? static_cast<int>(x_range.first - x_origin) : 0;
+    int x1 = x_range.second < x_end ? static_cast<int>(x_range.second - x_origin) : BLOCK_DIM - 1;
+    int y0 = y_range.first > y_origin ? static_cast<int>(y_range.first - y_origin) : 0;
+    int y1 = y_range.second < y_end ? static_cast<int>(y_range.second - y_origin) : BLOCK_DIM - 1;
+    uint64_t columns = (~uint64_t(0) >> (BLOCK_DIM - 1 - x1)) & (~uint64_t(0) << x0);
+    for (int y = y0; y <= y1; y++) {
+        for (uint64_t row = block[y] & columns; row != 0; row &= row - 1) {
+            visitor->Visit(x_origin + __builtin_ctzll(row), y_origin + y);
+        }
+    }
+}
+
+size_t BitBlockLife::TableSize() {
+    return blocks_->size();
+}
+
+void BitBlockLife::CountBlocks(uint64_t* blocks, uint64_t* created) {
+    *blocks = blocks_->size();
+    *created = blocks_created_;
+}
+
+void BitBlockLife::CollectStats(StepStats* stats) {
+    for (const auto& p : *blocks_) {
+        for (uint64_t row : p.second) {
+            stats->live_cells += __builtin_popcountll(row);
+        }
+    }
+    stats->table_size = blocks_->size();
+    stats->table_capacity = blocks_->capacity();
+    blocks_->AddProbeLengths(&stats->total_probe_length, &stats->max_probe_length);
+}
+
+HybridLife::HybridLife()
+  : blocks_(new PointMap<Block>()),
+    new_blocks_(new PointMap<Block>()),
+    visited_(new PointMap<bool>()),
+    blocks_created_(0) {
+}
+
+HybridLife::~HybridLife() {}
+
+double HybridLife::TimeBlockKernel(const uint64_t* rows, int iterations) {
+    return TimeRowKernel(rule_, rows, iterations);
+}
+
+void HybridLife::AddLivePoint(const Point& p) {
+    AddBits(Point(p.x >> BLOCK_SHIFT, p.y >> BLOCK_SHIFT), static_cast<int>(p.y & (BLOCK_DIM - 1)),
+            uint64_t(1) << (p.x & (BLOCK_DIM - 1)));
+}
+
+// Each word of bits covers at most two blocks, so it is ORed into them with two shifts, like in
+// BitBlockLife.
+void HybridLife::AddLiveRow(int64_t x, int64_t y, const uint64_t* bits, size_t num_cells) {
+    int shift = static_cast<int>(x & (BLOCK_DIM - 1));
+    int row = static_cast<int>(y & (BLOCK_DIM - 1));
+    for (size_t i = 0; i < num_cells; i += 64) {
+        uint64_t word = bits[i / 64];
+        if (num_cells - i < 64) {
+            word &= (uint64_t(1) << (num_cells - i)) - 1;
+        }
+        if (word == 0) {
+            continue;
+        }
+        Point index(static_cast<int64_t>(static_cast<uint64_t>(x) + i) >> BLOCK_SHIFT, y >> BLOCK_SHIFT);
+        if ((word << shift) != 0) {
+            AddBits(index, row, word << shift);
+        }
+        if (shift != 0 && (word >> (BLOCK_DIM - shift)) != 0) {
+            AddBits(wrapBlockIndex(index.x + 1, index.y), row, word >> (BLOCK_DIM - shift));
+        }
+    }
+}
+
+void HybridLife::AddBitBlock(const Point& block_index, const uint64_t* rows) {
+    Point index = wrapBlockIndex(block_index.x, block_index.y);
+    Block* block = nullptr;
+    for (int y = 0; y < BLOCK_DIM; y++) {
+        if (rows[y] != 0) {
+            block = &AddBits(index, y, rows[y], false);
+        }
+    }
+    if (block != nullptr && density_ != nullptr) {
+        density_->Set(index, BlockPopulation(block));
+    }
+}
+
+HybridLife::Block& HybridLife::AddBits(const Point& block_index, int y, uint64_t bits, bool update_density) {
+    const Block EMPTY = {nullptr, 0, {0}};
+    Block& block = blocks_->emplace(block_index, EMPTY).first->second;
+    if (block.rows == nullptr) {
+        uint64_t added = bits;
+        for (int i = 0; i < block.size; i++) {
+            if ((block.cells[i] >> BLOCK_SHIFT) == y) {
+                added &= ~(uint64_t(1) << (block.cells[i] & (BLOCK_DIM - 1)));
+            }
+        }
+        if (block.size + __builtin_popcountll(added) <= SPARSE_CELLS) {
+            for (; added != 0; added &= added - 1) {
+                block.cells[block.size++] = static_cast<uint16_t>(y * BLOCK_DIM + __builtin_ctzll(added));
+            }
+            if (update_density && density_ != nullptr) {
+                density_->Set(block_index, block.size);
+            }
+            return block;
+        }
+        // Full, so the block becomes dense.
+        block.rows = rows_.Allocate();
+        block.rows->fill(0);
+        for (int i = 0; i < block.size; i++) {
+            (*block.rows)[block.cells[i] >> BLOCK_SHIFT] |= uint64_t(1) << (block.cells[i] & (BLOCK_DIM - 1));
+        }
+        block.size = 0;
+    }
+    (*block.rows)[y] |= bits;
+    if (update_density && density_ != nullptr) {
+        density_->Set(block_index, BlockPopulation(&block));
+    }
+    return block;
+}
+
+// Block indices only span 64 - BLOCK_SHIFT bits, so wrap them the same way cell coordinates
+// wrap at the edges of the int64 space.
+Point HybridLife::wrapBlockIndex(int64_t x, int64_t y) {
+    return Point(static_cast<int64_t>(static_cast<uint64_t>(x) << BLOCK_SHIFT) >> BLOCK_SHIFT,
+                 static_cast<int64_t>(static_cast<uint64_t>(y) << BLOCK_SHIFT) >> BLOCK_SHIFT);
+}
+
+const HybridLife::Block* HybridLife::FindBlock(int64_t x, int64_t y) {
+    auto block = blocks_->find(wrapBlockIndex(x, y));
+    return block == nullptr ? nullptr : &block->second;
+}
+
+void HybridLife::DoStep() {
+    for (const auto& p : *blocks_) {
+        const Point& index = p.first;
+        const Block& block = p.second;
+        DoStepForBlock(index);
+
+        // Live cells on the edges may give birth in neighboring blocks which don't exist yet.
+        bool edges[3][3] = {{false}};
+        if (block.rows != nullptr) {
+            const BlockArray& rows = *block.rows;
+            uint64_t columns = 0;
+            for (uint64_t row : rows) {
+                columns |= row;
+            }
+            bool row_edges[3][3] = {
+                {(rows[0] & 1) != 0, rows[0] != 0, (rows[0] >> 63) != 0},
+                {(columns & 1) != 0, false, (columns >> 63) != 0},
+                {(rows[BLOCK_DIM - 1] & 1) != 0, rows[BLOCK_DIM - 1] != 0, (rows[BLOCK_DIM - 1] >> 63) != 0},
+            };
+            memcpy(edges, row_edges, sizeof(edges));
+        } else {
+            for (int i = 0; i < block.size; i++) {
+                int x = block.cells[i] & (BLOCK_DIM - 1);
+                int y = block.cells[i] >> BLOCK_SHIFT;
+                for (int ey = y == 0 ? 0 : 1; ey <= (y == BLOCK_DIM - 1 ? 2 : 1); ey++) {
+                    for (int ex = x == 0 ? 0 : 1; ex <= (x == BLOCK_DIM - 1 ? 2 : 1); ex++) {
+                        edges[ey][ex] = true;
+                    }
+                }
+            }
+        }
+        for (int dy = -1; dy <= 1; dy++) {
+            for (int dx = -1; dx <= 1; dx++) {
+                if ((dx == 0 && dy == 0) || !edges[dy + 1][dx + 1]) {
+                    continue;
+                }
+                Point neighbor = wrapBlockIndex(index.x + dx, index.y + dy);
+                if (blocks_->count(neighbor) == 0 && visited_->emplace(neighbor, true).second) {
+                    DoStepForBlock(neighbor);
+                }
+            }
+        }
+    }
+    if (stats_enabled()) {
+        stats_.active_blocks += blocks_->size() + visited_->size();
+    }
+    for (const auto& p : *blocks_) {
+        if (p.second.rows != nullptr) {
+            rows_.Free(p.second.rows);
+        }
+    }
+    new_blocks_.swap(blocks_);
+    new_blocks_->clear();
+    visited_->clear();
+}
+
+// Adds the cells of the neighbor at (dx, dy), or of the block itself at (0, 0), that fall
+// inside the window, marking the rows they land on as occupied. Rows are zeroed as they become
+// occupied, so that sparse windows never touch the rest.
+void HybridLife::AddToWindow(const Block& block, int dx, int dy, Window* window) {
+    if (block.rows != nullptr) {
+        const BlockArray& rows = *block.rows;
+        uint64_t* column = dx < 0 ? window->west : (dx > 0 ? window->east : window->mid);
+        // Bit 63 of the neighbors to the west, bit 0 of the ones to the east, the whole row
+        // otherwise. Only the nearest row of the neighbors to the south and north.
+        int shift = dx < 0 ? BLOCK_DIM - 1 : 0;
+        uint64_t mask = dx == 0 ? ~uint64_t(0) : 1;
+        int first = dy > 0 ? 0 : (dy < 0 ? BLOCK_DIM - 1 : 0);
+        int last = dy < 0 ? BLOCK_DIM - 1 : (dy > 0 ? 0 : BLOCK_DIM - 1);
+        for (int y = first; y <= last; y++) {
+            uint64_t bits = (rows[y] >> shift) & mask;
+            if (bits != 0) {
+                int r = y + dy * BLOCK_DIM + 1;
+                OccupyRow(r, window);
+                column[r] |= bits;
+            }
+        }
+        return;
+    }
+    for (int j = 0; j < block.size; j++) {
+        int x = (block.cells[j] & (BLOCK_DIM - 1)) + dx * BLOCK_DIM;
+        int y = (block.cells[j] >> BLOCK_SHIFT) + dy * BLOCK_DIM;
+        if (x < -1 || x > BLOCK_DIM || y < -1 || y > BLOCK_DIM) {
+            continue;
+        }
+        OccupyRow(y + 1, window);
+        if (x < 0) {
+            window->west[y + 1] = 1;
+        } else if (x == BLOCK_DIM) {
+            window->east[y + 1] = 1;
+        } else {
+            window->mid[y + 1] |= uint64_t(1) << x;
+        }
+    }
+}
+
+void HybridLife::OccupyRow(int r, Window* window) {
+    unsigned __int128 bit = static_cast<unsigned __int128>(1) << r;
+    if ((window->occupied & bit) == 0) {
+        window->occupied |= bit;
+        window->west[r] = 0;
+        window->mid[r] = 0;
+        window->east[r] = 0;
+    }
+}
+
+const HybridLife::BlockArray& HybridLife::NeighborRows(const Block* block, BlockArray* scratch) {
+    if (block == nullptr) {
+        return EMPTY_BLOCK;
+    }
+    if (block->rows != nullptr) {
+        return *block->rows;
+    }
+    scratch->fill(0);
+    for (int i = 0; i < block->size; i++) {
+        (*scratch)[block->cells[i] >> BLOCK_SHIFT] |= uint64_t(1) << (block->cells[i] & (BLOCK_DIM - 1));
+    }
+    return *scratch;
+}
+
+// Runs the row kernel over the whole block, lining up its rows like BitBlockLife does.
+uint64_t HybridLife::StepDenseBlock(const Block* const blocks[3][3], BlockArray* next) {
+    BlockArray scratch[3][3];
+    const BlockArray& sw = NeighborRows(blocks[0][0], &scratch[0][0]);
+    const BlockArray& s = NeighborRows(blocks[0][1], &scratch[0][1]);
+    const BlockArray& se = NeighborRows(blocks[0][2], &scratch[0][2]);
+    const BlockArray& w = NeighborRows(blocks[1][0], &scratch[1][0]);
+    const BlockArray& c = NeighborRows(blocks[1][1], &scratch[1][1]);
+    const BlockArray& e = NeighborRows(blocks[1][2], &scratch[1][2]);
+    const BlockArray& nw = NeighborRows(blocks[2][0], &scratch[2][0]);
+    const BlockArray& n = NeighborRows(blocks[2][1], &scratch[2][1]);
+    const BlockArray& ne = NeighborRows(blocks[2][2], &scratch[2][2]);
+
+    uint64_t west[BLOCK_DIM + 2];
+    uint64_t mid[BLOCK_DIM + 2];
+    uint64_t east[BLOCK_DIM + 2];
+    mid[0] = s[BLOCK_DIM - 1];
+    west[0] = (mid[0] << 1) | (sw[BLOCK_DIM - 1] >> 63);
+    east[0] = (mid[0] >> 1) | (se[BLOCK_DIM - 1] << 63);
+    for (int i = 0; i < BLOCK_DIM; i++) {
+        mid[i + 1] = c[i];
+        west[i + 1] = (c[i] << 1) | (w[i] >> 63);
+        east[i + 1] = (c[i] >> 1) | (e[i] << 63);
+    }
+    mid[BLOCK_DIM + 1] = n[0];
+    west[BLOCK_DIM + 1] = (n[0] << 1) | (nw[0] >> 63);
+    east[BLOCK_DIM + 1] = (n[0] >> 1) | (ne[0] << 63);
+    RowKernelFor(rule_)(rule_, west, mid, east, next->data());
+    return ~uint64_t(0);
+}
+
+// Gathers only the live cells near the block into a window, and computes only the rows next to
+// them, which for a sparse block is a few rows. Falls back to the row kernel when that is most
+// rows. Returns the rows of next computed; the others are empty.
+uint64_t HybridLife::StepSparseBlock(const Block* const blocks[3][3], BlockArray* next) {
+    Window window;
+    window.occupied = 0;
+    for (int dy = -1; dy <= 1; dy++) {
+        for (int dx = -1; dx <= 1; dx++) {
+            if (blocks[dy + 1][dx + 1] != nullptr) {
+                AddToWindow(*blocks[dy + 1][dx + 1], dx, dy, &window);
+            }
+        }
+    }
+    uint64_t rows = static_cast<uint64_t>(window.occupied | (window.occupied >> 1) | (window.occupied >> 2));
+    bool all_rows = __builtin_popcountll(rows) > SPARSE_ROWS;
+    if (all_rows) {
+        rows = ~uint64_t(0);
+    }
+    // Line up the rows those read, zeroing the ones without live cells.
+    unsigned __int128 inputs = rows;
+    inputs |= (inputs << 1) | (inputs << 2);
+    for (int half = 0; half < 2; half++) {
+        for (uint64_t bits = static_cast<uint64_t>(inputs >> (64 * half)); bits != 0; bits &= bits - 1) {
+            int i = 64 * half + __builtin_ctzll(bits);
+            OccupyRow(i, &window);
+            window.west[i] |= window.mid[i] << 1;
+            window.east[i] = (window.mid[i] >> 1) | (window.east[i] << 63);
+        }
+    }
+    if (all_rows) {
+        RowKernelFor(rule_)(rule_, window.west, window.mid, window.east, next->data());
+    } else {
+        SOME_ROWS_KERNELS[RuleIndex(rule_)](rule_, window.west, window.mid, window.east, rows, next->data());
+    }
+    return rows;
+}
+
+int HybridLife::BlockPopulation(const Block* block) {
+    if (block == nullptr || block->rows == nullptr) {
+        return block == nullptr ? 0 : block->size;
+    }
+    int population = 0;
+    for (uint64_t row : *block->rows) {
+        population += __builtin_popcountll(row);
+    }
+    return population;
+}
+
+void HybridLife::DoStepForBlock(const Point& block_index) {
+    const Block* blocks[3][3];
+    for (int dy = -1; dy <= 1; dy++) {
+        for (int dx = -1; dx <= 1; dx++) {
+            blocks[dy + 1][dx + 1] = FindBlock(block_index.x + dx, block_index.y + dy);
+        }
+    }
+    const Block* center = blocks[1][1];
+    bool dense = center != nullptr && center->rows != nullptr;
+    BlockArray next;
+    uint64_t rows = dense ? StepDenseBlock(blocks, &next) : StepSparseBlock(blocks, &next);
+    int population = 0;
+    for (uint64_t todo = rows; todo != 0; todo &= todo - 1) {
+        population += __builtin_popcountll(next[__builtin_ctzll(todo)]);
+    }
+    if (density_ != nullptr) {
+        density_->Set(block_index, population);
+    }
+    if (population == 0) {
+        return;
+    }
+    Block block;
+    block.size = 0;
+    if (population > SPARSE_CELLS || (dense && population > DENSE_MIN_CELLS)) {
+        block.rows = rows_.Allocate();
+        for (int y = 0; y < BLOCK_DIM; y++) {
+            (*block.rows)[y] = ((rows >> y) & 1) != 0 ? next[y] : 0;
+        }
+    } else {
+        block.rows = nullptr;
+        for (; rows != 0; rows &= rows - 1) {
+            int y = __builtin_ctzll(rows);
+            for (uint64_t row = next[y]; row != 0; row &= row - 1) {
+                block.cells[block.size++] = static_cast<uint16_t>(y * BLOCK_DIM + __builtin_ctzll(row));
+            }
+        }
+    }
+    new_blocks_->emplace(block_index, block);
+    if (center == nullptr) {
+        blocks_created_++;
+    }
+}
+
+std::vector<Point> HybridLife::LivePoints() {
+    std::vector<Point> live_points;
+    Range everything(std::numeric_limits<int64_t>::min(), std::numeric_limits<int64_t>::max());
+    ForEachLivePoint(everything, everything, [&](int64_t x, int64_t y) { live_points.emplace_back(x, y); });
+    return live_points;
+}
+
+// Small rectangles look up each block position they cover, larger ones scan every block.
+void HybridLife::VisitLivePoints(const Range& x_range, const Range& y_range, LivePointVisitor* visitor) {
+    if (x_range.first > x_range.second || y_range.first > y_range.second) {
+        return;
+    }
+    int64_t x_start = x_range.first >> BLOCK_SHIFT;
+    int64_t y_start = y_range.first >> BLOCK_SHIFT;
+    uint64_t columns = static_cast<uint64_t>((x_range.second >> BLOCK_SHIFT) - x_start) + 1;
+    uint64_t rows = static_cast<uint64_t>((y_range.second >> BLOCK_SHIFT) - y_start) + 1;
+    size_t blocks = blocks_->size();
+    if (columns <= blocks && rows <= blocks && columns * rows <= blocks) {
+        for (uint64_t row = 0; row < rows; row++) {
+            for (uint64_t column = 0; column < columns; column++) {
+                Point index(x_start + static_cast<int64_t>(column), y_start + static_cast<int64_t>(row));
+                const PointMap<Block>::value_type* block = blocks_->find(index);
+                if (block != nullptr) {
+                    VisitBlock(block->first, block->second, x_range, y_range, visitor);
+                }
+            }
+        }
+        return;
+    }
+    for (const auto& pair : *blocks_) {
+        VisitBlock(pair.first, pair.second, x_range, y_range, visitor);
+    }
+}
+
+void HybridLife::VisitDensity(int level, const Range& x_range, const Range& y_range, DensityVisitor* visitor) {
+    if (level < BLOCK_SHIFT) {
+        Life::VisitDensity(level, x_range, y_range, visitor);
+        return;
+    }
+    if (density_ == nullptr) {
+        density_.reset(new DensityPyramid(BLOCK_SHIFT));
+        for (const auto& p : *blocks_) {
+            density_->Set(p.first, BlockPopulation(&p.second));
+        }
+    }
+    density_->Visit(level, x_range, y_range, visitor);
+}
+
+void HybridLife::VisitBlock(const Point& block_index, const Block& block,
+                            const Range& x_range, const Range& y_range, LivePointVisitor* visitor) {
+    int64_t x_origin = block_index.x * BLOCK_DIM;
+    int64_t y_origin = block_index.y * BLOCK_DIM;
+    int64_t x_end = x_origin + (BLOCK_DIM - 1);
+    int64_t y_end = y_origin + (BLOCK_DIM - 1);
+    if (x_origin > x_range.second || x_end < x_range.first ||
+        y_origin > y_range.second || y_end < y_range.first) {
+        return;
+    }
+    int x0 = x_range.first > x_origin ? static_cast<int>(x_range.first - x_origin) : 0;
+    int x1 = x_range.second < x_end ? static_cast<int>(x_range.second - x_origin) : BLOCK_DIM - 1;
+    int y0 = y_range.first > y_origin ? static_cast<int>(y_range.first - y_origin) : 0;
+    int y1 = y_range.second < y_end ? static_cast<int>(y_range.second - y_origin) : BLOCK_DIM - 1;
+    if (block.rows == nullptr) {
+        for (int i = 0; i < block.size; i++) {
+            int x = block.cells[i] & (BLOCK_DIM - 1);
+            int y = block.cells[i] >> BLOCK_SHIFT;
+            if (x >= x0 && x <= x1 && y >= y0 && y <= y1) {
+                visitor->Visit(x_origin + x, y_origin + y);
+            }
+        }
+        return;
+    }
+    uint64_t columns = (~uint64_t(0) >> (BLOCK_DIM - 1 - x1)) & (~uint64_t(0) << x0);
+    for (int y = y0; y <= y1; y++) {
+        for (uint64_t row = (*block.rows)[y] & columns; row != 0; row &= row - 1) {
+            visitor->Visit(x_origin + __builtin_ctzll(row), y_origin + y);
+        }
+    }
+}
+
+uint64_t HybridLife::Population() {
+    uint64_t population = 0;
+    for (const auto& p : *blocks_) {
+        population += BlockPopulation(&p.second);
+    }
+    return population;
+}
+
+void HybridLife::Clear() {
+    for (const auto& p : *blocks_) {
+        if (p.second.rows != nullptr) {
+            rows_.Free(p.second.rows);
+        }
+    }
+    blocks_->clear();
+    generation_ = 0;
+    blocks_created_ = 0;
+    density_.reset();
+}
+
+size_t HybridLife::TableSize() {
+    return blocks_->size();
+}
+
+void HybridLife::CopyBitBlocks(std::vector<BitBlock>* blocks) {
+    blocks->reserve(blocks->size() + blocks_->size());
+    for (const auto& pair : *blocks_) {
+        const Block& block = pair.second;
+        if (block.rows != nullptr) {
+            blocks->push_back(BitBlock{pair.first, *block.rows});
+        } else if (block.size != 0) {
+            blocks->push_back(BitBlock{pair.first, {{0}}});
+            for (int i = 0; i < block.size; i++) {
+                blocks->back().rows[block.cells[i] >> BLOCK_SHIFT] |= uint64_t(1) << (block.cells[i] & (BLOCK_DIM - 1));
+            }
+        }
+    }
+}
+
+void HybridLife::CountBlocks(uint64_t* blocks, uint64_t* created) {
+    *blocks = blocks_->size();
+    *created = blocks_created_;
+}
+
+void HybridLife::CollectStats(StepStats* stats) {
+    stats->live_cells = Population();
+    stats->table_size = blocks_->size();
+    stats->table_capacity = blocks_->capacity();
+    blocks_->AddProbeLengths(&stats->total_probe_length, &stats->max_probe_length);
+}
+
+bool DenseTorusLife::Fits(const Torus& torus) {
+    return torus.bounded() && torus.width <= MAX_CELLS && torus.height <= MAX_CELLS / torus.width;
+}
+
+DenseTorusLife::DenseTorusLife(const Torus& torus)
+  : torus_(torus),
+    x0_(-(torus.width / 2)),
+    y0_(-(torus.height / 2)),
+    words_per_row_((torus.width + 63) / 64),
+    last_bits_(static_cast<int>((torus.width - 1) % 64) + 1),
+    cells_(words_per_row_ * torus.height, 0),
+    next_(words_per_row_ * torus.height, 0) {
+}
+
+DenseTorusLife::~DenseTorusLife() {}
+
+void DenseTorusLife::set_num_threads(int num_threads) {
+    pool_.reset(num_threads > 1 ? new WorkStealingPool(num_threads) : nullptr);
+}
+
+void DenseTorusLife::AddLivePoint(const Point& p) {
+    // Remainders first, so that nothing overflows near the edges of the plane.
+    int64_t x = (p.x % torus_.width - x0_ % torus_.width) % torus_.width;
+    int64_t y = (p.y % torus_.height - y0_ % torus_.height) % torus_.height;
+    x += x < 0 ? torus_.width : 0;
+    y += y < 0 ? torus_.height : 0;
+    cells_[y * words_per_row_ + x / 64] |= uint64_t(1) << (x % 64);
+}
+
+void DenseTorusLife::DoStep() {
+    int64_t bands = (torus_.height + BAND_ROWS - 1) / BAND_ROWS;
+    if (!pool_) {
+        for (int64_t band = 0; band < bands; band++) {
+            DoStepForBand(band);
+        }
+    } else {
+        pool_->ParallelFor(bands, [&](size_t band, int thread) { DoStepForBand(band); });
+    }
+    cells_.swap(next_);
+}
+
+// Computes the rows of the band one word column at a time, gathering the column with the rows
+// above and below the band and lining up each cell with its west and east neighbors, which
+// wrap around from the other side of the torus.
+void DenseTorusLife::DoStepForBand(int64_t band) {
+    const RowKernel kernel = RowKernelFor(rule_);
+    int64_t first = band * BAND_ROWS;
+    int rows = static_cast<int>(std::min<int64_t>(BAND_ROWS, torus_.height - first));
+    // Offsets of the rows from the one below the band to the one above it. The kernel always
+    // computes BAND_ROWS rows, so short bands read further rows they then ignore.
+    int64_t offsets[BAND_ROWS + 2];
+    for (int i = 0; i < BAND_ROWS + 2; i++) {
+        offsets[i] = ((first - 1 + i + torus_.height) % torus_.height) * words_per_row_;
+    }
+    const int64_t last = words_per_row_ - 1;
+    const uint64_t last_mask = last_bits_ == 64 ? ~uint64_t(0) : (uint64_t(1) << last_bits_) - 1;
+    uint64_t west[BAND_ROWS + 2];
+    uint64_t mid[BAND_ROWS + 2];
+    uint64_t east[BAND_ROWS + 2];
+    uint64_t next[BAND_ROWS];
+    for (int64_t c = 0; c <= last; c++) {
+        for (int i = 0; i < BAND_ROWS + 2; i++) {
+            const uint64_t* row = &cells_[offsets[i]];
+            uint64_t word = row[c];
+            uint64_t west_cell = c > 0 ? row[c - 1] >> 63 : (row[last] >> (last_bits_ - 1)) & 1;
+            uint64_t east_cell = c < last ? (row[c + 1] & 1) << 63 : (row[0] & 1) << (last_bits_ - 1);
+            mid[i] = word;
+            west[i] = (word << 1) | west_cell;
+            east[i] = (word >> 1) | east_cell;
+        }
+        kernel(rule_, west, mid, east, next);
+        uint64_t mask = c == last ? last_mask : ~uint64_t(0);
+        for (int i = 0; i < rows; i++) {
+            next_[(first + i) * words_per_row_ + c] = next[i] & mask;
+        }
+    }
+}
+
+std::vector<Point> DenseTorusLife::LivePoints() {
+    std::vector<Point> live_points;
+    Range everything(std::numeric_limits<int64_t>::min(), std::numeric_limits<int64_t>::max());
+    ForEachLivePoint(everything, everything, [&](int64_t x, int64_t y) { live_points.emplace_back(x, y); });
+    return live_points;
+}
+
+void DenseTorusLife::VisitLivePoints(const Range& x_range, const Range& y_range, LivePointVisitor* visitor) {
+    for (int64_t y = 0; y < torus_.height; y++) {
+        if (y0_ + y < y_range.first || y0_ + y > y_range.second) {
+            continue;
+        }
+        const uint64_t* row = &cells_[y * words_per_row_];
+        for (int64_t c = 0; c < words_per_row_; c++) {
+            for (uint64_t word = row[c]; word != 0; word &= word - 1) {
+                int64_t x = x0_ + c * 64 + __builtin_ctzll(word);
+                if (x >= x_range.first && x <= x_range.second) {
+                    visitor->Visit(x, y0_ + y);
+                }
+            }
+        }
+    }
+}
+
+size_t DenseTorusLife::TableSize() {
+    return 0;
+}
+
+double DenseTorusLife::TimeBlockKernel(const uint64_t* rows, int iterations) {
+    return TimeRowKernel(rule_, rows, iterations);
+}
+
+void DenseTorusLife::CollectStats(StepStats* stats) {
+    for (uint64_t word : cells_) {
+        stats->live_cells += __builtin_popcountll(word);
+    }
+}
+
+struct HashLife::Node {
+    Node* nw;
+    Node* ne;
+    Node* sw;
+    Node* se;
+    // Next node in the hash chain.
+    Node* next;
+    // Memoized center of this node advanced by 2^min(step_log2_, level - 2) generations.
+    Node* result;
+    uint64_t population;
+    int level;
+    bool marked;
+};
+
+HashLife::HashLife()
+    : root_(nullptr),
+      dead_leaf_(new Node{nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, 0, 0, false}),
+      live_leaf_(new Node{nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, 1, 0, false}),
+      buckets_(1 << 10, nullptr),
+      node_count_(0),
+      nodes_created_(0),
+      // Picked to comfortably fit in memory on a desktop machine.
+      max_memory_(size_t(1) << 30),
+      next_gc_(max_memory_),
+      step_log2_(0) {
+    empty_nodes_.push_back(dead_leaf_);
+    root_ = EmptyNode(3);
+}
+
+HashLife::~HashLife() {
+    for (Node* bucket : buckets_) {
+        while (bucket != nullptr) {
+            Node* next = bucket->next;
+            delete bucket;
+            bucket = next;
+        }
+    }
+    delete dead_leaf_;
+    delete live_leaf_;
+}
+
+size_t HashLife::memory_usage() const {
+    return node_count_ * sizeof(Node) + buckets_.size() * sizeof(Node*);
+}
+
+// Returns the canonical node with the given children, creating it if it doesn't exist yet.
+HashLife::Node* HashLife::Join(Node* nw, Node* ne, Node* sw, Node* se) {
+    uint64_t hash = reinterpret_cast<uintptr_t>(nw);
+    hash = hash * 0x9E3779B97F4A7C15ULL + reinterpret_cast<uintptr_t>(ne);
+    hash = hash * 0x9E3779B97F4A7C15ULL + reinterpret_cast<uintptr_t>(sw);
+    hash = hash * 0x9E3779B97F4A7C15ULL + reinterpret_cast<uintptr_t>(se);
+    hash ^= hash >> 29;
+    Node** bucket = &buckets_[hash & (buckets_.size() - 1)];
+    for (Node* n = *bucket; n != nullptr; n = n->next) {
+        if (n->nw == nw && n->ne == ne && n->sw == sw && n->se == se) {
+            return n;
+        }
+    }
+    Node* n = new Node{nw, ne, sw, se, *bucket, nullptr,
+                       nw->population + ne->population + sw->population + se->population,
+                       nw->level + 1, false};
+    *bucket = n;
+    nodes_created_++;
+    if (++node_count_ > buckets_.size()) {
+        Resize();
+    }
+    return n;
+}
+
+void HashLife::Resize() {
+    std::vector<Node*> buckets(buckets_.size() * 2, nullptr);
+    for (Node* bucket : buckets_) {
+        while (bucket != nullptr) {
+            Node* next = bucket->next;
+            uint64_t hash = reinterpret_cast<uintptr_t>(bucket->nw);
+            hash = hash * 0x9E3779B97F4A7C15ULL + reinterpret_cast<uintptr_t>(bucket->ne);
+            hash = hash * 0x9E3779B97F4A7C15ULL + reinterpret_cast<uintptr_t>(bucket->sw);
+            hash = hash * 0x9E3779B97F4A7C15ULL + reinterpret_cast<uintptr_t>(bucket->se);
+            hash ^= hash >> 29;
+            Node** slot = &buckets[hash & (buckets.size() - 1)];
+            bucket->next = *slot;
+            *slot = bucket;
+            bucket = next;
+        }
+    }
+    buckets_.swap(buckets);
+}
+
+HashLife::Node* HashLife::EmptyNode(int level) {
+    while (static_cast<int>(empty_nodes_.size()) <= level) {
+        Node* e = empty_nodes_.back();
+        empty_nodes_.push_back(Join(e, e, e, e));
+    }
+    return empty_nodes_[level];
+}
+
+// Surrounds n with a border of empty space, doubling its width while keeping it centered.
+HashLife::Node* HashLife::Expand(Node* n) {
+    Node* e = EmptyNode(n->level - 1);
+    return Join(Join(e, e, e, n->nw), Join(e, e, n->ne, e),
+                Join(e, n->sw, e, e), Join(n->se, e, e, e));
+}
+
+// Returns the node half the width of n sharing its center.
+HashLife::Node* HashLife::CenteredSubnode(Node* n) {
+    return Join(n->nw->se, n->ne->sw, n->sw->ne, n->se->nw);
+}
+
+// Returns the node a quarter the width of n sharing its center.
+HashLife::Node* HashLife::CenteredSubSubnode(Node* n) {
+    return Join(n->nw->se->se, n->ne->sw->sw, n->sw->ne->ne, n->se->nw->nw);
+}
+
+// Runs a single generation on the 4x4 cells of a level 2 node and returns the 2x2 center.
+HashLife::Node* HashLife::BaseCase(Node* n) {
+    // Bit (y * 4 + x) holds the cell at (x, y) with y growing northwards.
+    Node* quadrants[4] = {n->sw, n->se, n->nw, n->ne};
+    int cells = 0;
+    for (int q = 0; q < 4; q++) {
+        int shift = (q & 1) * 2 + (q >> 1) * 8;
+        cells |= static_cast<int>(quadrants[q]->sw->population) << shift;
+        cells |= static_cast<int>(quadrants[q]->se->population) << (shift + 1);
+        cells |= static_cast<int>(quadrants[q]->nw->population) << (shift + 4);
+        cells |= static_cast<int>(quadrants[q]->ne->population) << (shift + 5);
+    }
+    Node* next[4];
+    for (int i = 0; i < 4; i++) {
+        int x = 1 + (i & 1);
+        int y = 1 + (i >> 1);
+        int neighbors = 0;
+        for (int dy = -1; dy <= 1; dy++) {
+            for (int dx = -1; dx <= 1; dx++) {
+                if (dx != 0 || dy != 0) {
+                    neighbors += (cells >> ((y + dy) * 4 + (x + dx))) & 1;
+                }
+            }
+        }
+        bool alive = (cells >> (y * 4 + x)) & 1;
+        next[i] = (((alive ? rule_.survival : rule_.birth) >> neighbors) & 1) ? live_leaf_ : dead_leaf_;
+    }
+    return Join(next[2], next[3], next[0], next[1]);
+}
+
+// Returns the center of n advanced by 2^min(step_log2_, level - 2) generations.
+// The nine overlapping subnodes of n are either advanced (when taking the largest step the
+// node allows) or just recentered, then combined into four nodes which are advanced again.
+HashLife::Node* HashLife::NextGeneration(Node* n) {
+    if (n->result != nullptr) {
+        return n->result;
+    }
+    if (n->population == 0) {
+        n->result = n->nw;
+        return n->result;
+    }
+    if (stats_enabled()) {
+        stats_.active_blocks++;
+    }
+    if (n->level == 2) {
+        n->result = BaseCase(n);
+        return n->result;
+    }
+
+    Node* m00 = n->nw;
+    Node* m01 = Join(n->nw->ne, n->ne->nw, n->nw->se, n->ne->sw);
+    Node* m02 = n->ne;
+    Node* m10 = Join(n->nw->sw, n->nw->se, n->sw->nw, n->sw->ne);
+    Node* m11 = CenteredSubnode(n);
+    Node* m12 = Join(n->ne->sw, n->ne->se, n->se->nw, n->se->ne);
+    Node* m20 = n->sw;
+    Node* m21 = Join(n->sw->ne, n->se->nw, n->sw->se, n->se->sw);
+    Node* m22 = n->se;
+
+    if (step_log2_ >= n->level - 2) {
+        m00 = NextGeneration(m00);
+        m01 = NextGeneration(m01);
+        m02 = NextGeneration(m02);
+        m10 = NextGeneration(m10);
+        m11 = NextGeneration(m11);
+        m12 = NextGeneration(m12);
+        m20 = NextGeneration(m20);
+        m21 = NextGeneration(m21);
+        m22 = NextGeneration(m22);
+    } else {
+        m00 = CenteredSubnode(m00);
+        m01 = CenteredSubnode(m01);
+        m02 = CenteredSubnode(m02);
+        m10 = CenteredSubnode(m10);
+        m11 = CenteredSubnode(m11);
+        m12 = CenteredSubnode(m12);
+        m20 = CenteredSubnode(m20);
+        m21 = CenteredSubnode(m21);
+        m22 = CenteredSubnode(m22);
+    }
+
+    n->result = Join(NextGeneration(Join(m00, m01, m10, m11)),
+                     NextGeneration(Join(m01, m02, m11, m12)),
+                     NextGeneration(Join(m10, m11, m20, m21)),
+                     NextGeneration(Join(m11, m12, m21, m22)));
+    return n->result;
+}
+
+// Returns a copy of n with the cell at (x, y), relative to the node's south west corner, set.
+HashLife::Node* HashLife::SetCell(Node* n, uint64_t x, uint64_t y) {
+    if (n->level == 0) {
+        return live_leaf_;
+    }
+    uint64_t half = uint64_t(1) << (n->level - 1);
+    bool east = (x & half) != 0;
+    bool north = (y & half) != 0;
+    x &= half - 1;
+    y &= half - 1;
+    if (north) {
+        return east ? Join(n->nw, SetCell(n->ne, x, y), n->sw, n->se)
+                    : Join(SetCell(n->nw, x, y), n->ne, n->sw, n->se);
+    }
+    return east ? Join(n->nw, n->ne, n->sw, SetCell(n->se, x, y))
+                : Join(n->nw, n->ne, SetCell(n->sw, x, y), n->se);
+}
+
+void HashLife::AddLivePoint(const Point& p) {
+    // The root is always centered on the origin, so it covers [-2^(level-1), 2^(level-1)).
+    while (root_->level < MAX_LEVEL) {
+        int64_t half = int64_t(1) << (root_->level - 1);
+        if (p.x >= -half && p.x < half && p.y >= -half && p.y < half) {
+            break;
+        }
+        root_ = Expand(root_);
+    }
+    uint64_t half = uint64_t(1) << (root_->level - 1);
+    root_ = SetCell(root_, static_cast<uint64_t>(p.x) + half, static_cast<uint64_t>(p.y) + half);
+}
+
+void HashLife::DoStep() {
+    Advance(0);
+}
+
+void HashLife::DoSteps(int64_t n) {
+    while (n > 0) {
+        // Switching the step size throws away the memoized results, so keep the current one
+        // while it fits.
+        int k = 63 - __builtin_clzll(static_cast<uint64_t>(n));
+        if ((int64_t(1) << step_log2_) <= n) {
+            k = step_log2_;
+        }
+        k = std::min(k, static_cast<int>(MAX_STEP_LOG2));
+        Advance(k);
+        n -= int64_t(1) << k;
+    }
+}
+
+void HashLife::StepPow2(int k) {
+    k = std::max(0, std::min(k, static_cast<int>(MAX_STEP_LOG2)));
+    generation_ += int64_t(1) << k;
+    Advance(k);
+}
+
+void HashLife::Advance(int step_log2) {
+    if (step_log2 != step_log2_) {
+        // Memoized results are only valid for the step size they were computed with.
+        ClearResults();
+        step_log2_ = step_log2;
+    }
+    if (root_->population == 0) {
+        return;
+    }
+    // The result of a level L node is its center advanced by 2^(L - 2) generations at most,
+    // so the pattern must sit well inside the root for nothing to escape the result.
+    while (root_->level < MAX_LEVEL &&
+           (root_->level < step_log2 + 3 ||
+            CenteredSubSubnode(root_)->population != root_->population)) {
+        root_ = Expand(root_);
+    }
+    if (root_->level < MAX_LEVEL) {
+        root_ = NextGeneration(root_);
+    } else {
+        // The root covers the whole int64 plane, which wraps at its edges. Tiling it 2x2 gives
+        // a node whose result is the wrapped plane advanced, but offset by half its width.
+        Node* next = NextGeneration(Join(root_, root_, root_, root_));
+        root_ = Join(next->se, next->sw, next->ne, next->nw);
+    }
+    if (memory_usage() > next_gc_) {
+        CollectGarbage();
+        next_gc_ = std::max(max_memory_, GC_GROWTH * memory_usage());
+    }
+}
+
+void HashLife::set_rule(const Rule& rule) {
+    if (rule != rule_) {
+        Life::set_rule(rule);
+        ClearResults();
+    }
+}
+
+void HashLife::ClearResults() {
+    for (Node* bucket : buckets_) {
+        for (Node* n = bucket; n != nullptr; n = n->next) {
+            n->result = nullptr;
+        }
+    }
+}
+
+void HashLife::Mark(Node* n) {
+    if (n->marked || n->level == 0) {
+        return;
+    }
+    n->marked = true;
+    Mark(n->nw);
+    Mark(n->ne);
+    Mark(n->sw);
+    Mark(n->se);
+}
+
+// Frees every node which isn't reachable from the current generation. Memoized results
+// are kept only when they point at surviving nodes.
+void HashLife::CollectGarbage() {
+    Mark(root_);
+    for (Node* e : empty_nodes_) {
+        Mark(e);
+    }
+    for (Node* bucket : buckets_) {
+        for (Node* n = bucket; n != nullptr; n = n->next) {
+            if (n->marked && n->result != nullptr && n->result->level > 0 && !n->result->marked) {
+                n->result = nullptr;
+            }
+        }
+    }
+    for (Node*& bucket : buckets_) {
+        Node** link = &bucket;
+        while (*link != nullptr) {
+            Node* n = *link;
+            if (n->marked) {
+                n->marked = false;
+                link = &n->next;
+            } else {
+                *link = n->next;
+                delete n;
+                node_count_--;
+            }
+        }
+    }
+}
+
+void HashLife::CollectLivePoints(Node* n, uint64_t x, uint64_t y, std::vector<Point>* points) {
+    if (n->population == 0) {
+        return;
+    }
+    if (n->level == 0) {
+        points->emplace_back(static_cast<int64_t>(x), static_cast<int64_t>(y));
+        return;
+    }
+    uint64_t half = uint64_t(1) << (n->level - 1);
+    CollectLivePoints(n->sw, x, y, points);
+    CollectLivePoints(n->se, x + half, y, points);
+    CollectLivePoints(n->nw, x, y + half, points);
+    CollectLivePoints(n->ne, x + half, y + half, points);
+}
+
+std::vector<Point> HashLife::LivePoints() {
+    std::vector<Point> live_points;
+    uint64_t half = uint64_t(1) << (root_->level - 1);
+    CollectLivePoints(root_, -half, -half, &live_points);
+    return live_points;
+}
+
+void HashLife::VisitNode(Node* n, uint64_t x, uint64_t y,
+                         const Range& x_range, const Range& y_range, LivePointVisitor* visitor) {
+    if (n->population == 0) {
+        return;
+    }
+    uint64_t span = n->level >= 64 ? ~uint64_t(0) : (uint64_t(1) << n->level) - 1;
+    if (static_cast<int64_t>(x) > x_range.second || static_cast<int64_t>(x + span) < x_range.first ||
+        static_cast<int64_t>(y) > y_range.second || static_cast<int64_t>(y + span) < y_range.first) {
+        return;
+    }
+    if (n->level == 0) {
+        visitor->Visit(static_cast<int64_t>(x), static_cast<int64_t>(y));
+        return;
+    }
+    uint64_t half = uint64_t(1) << (n->level - 1);
+    VisitNode(n->sw, x, y, x_range, y_range, visitor);
+    VisitNode(n->se, x + half, y, x_range, y_range, visitor);
+    VisitNode(n->nw, x, y + half, x_range, y_range, visitor);
+    VisitNode(n->ne, x + half, y + half, x_range, y_range, visitor);
+}
+
+void HashLife::VisitLivePoints(const Range& x_range, const Range& y_range, LivePointVisitor* visitor) {
+    uint64_t half = uint64_t(1) << (root_->level - 1);
+    VisitNode(root_, -half, -half, x_range, y_range, visitor);
+}
+
+void HashLife::VisitNodeDensity(Node* n, uint64_t x, uint64_t y, int level,
+                                const Range& x_range, const Range& y_range, DensityVisitor* visitor) {
+    if (n->population == 0) {
+        return;
+    }
+    uint64_t span = n->level >= 64 ? ~uint64_t(0) : (uint64_t(1) << n->level) - 1;
+    if (static_cast<int64_t>(x) > x_range.second || static_cast<int64_t>(x + span) < x_range.first ||
+        static_cast<int64_t>(y) > y_range.second || static_cast<int64_t>(y + span) < y_range.first) {
+        return;
+    }
+    // Nodes are aligned to their size, so a node no larger than a tile lies inside one, and
+    // only the root's children can be smaller than a tile.
+    if (n->level <= level) {
+        visitor->Visit(static_cast<int64_t>(x) >> level, static_cast<int64_t>(y) >> level, n->population);
+        return;
+    }
+    uint64_t half = uint64_t(1) << (n->level - 1);
+    VisitNodeDensity(n->sw, x, y, level, x_range, y_range, visitor);
+    VisitNodeDensity(n->se, x + half, y, level, x_range, y_range, visitor);
+    VisitNodeDensity(n->nw, x, y + half, level, x_range, y_range, visitor);
+    VisitNodeDensity(n->ne, x + half, y + half, level, x_range, y_range, visitor);
+}
+
+// The root is centered on the origin rather than aligned to its size, so start from its
+// children.
+void HashLife::VisitDensity(int level, const Range& x_range, const Range& y_range, DensityVisitor* visitor) {
+    uint64_t half = uint64_t(1) << (root_->level - 1);
+    VisitNodeDensity(root_->sw, -half, -half, level, x_range, y_range, visitor);
+    VisitNodeDensity(root_->se, 0, -half, level, x_range, y_range, visitor);
+    VisitNodeDensity(root_->nw, -half, 0, level, x_range, y_range, visitor);
+    VisitNodeDensity(root_->ne, 0, 0, level, x_range, y_range, visitor);
+}
+
+size_t HashLife::TableSize() {
+    return node_count_;
+}
+
+void HashLife::CountBlocks(uint64_t* blocks, uint64_t* created) {
+    *blocks = node_count_;
+    *created = nodes_created_;
+}
+
+void HashLife::CollectStats(StepStats* stats) {
+    stats->live_cells = root_->population;
+    stats->table_size = node_count_;
+    stats->table_capacity = buckets_.size();
+    for (Node* bucket : buckets_) {
+        size_t length = 0;
+        for (Node* n = bucket; n != nullptr; n = n->next) {
+            stats->total_probe_length += length;
+            length++;
+        }
+        stats->max_probe_length = std::max(stats->max_probe_length, length == 0 ? 0 : length - 1);
+    }
 }
 
 }  // namespace conway
\ No newline at end of file
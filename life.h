@@ -4,61 +4,190 @@
 #include <array>
 #include <cstdint>
 #include <functional>
-#include <unordered_map>
-#include <unordered_set>
+#include <memory>
+#include <utility>
 #include <vector>
 
-namespace conway {
+#include "block_pool.h"
+#include "cycle.h"
+#include "density.h"
+#include "point.h"
+#include "point_map.h"
+#include "rule.h"
+#include "spill.h"
+#include "stats.h"
 
-struct Point {
-    int64_t x;
-    int64_t y;
+namespace conway {
 
-    Point(int64_t x, int64_t y) : x(x), y(y) {}
-    Point(const Point &o) : x(o.x), y(o.y) {}
+class WorkStealingPool;
 
-    bool operator==(const Point& o) const {
-        return x == o.x && y == o.y;
-    }
+class LivePointVisitor {
+    public:
+    virtual ~LivePointVisitor() {}
+    virtual void Visit(int64_t x, int64_t y) = 0;
 };
 
-}  // namespace conway
-
-namespace std {
-template <>
-struct hash<const conway::Point> {
-    size_t operator() (const conway::Point& p) const {
-        hash<char> int64_hash;
-        char hash = 17;
-        hash = 31 * hash + int64_hash(p.x);
-        hash = 31 * hash + int64_hash(p.y);
-        return hash;
-    }
+// 64x64 cells with one bit per cell, for moving whole regions between engines and files.
+// Bit x of rows[y] is the cell (64 * index.x + x, 64 * index.y + y).
+struct BitBlock {
+    Point index;
+    std::array<uint64_t, 64> rows;
 };
-}  // namespace std
-
-namespace conway {
 
 class Life {
     protected:
     int64_t generation_;
+    Rule rule_;
 
     public:
-    Life() : generation_(0) {}
+    Life() : generation_(0), stats_enabled_(false) {}
+    virtual ~Life() {}
 
     int64_t generation() { return generation_; }
+    // For restoring saved state.
+    void set_generation(int64_t generation) { generation_ = generation; }
+
+    const Rule& rule() const { return rule_; }
+    // The grid the engine runs on. Engines run on the int64 plane unless they say otherwise.
+    virtual Torus torus() const { return Torus(); }
+    // Engines run common rules, such as Life, HighLife, Day & Night and Seeds, with kernels
+    // specialized for them, and any other rule with a slower generic kernel.
+    virtual void set_rule(const Rule& rule) { rule_ = rule; }
 
     virtual void AddLivePoint(const Point& p) = 0;
     void AddLivePoint(int64_t x, int64_t y) { this->AddLivePoint(Point(x, y)); }
+
+    // Adds the cells (x + i, y) for every i < num_cells set in bits, where cell i is bit i % 64
+    // of bits[i / 64]. Engines override this to write whole runs of cells into their blocks at
+    // once, which makes loading large patterns much faster than adding points one by one.
+    virtual void AddLiveRow(int64_t x, int64_t y, const uint64_t* bits, size_t num_cells);
+    // Adds the live cells of the 64x64 block at block_index, laid out like BitBlock::rows.
+    virtual void AddBitBlock(const Point& block_index, const uint64_t* rows);
+
     void Step() {
+        if (cycles_) {
+            StepDetectingCycles(1);
+            return;
+        }
         generation_ += 1;
-        this->DoStep();
+        if (stats_enabled_) {
+            StepWithStats(1);
+        } else {
+            this->DoStep();
+        }
+    }
+
+    // Advances n generations. Engines may run several generations per pass over their blocks,
+    // which is much faster than n calls to Step(). Once a cycle is known, jumps over as many
+    // whole periods as fit.
+    void Step(int64_t n) {
+        if (n > 0 && cycles_) {
+            StepDetectingCycles(n);
+        } else if (n > 0) {
+            generation_ += n;
+            if (stats_enabled_) {
+                StepWithStats(n);
+            } else {
+                this->DoSteps(n);
+            }
+        }
     }
 
-    virtual std::vector<const Point> LivePoints() = 0;
+    // While enabled, each Step collects StepStats, which costs a pass over the engine's blocks
+    // and hash table after the step. Disabled, the only cost is a branch per step and phase.
+    void set_stats_enabled(bool enabled) { stats_enabled_ = enabled; }
+    bool stats_enabled() const { return stats_enabled_; }
+    // Stats of the last Step taken while enabled.
+    const StepStats& stats() const { return stats_; }
+
+    // While enabled, the engine keeps a BoardHash of its cells and every Step compares it with
+    // the hashes of the generations before to find cycles, stepping one generation at a time
+    // until it does. LiveLife and BlockLife update the hash as cells change; other engines hash
+    // all of their cells after every generation. Adding cells or changing the rule starts over.
+    void set_cycle_detection(bool enabled);
+    bool cycle_detection() const { return cycles_ != nullptr; }
+    // The period and displacement the cells repeat with, confirmed by comparing the cells a
+    // period apart, or a Cycle with period 0 while none is known or detection is disabled.
+    // Steps then jump over whole periods, moving the cells of engines that can move them, or
+    // else only over the periods of cycles without displacement.
+    Cycle cycle() const { return cycles_ ? cycles_->cycle() : Cycle(); }
+    // The hash of the cells as of the last Step while detection is enabled.
+    const BoardHash& board_hash() const { return hash_; }
+
+    virtual std::vector<Point> LivePoints() = 0;
+
+    // Calls visitor for every live point inside the rectangle, without allocating. Engines skip
+    // whole blocks or subtrees outside of it, so the cost follows the visible area rather than
+    // the total population.
+    virtual void VisitLivePoints(const Range& x_range, const Range& y_range, LivePointVisitor* visitor) = 0;
+
+    // Calls visitor with the live cells of every tile of level that overlaps the rectangle and
+    // has any, for drawing zoomed out patterns with about one value per pixel; see
+    // DensityVisitor. By default counts the cells VisitLivePoints visits, which costs as much as
+    // visiting them. Engines keeping a DensityPyramid answer from it instead, at a cost that
+    // follows the number of tiles, from the first call on.
+    virtual void VisitDensity(int level, const Range& x_range, const Range& y_range, DensityVisitor* visitor);
+
+    // Appends the live cells as 64x64 blocks, one per block index that has live cells.
+    virtual void CopyBitBlocks(std::vector<BitBlock>* blocks);
+
+    // Like VisitLivePoints, but calls f(x, y).
+    template <typename F>
+    void ForEachLivePoint(const Range& x_range, const Range& y_range, F f) {
+        class Adapter : public LivePointVisitor {
+            public:
+            explicit Adapter(F& f) : f_(f) {}
+            void Visit(int64_t x, int64_t y) override { f_(x, y); }
+
+            private:
+            F& f_;
+        } adapter(f);
+        VisitLivePoints(x_range, y_range, &adapter);
+    }
+
+    // Number of entries in the engine's main hash table, e.g. cells, blocks or nodes.
+    virtual size_t TableSize() = 0;
+
+    // Runs the engine's per-block kernel iterations times on a 64x64 block of cells laid out
+    // like BitBlock::rows and surrounded by empty cells, without changing the engine, for
+    // timing the kernel on its own. Returns the seconds taken, or a negative number if the
+    // engine has no per-block kernel.
+    virtual double TimeBlockKernel(const uint64_t* rows, int iterations) { return -1; }
 
     protected:
     virtual void DoStep() = 0;
+    // Advances n > 0 generations, by default one DoStep at a time.
+    virtual void DoSteps(int64_t n);
+
+    // Where to add the time of the named phase of the current step, for ScopedTimer, or
+    // nullptr when stats are disabled.
+    double* PhaseSeconds(const char* name) { return stats_enabled_ ? stats_.Phase(name) : nullptr; }
+    // Counts blocks in use and blocks created so far, for telling the blocks created and
+    // destroyed by a step apart. By default the engine has no blocks.
+    virtual void CountBlocks(uint64_t* blocks, uint64_t* created);
+    // Fills in the live cells and the table of stats after a step. Engines that compute only
+    // some of their blocks also add to stats_.active_blocks during the step.
+    virtual void CollectStats(StepStats* stats) = 0;
+
+    bool hashing() const { return cycles_ != nullptr; }
+    // Recomputes hash_ from every live cell.
+    virtual void ResetHash();
+    // Brings hash_ up to date after steps and added cells, by default with ResetHash. Engines
+    // which update hash_ as they go override this.
+    virtual void UpdateHash() { ResetHash(); }
+    // Moves every cell by displacement, keeping hash_ up to date, for jumping along cycles of
+    // spaceships. Returns false if the engine can't.
+    virtual bool Translate(const Point& displacement) { return false; }
+
+    StepStats stats_;
+    BoardHash hash_;
+
+    private:
+    void StepWithStats(int64_t n);
+    void StepDetectingCycles(int64_t n);
+
+    bool stats_enabled_;
+    std::unique_ptr<CycleDetector> cycles_;
 };
 
 class LiveLife : public Life {
@@ -67,16 +196,26 @@ class LiveLife : public Life {
     ~LiveLife();
 
     void AddLivePoint(const Point& p) override;
-    std::vector<const Point> LivePoints() override;
+    std::vector<Point> LivePoints() override;
+    void VisitLivePoints(const Range& x_range, const Range& y_range, LivePointVisitor* visitor) override;
+    size_t TableSize() override;
+
+    void set_rule(const Rule& rule) override;
 
     protected:
     void DoStep() override;
+    void CollectStats(StepStats* stats) override;
+    // hash_ follows every cell born, died or added.
+    void UpdateHash() override {}
+    bool Translate(const Point& displacement) override;
 
     private:
     bool IsLiveCell(const Point& p);
 
-    std::unique_ptr<std::vector<const Point>> live_points_;
-    std::unique_ptr<std::unordered_map<const Point, int>> weights_;
+    std::unique_ptr<std::vector<Point>> live_points_;
+    std::unique_ptr<PointMap<int>> weights_;
+    // Bit w is set if a cell with weight w is alive in the next generation.
+    uint32_t live_weights_;
 };
 
 class BlockLife : public Life {
@@ -85,25 +224,514 @@ class BlockLife : public Life {
     ~BlockLife();
 
     void AddLivePoint(const Point& p) override;
-    std::vector<const Point> LivePoints() override;
+    void AddLiveRow(int64_t x, int64_t y, const uint64_t* bits, size_t num_cells) override;
+    std::vector<Point> LivePoints() override;
+    void CopyBitBlocks(std::vector<BitBlock>* blocks) override;
+    void VisitLivePoints(const Range& x_range, const Range& y_range, LivePointVisitor* visitor) override;
+    size_t TableSize() override;
+
+    // Splits each step across a pool of num_threads threads. The result of a step doesn't
+    // depend on the number of threads.
+    void set_num_threads(int num_threads);
+
+    // Times computing the four blocks making up rows and the twelve around them, as steps do:
+    // summing the neighborhood of each block and converting the sums into cells.
+    double TimeBlockKernel(const uint64_t* rows, int iterations) override;
+
+    // Heap allocations made for blocks and hash tables so far. Once a pattern settles, e.g.
+    // into oscillators, steps reuse blocks and table slots and these stay the same.
+    struct AllocationStats {
+        // Chunks of BlockPool<Block>::CHUNK_SIZE blocks.
+        size_t block_chunks;
+        // Slot arrays of the hash tables.
+        size_t table_allocations;
+        // Blocks in use and blocks ready for reuse.
+        size_t blocks;
+        size_t free_blocks;
+    };
+    AllocationStats allocation_stats();
+
+    // Keeps about bytes of blocks in memory, for long runs that leave large areas of debris
+    // behind. Past that, the blocks which no change came within two blocks of for
+    // SPILL_AFTER_STEPS generations, not counting period 2 oscillators, are packed into a
+    // SpillStore on disk, least recently active first, and paged back in as soon as a change
+    // comes that close or cells are added to them. Spilled period 2 blocks go on alternating
+    // on disk, except while cycle detection hashes the board, when they stay in memory.
+    // Queries read spilled blocks from the store without paging them in. 0, the default, keeps
+    // every block in memory, paging every spilled block back in. Returns false if the store
+    // can't be created.
+    bool set_memory_budget(size_t bytes);
+
+    struct SpillStats {
+        // Blocks in the store and in memory.
+        size_t spilled_blocks;
+        size_t resident_blocks;
+        // Blocks spilled and paged back in so far.
+        uint64_t evictions;
+        uint64_t faults;
+        // Bytes of the packed blocks in the store.
+        size_t store_bytes;
+    };
+    SpillStats spill_stats();
 
     protected:
     void DoStep() override;
+    // Runs up to MAX_PASS_STEPS generations per pass. Each block next to a change is advanced
+    // on its own, from a tile of its cells and MAX_PASS_STEPS cells around it, while the tile
+    // stays in cache. Blocks only exchange their edges between passes.
+    void DoSteps(int64_t n) override;
+    void CountBlocks(uint64_t* blocks, uint64_t* created) override;
+    void CollectStats(StepStats* stats) override;
+    void ResetHash() override;
+    // Steps rehash the blocks whose cells they change, and added cells rehash their blocks.
+    void UpdateHash() override;
+    // Reloads the cells at their new positions.
+    bool Translate(const Point& displacement) override;
 
     private:
     static const int BLOCK_SHIFT = 5;
     static const int BLOCK_DIM = 1 << BLOCK_SHIFT;
     static const int64_t BLOCK_MASK = ~((1 << BLOCK_SHIFT) - 1);
     typedef std::array<char, BLOCK_DIM * BLOCK_DIM> BlockArray;
+    // Blocks also keep their cells from the previous generation. When nothing around a block
+    // changed since one generation ago its next generation is its current cells, and when
+    // nothing changed since two generations ago it is its previous cells, so only blocks next
+    // to changes need to be computed.
+    //
+    // Blocks come from per-shard pools and go back once they stayed empty and unchanged for
+    // RECYCLE_STEPS generations, so blocks that empty out and fill up again as patterns move
+    // back and forth keep their memory. Blocks in a pool have empty cells and no changes.
+    //
+    // Each block links to the blocks around it, so that steps find the neighborhood of a block
+    // with one hash table lookup instead of nine. Steps create and retire blocks shard by shard
+    // in parallel, so links are only updated between steps, by LinkBlocks.
+    struct Block {
+        // The current and the previous cells, which trade places by flipping current.
+        BlockArray generations[2];
+        uint8_t current;
+        // CHANGED and CHANGED2 bits.
+        uint8_t changes;
+        // Whether the block is in empty_blocks_.
+        bool queued;
+        // The step count since which the block has been empty and unchanged, or -1.
+        int64_t empty_since;
+        // While a memory budget is set, the step count at which a change was last within two
+        // blocks of this one.
+        int64_t active_at;
+        // The hash of the cells as last added to hash_, while hashing.
+        BoardHash hash;
+        Point index;
+        // The blocks around, at NeighborSlot(dx, dy), with this block in the middle, or nullptr
+        // where there are none.
+        Block* neighbors[9];
+
+        BlockArray& cells() { return generations[current]; }
+        const BlockArray& cells() const { return generations[current]; }
+        BlockArray& previous() { return generations[current ^ 1]; }
+    };
+    typedef PointMap<Block*> BlockMap;
+    // A block waiting to be recycled, and the step count to check it at.
+    struct EmptyBlock {
+        Point index;
+        int64_t due;
+    };
+    // The cells of a block at the end of a pass and one and two generations before, one bit per
+    // cell: bit x of rows[i][y] is cells()[y * BLOCK_DIM + x] i generations before the end.
+    struct PassResult {
+        uint32_t rows[3][BLOCK_DIM];
+    };
     static const BlockArray EMPTY_BLOCK;
+    // A tile of a block and MAX_PASS_STEPS cells on each side fits 64-bit rows.
+    static const int MAX_PASS_STEPS = 16;
+    static const int64_t RECYCLE_STEPS = 16;
+    // The cells differ from one generation ago.
+    static const uint8_t CHANGED = 1;
+    // The cells differ from two generations ago.
+    static const uint8_t CHANGED2 = 2;
+    static const int64_t SPILL_AFTER_STEPS = 64;
+    static const uint32_t SPILLED_PERIOD_2 = 1;
 
-    void DoStepForBlock(const Point& p, const BlockArray& block);
+    static int NeighborSlot(int dx, int dy) { return (dy + 1) * 3 + dx + 1; }
+
+    Block& EditBlock(const Point& block_index);
+    Block* NewBlock(size_t shard, const Point& block_index);
+    // Unlinks and frees the blocks retired since the last call, then links the blocks created.
+    void LinkBlocks();
+    void WakeNeighbors();
+    // Sums the live cells around each cell of the block at NeighborSlot(0, 0) of neighborhood
+    // into weights for the cells kernels, plus 10 for a live cell itself. neighborhood holds
+    // the cells of the block and the blocks around it, or nullptr where there are none.
+    static void SumNeighborhood(const BlockArray* const neighborhood[9], BlockArray* weights);
+    // Computes the next cells of a block of the shard into its previous cells, and its changes.
+    // The cells of a block that doesn't exist yet go to new_blocks_ if any are born.
+    void DoStepForBlock(size_t shard, const Point& block_index);
+    void FinishShard(size_t shard);
+    void DoPass(int steps);
+    void DoPassForBlock(const Point& block_index, int steps, PassResult* result);
+    void FinishPass(size_t shard, int steps);
+    void SettleBlock(size_t shard, const Point& block_index, Block* block);
+    void RecycleEmptyBlocks(size_t shard);
+    // Adds the change of the block's hash to the shard's hash_changes_.
+    void RehashBlock(size_t shard, const Point& block_index, Block* block);
+    void VisitBlock(const Point& block_index, const BlockArray& block,
+                    const Range& x_range, const Range& y_range, LivePointVisitor* visitor);
+    // Pages in the spilled blocks within two blocks of a change, which the step may read or
+    // write, and marks the blocks there as active. Called before the step is counted.
+    void PageInNearChanges();
+    // Moves the spilled block back into memory, unlinked, and among the changed blocks if it
+    // has period 2. Returns nullptr if it isn't spilled.
+    Block* PageIn(const Point& block_index);
+    // Spills the least recently active cold blocks once more blocks than the budget are in
+    // memory, down to 3/4 of the budget.
+    void SpillColdBlocks();
+    // Reads the current and previous rows of the spilled block as of step_count_, laid out
+    // like PassResult::rows[0].
+    void ReadSpilled(const SpillStore::Handle& handle, uint32_t* rows, uint32_t* previous);
+    // Writes the mask of the rows of cells with live cells to record, followed by those rows,
+    // and returns the number of words written.
+    static int PackRows(const BlockArray& cells, uint32_t* record);
+    // Reads rows written by PackRows, returning the end of them.
+    static const uint32_t* UnpackRows(const uint32_t* record, uint32_t* rows);
+    // Calls f(block_index, cells) for every spilled block.
+    template <typename F>
+    void ForEachSpilledBlock(F f);
     Point toBlockIndex(const Point& p);
     Point toBlockCoordinates(const Point& p);
+    size_t shardOf(const Point& block_index);
+
+    // Holds 32x32 blocks of points, sharded by block index. Blocks stay until both their
+    // cells and previous cells stayed empty and unchanged for RECYCLE_STEPS generations.
+    std::vector<BlockMap> blocks_;
+    std::vector<BlockPool<Block>> pools_;
+    // Blocks found empty and unchanged, by shard, in order of due.
+    std::vector<std::vector<EmptyBlock>> empty_blocks_;
+    // Generations computed, which unlike generation_ moves in step with the passes of DoSteps.
+    int64_t step_count_;
+    // Blocks to create for cells born during a step, with their cells, by shard.
+    std::vector<std::vector<std::pair<Point, BlockArray>>> new_blocks_;
+    // Blocks with changes, by shard.
+    std::vector<std::vector<Point>> changed_;
+    // Changes around each block next to a change, by shard.
+    std::vector<PointMap<uint8_t>> wake_;
+    // Blocks created and blocks recycled but not yet freed since the last LinkBlocks, by shard.
+    std::vector<std::vector<Block*>> created_;
+    std::vector<std::vector<Block*>> retired_;
+    // Results of a pass by shard, in the order of the shard's blocks in wake_ that are computed.
+    std::vector<std::vector<PassResult>> passes_;
+    // While hashing, the changes of the blocks' hashes by shard, not yet added to hash_.
+    std::vector<BoardHash> hash_changes_;
+    // Whether cells were added since the last UpdateHash.
+    bool edited_;
+    std::unique_ptr<WorkStealingPool> pool_;
+    // Blocks in memory past which cold blocks are spilled, or 0.
+    size_t max_resident_blocks_;
+    std::unique_ptr<SpillStore> store_;
+    // The records of the spilled blocks: a header with SPILLED_PERIOD_2 and the parity of the
+    // step count they were spilled at, then the cells, and for period 2 blocks the previous
+    // cells, each as a mask of the rows with live cells followed by those rows packed into bits.
+    PointMap<SpillStore::Handle> spilled_;
+    // Live cells of the spilled blocks at even and at odd step counts.
+    uint64_t spilled_cells_[2];
+    // Step count before which SpillColdBlocks doesn't look for cold blocks again, after it last
+    // found too few.
+    int64_t next_spill_scan_;
+    uint64_t evictions_;
+    uint64_t faults_;
+};
+
+// Like BlockLife, but each 64x64 block stores one bit per cell with one 64-bit word per row.
+// The next generation of a block is computed from the block and its eight neighbors with
+// bitwise adders over shifted rows, several rows at a time when the CPU supports SIMD.
+class BitBlockLife : public Life {
+    public:
+    BitBlockLife();
+    ~BitBlockLife();
+
+    void AddLivePoint(const Point& p) override;
+    void AddLiveRow(int64_t x, int64_t y, const uint64_t* bits, size_t num_cells) override;
+    void AddBitBlock(const Point& block_index, const uint64_t* rows) override;
+    std::vector<Point> LivePoints() override;
+    void CopyBitBlocks(std::vector<BitBlock>* blocks) override;
+    void VisitLivePoints(const Range& x_range, const Range& y_range, LivePointVisitor* visitor) override;
+    size_t TableSize() override;
+
+    // Calls f(block_index, rows) for every block, with rows laid out like BitBlock::rows. Blocks
+    // may be empty.
+    template <typename F>
+    void ForEachBitBlock(F f) {
+        for (const auto& p : *blocks_) {
+            f(p.first, p.second.data());
+        }
+    }
+    // Drops the blocks for which keep(block_index) returns false, e.g. the ones another process
+    // computes.
+    template <typename F>
+    void RetainBlocks(F keep) {
+        blocks_->Retain([&keep](const PointMap<BlockArray>::value_type& p) { return keep(p.first); });
+    }
+
+    // Name of the row kernel picked for this CPU.
+    static const char* KernelName();
+
+    // Times the row kernel.
+    double TimeBlockKernel(const uint64_t* rows, int iterations) override;
+
+    protected:
+    void DoStep() override;
+    void CountBlocks(uint64_t* blocks, uint64_t* created) override;
+    void CollectStats(StepStats* stats) override;
+
+    private:
+    static const int BLOCK_SHIFT = 6;
+    static const int BLOCK_DIM = 1 << BLOCK_SHIFT;
+    typedef std::array<uint64_t, BLOCK_DIM> BlockArray;
+    static const BlockArray EMPTY_BLOCK;
+
+    const BlockArray& FindBlock(int64_t x, int64_t y);
+    void DoStepForBlock(const Point& block_index);
+    void VisitBlock(const Point& block_index, const BlockArray& block,
+                    const Range& x_range, const Range& y_range, LivePointVisitor* visitor);
+    Point toBlockIndex(const Point& p);
+    Point wrapBlockIndex(int64_t x, int64_t y);
+
+    // Keyed by block index, i.e. cell coordinates divided by BLOCK_DIM.
+    std::unique_ptr<PointMap<BlockArray>> blocks_;
+    std::unique_ptr<PointMap<BlockArray>> new_blocks_;
+    // Empty blocks already computed this generation.
+    std::unique_ptr<PointMap<bool>> visited_;
+    // Blocks which came to life where there was no block.
+    uint64_t blocks_created_;
+};
+
+// Keeps each 64x64 block either as a short list of its live cells or, once it holds more than
+// SPARSE_CELLS, as rows of bits like BitBlockLife. Scattered cells, such as the gliders a gun
+// sends across a large area, then cost a few bytes each and are stepped by counting the
+// neighbors of the cells around them, while clustered regions run the row kernels. Blocks move
+// between the two as their population changes, and only go back to a list once they fall to
+// DENSE_MIN_CELLS, so that a block hovering around the threshold doesn't switch every step.
+class HybridLife : public Life {
+    public:
+    HybridLife();
+    ~HybridLife();
+
+    void AddLivePoint(const Point& p) override;
+    void AddLiveRow(int64_t x, int64_t y, const uint64_t* bits, size_t num_cells) override;
+    void AddBitBlock(const Point& block_index, const uint64_t* rows) override;
+    std::vector<Point> LivePoints() override;
+    void VisitLivePoints(const Range& x_range, const Range& y_range, LivePointVisitor* visitor) override;
+    // Levels from BLOCK_SHIFT up come from a DensityPyramid of the blocks, built by the first
+    // call and kept up to date by every step after it.
+    void VisitDensity(int level, const Range& x_range, const Range& y_range, DensityVisitor* visitor) override;
+    size_t TableSize() override;
+    // Blocks are the size of BitBlocks, so dense blocks are copied as they are.
+    void CopyBitBlocks(std::vector<BitBlock>* blocks) override;
+
+    // Live cells, counted over the blocks.
+    uint64_t Population();
+    // Removes every cell and resets the generation, keeping the memory of the blocks and tables
+    // for reuse, e.g. when running many small patterns one after another.
+    void Clear();
+
+    // Blocks stored as rows of bits rather than lists of cells.
+    size_t dense_blocks() const { return rows_.size(); }
+
+    // Times the row kernel of dense blocks.
+    double TimeBlockKernel(const uint64_t* rows, int iterations) override;
+
+    protected:
+    void DoStep() override;
+    void CountBlocks(uint64_t* blocks, uint64_t* created) override;
+    void CollectStats(StepStats* stats) override;
+
+    private:
+    static const int BLOCK_SHIFT = 6;
+    static const int BLOCK_DIM = 1 << BLOCK_SHIFT;
+    static const int SPARSE_CELLS = 27;
+    static const int DENSE_MIN_CELLS = 8;
+    // Windows with live cells near more rows than this run the row kernel, even for sparse
+    // blocks.
+    static const int SPARSE_ROWS = 8;
+    typedef std::array<uint64_t, BLOCK_DIM> BlockArray;
+
+    // Dense blocks point to their rows. Sparse blocks have a null rows and keep their cells in
+    // the first size entries of cells, as y * BLOCK_DIM + x. Fits in a cache line.
+    struct Block {
+        BlockArray* rows;
+        uint16_t size;
+        uint16_t cells[SPARSE_CELLS];
+    };
+
+    // The cells of a block and the ones around it: mid[i + 1] holds row i, from -1 to
+    // BLOCK_DIM, and bit 0 of west[i + 1] and east[i + 1] the cells just west and east of it.
+    // Only the rows with a bit set in occupied are initialized.
+    struct Window {
+        uint64_t west[BLOCK_DIM + 2];
+        uint64_t mid[BLOCK_DIM + 2];
+        uint64_t east[BLOCK_DIM + 2];
+        unsigned __int128 occupied;
+    };
+
+    static const BlockArray EMPTY_BLOCK;
+
+    const Block* FindBlock(int64_t x, int64_t y);
+    // ORs bits into row y of the block at block_index, which becomes dense once its cells don't
+    // fit a sparse block, and updates density_ unless told not to.
+    Block& AddBits(const Point& block_index, int y, uint64_t bits, bool update_density = true);
+    const BlockArray& NeighborRows(const Block* block, BlockArray* scratch);
+    void AddToWindow(const Block& block, int dx, int dy, Window* window);
+    static void OccupyRow(int r, Window* window);
+    uint64_t StepDenseBlock(const Block* const blocks[3][3], BlockArray* next);
+    uint64_t StepSparseBlock(const Block* const blocks[3][3], BlockArray* next);
+    static int BlockPopulation(const Block* block);
+    void DoStepForBlock(const Point& block_index);
+    void VisitBlock(const Point& block_index, const Block& block,
+                    const Range& x_range, const Range& y_range, LivePointVisitor* visitor);
+    Point wrapBlockIndex(int64_t x, int64_t y);
+
+    // Keyed by block index, i.e. cell coordinates divided by BLOCK_DIM.
+    std::unique_ptr<PointMap<Block>> blocks_;
+    std::unique_ptr<PointMap<Block>> new_blocks_;
+    // Empty blocks already computed this generation.
+    std::unique_ptr<PointMap<bool>> visited_;
+    // Rows of the dense blocks of both generations during a step.
+    BlockPool<BlockArray> rows_;
+    // Blocks which came to life where there was no block.
+    uint64_t blocks_created_;
+    // Live cells per block and the tiles above, once VisitDensity needed them.
+    std::unique_ptr<DensityPyramid> density_;
+};
+
+// A bounded torus stored as one contiguous grid with one bit per cell, for boards small enough
+// that storing every cell beats hashing blocks, e.g. dense soups on a 4096x4096 torus. Each
+// step runs the row kernels of BitBlockLife over the whole grid, 64 rows by 64 columns at a
+// time, in bands of rows split across threads. The torus covers the cells from
+// (-width / 2, -height / 2) to (width - 1 - width / 2, height - 1 - height / 2); cells added
+// outside of it wrap around.
+class DenseTorusLife : public Life {
+    public:
+    // Largest torus supported, which takes 2 x 128 MB.
+    static const int64_t MAX_CELLS = int64_t(1) << 30;
+    // Whether a DenseTorusLife can run on torus.
+    static bool Fits(const Torus& torus);
+
+    // torus must fit.
+    explicit DenseTorusLife(const Torus& torus);
+    ~DenseTorusLife();
+
+    Torus torus() const override { return torus_; }
+
+    void AddLivePoint(const Point& p) override;
+    std::vector<Point> LivePoints() override;
+    void VisitLivePoints(const Range& x_range, const Range& y_range, LivePointVisitor* visitor) override;
+    // There is no table.
+    size_t TableSize() override;
+    double TimeBlockKernel(const uint64_t* rows, int iterations) override;
+
+    // Splits each step across a pool of num_threads threads.
+    void set_num_threads(int num_threads);
+
+    protected:
+    void DoStep() override;
+    void CollectStats(StepStats* stats) override;
+
+    private:
+    // Rows computed per kernel call.
+    static const int BAND_ROWS = 64;
+
+    void DoStepForBand(int64_t band);
+
+    Torus torus_;
+    // Coordinates of the cell in the first bit of the grid.
+    int64_t x0_;
+    int64_t y0_;
+    // Row y takes words [y * words_per_row_, (y + 1) * words_per_row_), with cell x in bit
+    // x % 64 of word x / 64. Bits past the width stay 0.
+    int64_t words_per_row_;
+    // Bits used in the last word of a row, 1 to 64.
+    int last_bits_;
+    std::vector<uint64_t> cells_;
+    std::vector<uint64_t> next_;
+    std::unique_ptr<WorkStealingPool> pool_;
+};
+
+// Hashlife: the universe is a quadtree of canonical (hash-consed) nodes, and the future of each
+// node's center is memoized on the node itself. Repetitive patterns share almost all of their
+// nodes, which allows jumping 2^k generations at a time at a cost independent of k.
+class HashLife : public Life {
+    public:
+    HashLife();
+    ~HashLife();
+
+    void AddLivePoint(const Point& p) override;
+    std::vector<Point> LivePoints() override;
+    void VisitLivePoints(const Range& x_range, const Range& y_range, LivePointVisitor* visitor) override;
+    // Reads the populations of the nodes as large as the tiles.
+    void VisitDensity(int level, const Range& x_range, const Range& y_range, DensityVisitor* visitor) override;
+    size_t TableSize() override;
+    // Throws away the memoized results, which only hold for the rule they were computed with.
+    void set_rule(const Rule& rule) override;
+
+    // Advances the simulation by 2^k generations at once.
+    void StepPow2(int k);
+
+    // Limits the memory used by the node cache. When the cache grows past the limit,
+    // nodes no longer reachable from the current generation are collected between steps.
+    // Once the reachable nodes alone take more than 1/GC_GROWTH of the limit, the cache
+    // grows to GC_GROWTH times what the last collection kept before the next one, so that a
+    // pattern outgrowing the limit isn't collected after every step.
+    void set_max_memory(size_t bytes) {
+        max_memory_ = bytes;
+        next_gc_ = bytes;
+    }
+    size_t memory_usage() const;
+
+    protected:
+    void DoStep() override;
+    // Advances by powers of two, preferring the step of the memoized results.
+    void DoSteps(int64_t n) override;
+    // Nodes count as blocks.
+    void CountBlocks(uint64_t* blocks, uint64_t* created) override;
+    void CollectStats(StepStats* stats) override;
+
+    private:
+    struct Node;
+
+    static const int MAX_STEP_LOG2 = 62;
+    // A level 64 node covers the entire int64 plane.
+    static const int MAX_LEVEL = 64;
+    static const size_t GC_GROWTH = 2;
+
+    Node* Join(Node* nw, Node* ne, Node* sw, Node* se);
+    Node* EmptyNode(int level);
+    Node* Expand(Node* n);
+    Node* CenteredSubnode(Node* n);
+    Node* CenteredSubSubnode(Node* n);
+    Node* NextGeneration(Node* n);
+    Node* BaseCase(Node* n);
+    Node* SetCell(Node* n, uint64_t x, uint64_t y);
+    void Advance(int step_log2);
+    void CollectLivePoints(Node* n, uint64_t x, uint64_t y, std::vector<Point>* points);
+    void VisitNode(Node* n, uint64_t x, uint64_t y,
+                   const Range& x_range, const Range& y_range, LivePointVisitor* visitor);
+    void VisitNodeDensity(Node* n, uint64_t x, uint64_t y, int level,
+                          const Range& x_range, const Range& y_range, DensityVisitor* visitor);
+    void ClearResults();
+    void Resize();
+    void CollectGarbage();
+    void Mark(Node* n);
 
-    // Holds a 32x32 block of points.
-    std::unique_ptr<std::unordered_map<const Point, BlockArray>> blocks_;
-    std::unique_ptr<std::unordered_map<const Point, BlockArray>> new_blocks_;
+    Node* root_;
+    Node* dead_leaf_;
+    Node* live_leaf_;
+    std::vector<Node*> empty_nodes_;
+    // Chained hash table holding every non-leaf node.
+    std::vector<Node*> buckets_;
+    size_t node_count_;
+    uint64_t nodes_created_;
+    size_t max_memory_;
+    // Memory usage past which the next collection runs.
+    size_t next_gc_;
+    int step_log2_;
 };
 
 }  // namespace conway
@@ -0,0 +1,59 @@
+#ifndef CONWAY_MAPPED_FILE_H
+#define CONWAY_MAPPED_FILE_H
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cstddef>
+#include <string>
+
+namespace conway {
+
+// Maps a whole file into memory for reading.
+class MappedFile {
+    public:
+    explicit MappedFile(const std::string& filename) : data_(nullptr), size_(0), mapped_(false) {
+        int fd = open(filename.c_str(), O_RDONLY);
+        if (fd < 0) {
+            return;
+        }
+        struct stat st;
+        if (fstat(fd, &st) == 0) {
+            size_ = static_cast<size_t>(st.st_size);
+            if (size_ == 0) {
+                data_ = "";
+            } else {
+                void* data = mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+                if (data != MAP_FAILED) {
+                    data_ = static_cast<const char*>(data);
+                    mapped_ = true;
+                }
+            }
+        }
+        close(fd);
+    }
+    ~MappedFile() {
+        if (mapped_) {
+            munmap(const_cast<char*>(data_), size_);
+        }
+    }
+
+    bool ok() const { return data_ != nullptr; }
+    const char* begin() const { return data_; }
+    const char* end() const { return data_ + size_; }
+    size_t size() const { return size_; }
+
+    private:
+    MappedFile(const MappedFile&);
+    MappedFile& operator=(const MappedFile&);
+
+    const char* data_;
+    size_t size_;
+    bool mapped_;
+};
+
+}  // namespace conway
+
+#endif
@@ -0,0 +1,55 @@
+#ifndef CONWAY_POINT_H
+#define CONWAY_POINT_H
+
+#include <cstdint>
+#include <functional>
+#include <utility>
+
+namespace conway {
+
+// Inclusive range of coordinates [first, second].
+typedef std::pair<int64_t, int64_t> Range;
+
+struct Point {
+    int64_t x;
+    int64_t y;
+
+    Point() : x(0), y(0) {}
+    Point(int64_t x, int64_t y) : x(x), y(y) {}
+    Point(const Point &o) : x(o.x), y(o.y) {}
+    Point& operator=(const Point& o) {
+        x = o.x;
+        y = o.y;
+        return *this;
+    }
+
+    bool operator==(const Point& o) const {
+        return x == o.x && y == o.y;
+    }
+};
+
+// Mixes both coordinates into all 64 bits of the hash. Block indices are multiples of the block
+// size, so the low bits of the coordinates alone are a poor hash.
+inline uint64_t HashPoint(const Point& p) {
+    uint64_t hash = static_cast<uint64_t>(p.x) ^ (static_cast<uint64_t>(p.y) * 0x9E3779B97F4A7C15ULL);
+    // Finalizer from MurmurHash3.
+    hash ^= hash >> 33;
+    hash *= 0xFF51AFD7ED558CCDULL;
+    hash ^= hash >> 33;
+    hash *= 0xC4CEB9FE1A85EC53ULL;
+    hash ^= hash >> 33;
+    return hash;
+}
+
+}  // namespace conway
+
+namespace std {
+template <>
+struct hash<const conway::Point> {
+    size_t operator() (const conway::Point& p) const {
+        return conway::HashPoint(p);
+    }
+};
+}  // namespace std
+
+#endif
@@ -0,0 +1,298 @@
+#ifndef CONWAY_POINT_MAP_H
+#define CONWAY_POINT_MAP_H
+
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <utility>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "point.h"
+
+namespace conway {
+
+// Flat open addressing hash table from Point to V, replacing std::unordered_map for the
+// engines' cells and blocks. Entries live in one array probed linearly from their home slot.
+// A separate array holds one control byte per slot: either EMPTY or 7 bits of the entry's hash,
+// so a probe compares 16 control bytes at once (with SSE2 when available) and only looks at
+// keys whose hash bits match. Erasing shifts the following entries of the probe sequence back
+// instead of leaving tombstones, so lookups never slow down as entries come and go.
+//
+// Unlike std::unordered_map, inserting may move every entry when the table grows, and erasing
+// may move entries after the erased one. Pointers into the table are only stable while neither
+// happens; reserve() guarantees room for inserts without growing.
+template <typename V>
+class PointMap {
+    public:
+    typedef std::pair<Point, V> value_type;
+
+    template <typename Map, typename Value>
+    class Iterator {
+        public:
+        Iterator(Map* map, size_t index) : map_(map), index_(index) { SkipEmpty(); }
+        Value& operator*() const { return map_->slots_[index_]; }
+        Value* operator->() const { return &map_->slots_[index_]; }
+        Iterator& operator++() {
+            index_++;
+            SkipEmpty();
+            return *this;
+        }
+        bool operator==(const Iterator& o) const { return index_ == o.index_; }
+        bool operator!=(const Iterator& o) const { return index_ != o.index_; }
+
+        private:
+        void SkipEmpty() {
+            while (index_ < map_->capacity() && map_->ctrl_[index_] == EMPTY) {
+                index_++;
+            }
+        }
+
+        Map* map_;
+        size_t index_;
+    };
+    typedef Iterator<PointMap, value_type> iterator;
+    typedef Iterator<const PointMap, const value_type> const_iterator;
+
+    PointMap() : size_(0), max_load_factor_(0.75f), allocations_(0) { Allocate(MIN_CAPACITY); }
+    PointMap(const PointMap& o) : size_(0), max_load_factor_(o.max_load_factor_), allocations_(0) {
+        Allocate(o.capacity());
+        for (size_t i = 0; i < o.capacity(); i++) {
+            if (o.ctrl_[i] != EMPTY) {
+                emplace(o.slots_[i].first, o.slots_[i].second);
+            }
+        }
+    }
+    PointMap& operator=(const PointMap& o) {
+        PointMap copy(o);
+        swap(copy);
+        return *this;
+    }
+
+    iterator begin() { return iterator(this, 0); }
+    iterator end() { return iterator(this, capacity()); }
+    const_iterator begin() const { return const_iterator(this, 0); }
+    const_iterator end() const { return const_iterator(this, capacity()); }
+
+    size_t size() const { return size_; }
+    bool empty() const { return size_ == 0; }
+    size_t capacity() const { return mask_ + 1; }
+    // Number of times the slots were allocated, including the initial ones.
+    size_t allocations() const { return allocations_; }
+
+    // Keeps the allocated slots for reuse.
+    void clear() {
+        memset(ctrl_.get(), EMPTY, capacity() + GROUP - 1);
+        size_ = 0;
+    }
+
+    void swap(PointMap& o) {
+        slots_.swap(o.slots_);
+        ctrl_.swap(o.ctrl_);
+        std::swap(mask_, o.mask_);
+        std::swap(size_, o.size_);
+        std::swap(growth_limit_, o.growth_limit_);
+        std::swap(max_load_factor_, o.max_load_factor_);
+        std::swap(allocations_, o.allocations_);
+    }
+
+    void max_load_factor(float f) {
+        max_load_factor_ = f < 0.25f ? 0.25f : (f > 0.9f ? 0.9f : f);
+        growth_limit_ = static_cast<size_t>(capacity() * max_load_factor_);
+        reserve(size_);
+    }
+
+    // Makes room for n entries so that inserting up to n entries doesn't move any.
+    void reserve(size_t n) {
+        if (n > growth_limit_) {
+            size_t capacity = this->capacity();
+            while (n > static_cast<size_t>(capacity * max_load_factor_)) {
+                capacity *= 2;
+            }
+            Rehash(capacity);
+        }
+    }
+
+    value_type* find(const Point& key) {
+        size_t index;
+        return Probe(key, HashPoint(key), &index) ? &slots_[index] : nullptr;
+    }
+
+    size_t count(const Point& key) {
+        return find(key) != nullptr ? 1 : 0;
+    }
+
+    // Like std::unordered_map::emplace, returns the entry for key and whether it was inserted.
+    std::pair<value_type*, bool> emplace(const Point& key, const V& value) {
+        if (size_ + 1 > growth_limit_) {
+            reserve(size_ + 1);
+        }
+        uint64_t hash = HashPoint(key);
+        size_t index;
+        if (Probe(key, hash, &index)) {
+            return std::make_pair(&slots_[index], false);
+        }
+        slots_[index].first = key;
+        slots_[index].second = value;
+        SetCtrl(index, Tag(hash));
+        size_++;
+        return std::make_pair(&slots_[index], true);
+    }
+
+    bool erase(const Point& key) {
+        size_t index;
+        if (!Probe(key, HashPoint(key), &index)) {
+            return false;
+        }
+        EraseAt(index);
+        return true;
+    }
+
+    // Calls keep(entry) for every entry, erasing the ones it returns false for.
+    template <typename F>
+    void Retain(F keep) {
+        if (size_ == 0) {
+            return;
+        }
+        // Start right after an empty slot. Erasing only moves entries backwards into the erased
+        // slot from later in the same run of occupied slots, which never crosses an empty slot,
+        // so every entry is still visited exactly once.
+        size_t start = 0;
+        while (ctrl_[start] != EMPTY) {
+            start++;
+        }
+        for (size_t i = 1; i <= mask_;) {
+            size_t index = (start + i) & mask_;
+            if (ctrl_[index] != EMPTY && !keep(slots_[index])) {
+                EraseAt(index);
+                continue;
+            }
+            i++;
+        }
+    }
+
+    // Adds how many slots past its home slot each entry sits to *total, and raises *longest to
+    // the farthest, which tells how well the keys hash.
+    void AddProbeLengths(size_t* total, size_t* longest) const {
+        for (size_t i = 0; i < capacity(); i++) {
+            if (ctrl_[i] != EMPTY) {
+                size_t length = (i - HashPoint(slots_[i].first)) & mask_;
+                *total += length;
+                *longest = length > *longest ? length : *longest;
+            }
+        }
+    }
+
+    private:
+    static const uint8_t EMPTY = 0x80;
+    static const size_t GROUP = 16;
+    static const size_t MIN_CAPACITY = 16;
+
+    static uint8_t Tag(uint64_t hash) { return static_cast<uint8_t>(hash >> 57); }
+
+    // Returns a bitmask of the control bytes in ctrl[0, GROUP) equal to byte.
+    static uint32_t MatchGroup(const uint8_t* ctrl, uint8_t byte) {
+#if defined(__SSE2__)
+        __m128i group = _mm_loadu_si128(reinterpret_cast<const __m128i*>(ctrl));
+        return _mm_movemask_epi8(_mm_cmpeq_epi8(group, _mm_set1_epi8(static_cast<char>(byte))));
+#else
+        uint32_t mask = 0;
+        for (size_t i = 0; i < GROUP; i++) {
+            mask |= static_cast<uint32_t>(ctrl[i] == byte) << i;
+        }
+        return mask;
+#endif
+    }
+
+    // Finds key, or else the empty slot it would be inserted in.
+    bool Probe(const Point& key, uint64_t hash, size_t* index) const {
+        uint8_t tag = Tag(hash);
+        size_t i = hash & mask_;
+        while (true) {
+            uint32_t matches = MatchGroup(&ctrl_[i], tag);
+            uint32_t empties = MatchGroup(&ctrl_[i], EMPTY);
+            if (empties != 0) {
+                // Keys can't be past the first empty slot.
+                matches &= (empties & (0 - empties)) - 1;
+            }
+            while (matches != 0) {
+                size_t j = (i + __builtin_ctz(matches)) & mask_;
+                if (slots_[j].first == key) {
+                    *index = j;
+                    return true;
+                }
+                matches &= matches - 1;
+            }
+            if (empties != 0) {
+                *index = (i + __builtin_ctz(empties)) & mask_;
+                return false;
+            }
+            i = (i + GROUP) & mask_;
+        }
+    }
+
+    // The first GROUP - 1 control bytes are mirrored past the end so a group never wraps.
+    void SetCtrl(size_t index, uint8_t ctrl) {
+        ctrl_[index] = ctrl;
+        if (index < GROUP - 1) {
+            ctrl_[capacity() + index] = ctrl;
+        }
+    }
+
+    // Removes the entry at index, moving back later entries of the probe run which may now sit
+    // closer to their home slot.
+    void EraseAt(size_t hole) {
+        size_t j = (hole + 1) & mask_;
+        while (ctrl_[j] != EMPTY) {
+            size_t home = HashPoint(slots_[j].first) & mask_;
+            if (((j - home) & mask_) >= ((j - hole) & mask_)) {
+                slots_[hole] = slots_[j];
+                SetCtrl(hole, ctrl_[j]);
+                hole = j;
+            }
+            j = (j + 1) & mask_;
+        }
+        SetCtrl(hole, EMPTY);
+        size_--;
+    }
+
+    void Allocate(size_t capacity) {
+        slots_.reset(new value_type[capacity]);
+        ctrl_.reset(new uint8_t[capacity + GROUP - 1]);
+        mask_ = capacity - 1;
+        growth_limit_ = static_cast<size_t>(capacity * max_load_factor_);
+        allocations_++;
+        clear();
+    }
+
+    void Rehash(size_t capacity) {
+        std::unique_ptr<value_type[]> slots(std::move(slots_));
+        std::unique_ptr<uint8_t[]> ctrl(std::move(ctrl_));
+        size_t old_capacity = mask_ + 1;
+        Allocate(capacity);
+        for (size_t i = 0; i < old_capacity; i++) {
+            if (ctrl[i] != EMPTY) {
+                uint64_t hash = HashPoint(slots[i].first);
+                size_t index;
+                Probe(slots[i].first, hash, &index);
+                slots_[index] = slots[i];
+                SetCtrl(index, Tag(hash));
+                size_++;
+            }
+        }
+    }
+
+    std::unique_ptr<value_type[]> slots_;
+    std::unique_ptr<uint8_t[]> ctrl_;
+    size_t mask_;
+    size_t size_;
+    size_t growth_limit_;
+    float max_load_factor_;
+    size_t allocations_;
+};
+
+}  // namespace conway
+
+#endif
@@ -0,0 +1,129 @@
+// Headless rendering of a pattern's evolution into frames for a time-lapse, with no GPU or
+// display.
+//
+// Usage: render [--scale N] [--center X,Y] [--size N] [--every N] [--frames N]
+//               [--format png|ppm|raw] [--out DIRECTORY] [--threads N] [--rule RULE] FILE
+//
+// Draws FILE, an RLE pattern or a .ckpt checkpoint, every --every generations for --frames
+// frames, as the window of the driver would show it: --size x --size pixels around --center at
+// scale 2^--scale, the scaleFactor of the driver's -/+ keys. Frames are encoded on --threads
+// threads while the simulation goes on. With --out, each frame is written to
+// DIRECTORY/frame-000000.png and so on, otherwise the frames are written one after the other to
+// stdout, e.g. for
+//
+//   render --format raw pattern.rle | ffmpeg -f rawvideo -pixel_format rgb24 -video_size 800x800 -i - out.mp4
+//
+// Engines are picked by LoadPattern, as in the driver: HybridLife, or DenseTorusLife for a rule
+// with a torus.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <string>
+
+#include "checkpoint.h"
+#include "frame.h"
+
+namespace {
+
+struct Options {
+    Options() : scale(8), size(800), every(1), frames(100), format(conway::FrameFormat::PNG), threads(2) {}
+
+    int scale;
+    conway::Point center;
+    int size;
+    int64_t every;
+    int64_t frames;
+    conway::FrameFormat format;
+    std::string out;
+    int threads;
+    std::string rule;
+    std::string filename;
+};
+
+void PrintUsage() {
+    std::cerr << "Usage: render [--scale N] [--center X,Y] [--size N] [--every N] [--frames N]\n"
+              << "              [--format png|ppm|raw] [--out DIRECTORY] [--threads N] [--rule RULE] FILE" << std::endl;
+}
+
+bool ParseOptions(int argc, char** argv, Options* options) {
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        bool has_value = i + 1 < argc;
+        if (arg == "--scale" && has_value) {
+            // The range of the driver's zoom.
+            options->scale = std::min(64, std::max(8, std::atoi(argv[++i])));
+        } else if (arg == "--center" && has_value) {
+            long long x;
+            long long y;
+            if (std::sscanf(argv[++i], "%lld,%lld", &x, &y) != 2) {
+                return false;
+            }
+            options->center = conway::Point(x, y);
+        } else if (arg == "--size" && has_value) {
+            options->size = std::max(1, std::atoi(argv[++i]));
+        } else if (arg == "--every" && has_value) {
+            options->every = std::max<int64_t>(1, std::atoll(argv[++i]));
+        } else if (arg == "--frames" && has_value) {
+            options->frames = std::max<int64_t>(1, std::atoll(argv[++i]));
+        } else if (arg == "--format" && has_value) {
+            if (!conway::ParseFrameFormat(argv[++i], &options->format)) {
+                return false;
+            }
+        } else if (arg == "--out" && has_value) {
+            options->out = argv[++i];
+        } else if (arg == "--threads" && has_value) {
+            options->threads = std::max(1, std::atoi(argv[++i]));
+        } else if (arg == "--rule" && has_value) {
+            options->rule = argv[++i];
+        } else if (!arg.empty() && arg[0] != '-' && options->filename.empty()) {
+            options->filename = arg;
+        } else {
+            return false;
+        }
+    }
+    return !options->filename.empty();
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+    Options options;
+    if (!ParseOptions(argc, argv, &options)) {
+        PrintUsage();
+        return 2;
+    }
+
+    std::unique_ptr<conway::Life> life;
+    std::string error;
+    if (!conway::LoadPattern(options.filename, options.rule, 0, &life, &error)) {
+        std::cerr << error << std::endl;
+        return 1;
+    }
+
+    // Two frames per encoder in flight, so that an encoder never waits for the simulation
+    // while the simulation is ahead.
+    conway::FrameWriter writer(options.format, options.out, options.threads, 2 * options.threads);
+    auto start = std::chrono::steady_clock::now();
+    for (int64_t i = 0; i < options.frames; i++) {
+        if (i > 0) {
+            life->Step(options.every);
+        }
+        conway::Frame frame(options.size, options.size);
+        conway::RenderFrame(life.get(), options.center, options.scale, &frame);
+        writer.Write(std::move(frame));
+    }
+    bool ok = writer.Finish();
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    std::cerr << options.frames << " frames to generation " << life->generation() << " in " << seconds << " s ("
+              << (seconds > 0 ? options.frames / seconds : 0) << " frames/sec)" << std::endl;
+    if (!ok) {
+        std::cerr << "Could not write every frame" << std::endl;
+        return 1;
+    }
+    return 0;
+}
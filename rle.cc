@@ -0,0 +1,338 @@
+#include "rle.h"
+
+#include "mapped_file.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <limits>
+#include <vector>
+
+namespace conway {
+
+namespace {
+
+// Longest run, and widest row, read from a pattern file. Anything longer is taken for a corrupt
+// file rather than a row buffer of that many cells.
+const uint64_t MAX_ROW_CELLS = uint64_t(1) << 28;
+
+bool IsSpace(char c) {
+    return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+}
+
+bool IsDigit(char c) {
+    return c >= '0' && c <= '9';
+}
+
+const char* SkipLine(const char* p, const char* end) {
+    while (p < end && *p != '\n') {
+        p++;
+    }
+    return p;
+}
+
+// Parses an optionally signed decimal number, leaving p after it. Returns false if it doesn't
+// fit an int64_t, or its negation doesn't.
+bool ParseInt(const char** p, const char* end, int64_t* value) {
+    bool negative = *p < end && **p == '-';
+    if (negative) {
+        (*p)++;
+    }
+    const uint64_t max = std::numeric_limits<int64_t>::max();
+    uint64_t n = 0;
+    while (*p < end && IsDigit(**p)) {
+        if (n > (max - (**p - '0')) / 10) {
+            return false;
+        }
+        n = n * 10 + (**p - '0');
+        (*p)++;
+    }
+    *value = negative ? -static_cast<int64_t>(n) : static_cast<int64_t>(n);
+    return true;
+}
+
+// Parses "x = 3, y = 3, rule = B3/S23" up to the end of the line. Returns nullptr if a size is
+// out of range.
+const char* ParseHeader(const char* p, const char* end, RLEHeader* header) {
+    while (p < end && *p != '\n') {
+        while (p < end && (*p == ' ' || *p == '\t' || *p == ',')) {
+            p++;
+        }
+        const char* key = p;
+        while (p < end && *p != '=' && *p != ',' && *p != '\n' && !IsSpace(*p)) {
+            p++;
+        }
+        std::string name(key, p);
+        while (p < end && (*p == ' ' || *p == '\t')) {
+            p++;
+        }
+        if (p == end || *p != '=') {
+            p = std::find(p, end, ',');
+            continue;
+        }
+        p++;
+        while (p < end && (*p == ' ' || *p == '\t')) {
+            p++;
+        }
+        // The rule runs to the end of the line, since a torus suffix has a comma, e.g.
+        // "rule = B3/S23:T64,64".
+        const char* value = p;
+        while (p < end && (*p != ',' || name == "rule") && *p != '\n') {
+            p++;
+        }
+        const char* value_end = p;
+        while (value_end > value && IsSpace(value_end[-1])) {
+            value_end--;
+        }
+        if ((name == "x" && !ParseInt(&value, value_end, &header->width)) ||
+            (name == "y" && !ParseInt(&value, value_end, &header->height))) {
+            return nullptr;
+        } else if (name == "rule") {
+            header->rule.assign(value, value_end);
+        }
+    }
+    return p;
+}
+
+// Collects the live cells of one row of the pattern as bits, and hands them to life in one
+// AddLiveRow call per row.
+class RowBuffer {
+    public:
+    explicit RowBuffer(Life* life) : life_(life), first_word_(SIZE_MAX), last_word_(0) {}
+
+    // The cells end by MAX_ROW_CELLS.
+    void SetCells(uint64_t column, uint64_t n) {
+        uint64_t end = column + n;
+        if (bits_.size() < (end + 63) / 64) {
+            bits_.resize(std::min((end + 63) / 64 * 2, MAX_ROW_CELLS / 64), 0);
+        }
+        first_word_ = std::min<size_t>(first_word_, column / 64);
+        last_word_ = std::max<size_t>(last_word_, (end - 1) / 64);
+        while (column < end) {
+            uint64_t count = std::min<uint64_t>(64 - column % 64, end - column);
+            uint64_t mask = count == 64 ? ~uint64_t(0) : ((uint64_t(1) << count) - 1);
+            bits_[column / 64] |= mask << (column % 64);
+            column += count;
+        }
+    }
+
+    void Flush(int64_t x, int64_t y) {
+        if (first_word_ > last_word_) {
+            return;
+        }
+        life_->AddLiveRow(static_cast<int64_t>(static_cast<uint64_t>(x) + first_word_ * 64), y,
+                          &bits_[first_word_], (last_word_ - first_word_ + 1) * 64);
+        std::fill(bits_.begin() + first_word_, bits_.begin() + last_word_ + 1, 0);
+        first_word_ = SIZE_MAX;
+        last_word_ = 0;
+    }
+
+    private:
+    Life* life_;
+    std::vector<uint64_t> bits_;
+    // Words of bits_ holding cells of the current row.
+    size_t first_word_;
+    size_t last_word_;
+};
+
+// Appends n copies of tag, e.g. "12o", wrapping lines at 70 characters as is customary.
+void AppendRun(uint64_t n, char tag, std::string* out, size_t* line_length) {
+    char run[24];
+    int length = n == 1 ? snprintf(run, sizeof(run), "%c", tag)
+                        : snprintf(run, sizeof(run), "%llu%c", static_cast<unsigned long long>(n), tag);
+    if (*line_length + length > 70) {
+        out->push_back('\n');
+        *line_length = 0;
+    }
+    out->append(run, length);
+    *line_length += length;
+}
+
+// Parses the comment lines and the header line, returning where the cell data starts, or
+// nullptr if a number in them is out of range. Sets has_position and the origin when the
+// comments give the pattern's position.
+const char* ParsePreamble(const char* p, const char* end, RLEHeader* parsed, bool* has_position,
+                          int64_t* x_origin, int64_t* y_origin) {
+    while (p < end) {
+        if (IsSpace(*p)) {
+            p++;
+        } else if (*p == '#') {
+            const char* line = p;
+            p = SkipLine(p, end);
+            std::string comment(line, p);
+            size_t pos = comment.find("Pos=");
+            if (comment.compare(0, 6, "#CXRLE") == 0 && pos != std::string::npos) {
+                const char* q = line + pos + 4;
+                int64_t y;
+                if (!ParseInt(&q, p, x_origin)) {
+                    return nullptr;
+                }
+                if (q < p && *q == ',') {
+                    q++;
+                }
+                if (!ParseInt(&q, p, &y)) {
+                    return nullptr;
+                }
+                // Positions count rows downwards, while y grows upwards here.
+                *y_origin = -y;
+                *has_position = true;
+            } else if (comment.compare(0, 3, "#r ") == 0) {
+                // Old style rule line.
+                parsed->rule = comment.substr(3);
+            }
+        } else if (*p == 'x') {
+            p = ParseHeader(p, end, parsed);
+            if (p == nullptr) {
+                return nullptr;
+            }
+        } else {
+            break;
+        }
+    }
+    return p;
+}
+
+}  // namespace
+
+bool ReadRLEHeader(const std::string& filename, RLEHeader* header) {
+    MappedFile file(filename);
+    if (!file.ok()) {
+        return false;
+    }
+    *header = RLEHeader();
+    bool has_position = false;
+    int64_t x_origin = 0;
+    int64_t y_origin = 0;
+    return ParsePreamble(file.begin(), file.end(), header, &has_position, &x_origin, &y_origin) != nullptr;
+}
+
+// Single pass over the mapped file: comment lines, the header line and then the cell data.
+bool LoadRLE(const std::string& filename, Life* life, RLEHeader* header) {
+    MappedFile file(filename);
+    if (!file.ok()) {
+        return false;
+    }
+    RLEHeader parsed;
+    bool has_position = false;
+    int64_t x_origin = 0;
+    int64_t y_origin = 0;
+    const char* end = file.end();
+    const char* p = ParsePreamble(file.begin(), end, &parsed, &has_position, &x_origin, &y_origin);
+    if (p == nullptr) {
+        return false;
+    }
+    if (!parsed.rule.empty()) {
+        Rule rule;
+        Torus torus;
+        if (!ParseRule(parsed.rule, &rule, &torus) || (torus.bounded() && torus != life->torus())) {
+            return false;
+        }
+        life->set_rule(rule);
+    }
+    if (!has_position) {
+        x_origin = -parsed.width / 2;
+        y_origin = parsed.height / 2;
+    }
+
+    RowBuffer row(life);
+    int64_t y = y_origin;
+    uint64_t column = 0;
+    uint64_t n = 0;
+    for (; p < end; p++) {
+        char c = *p;
+        if (IsDigit(c)) {
+            n = n * 10 + (c - '0');
+            if (n > MAX_ROW_CELLS) {
+                return false;
+            }
+            continue;
+        } else if (IsSpace(c)) {
+            continue;
+        }
+        uint64_t run = n == 0 ? 1 : n;
+        if (c == 'b' || c == '.') {
+            column += run;
+        } else if (c == '$') {
+            row.Flush(x_origin, y);
+            // The plane wraps around, so very tall patterns do too.
+            y = static_cast<int64_t>(static_cast<uint64_t>(y) - run);
+            column = 0;
+        } else if (c == '!') {
+            break;
+        } else if ((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z')) {
+            // Any other state of a multi-state pattern counts as alive.
+            if (column + run > MAX_ROW_CELLS) {
+                return false;
+            }
+            row.SetCells(column, run);
+            column += run;
+        } else if (c == '#') {
+            p = SkipLine(p, end) - 1;
+        }
+        n = 0;
+    }
+    row.Flush(x_origin, y);
+    if (header != nullptr) {
+        *header = parsed;
+    }
+    return true;
+}
+
+bool SaveRLE(const std::string& filename, Life* life) {
+    std::vector<Point> points = life->LivePoints();
+    // Rows from top to bottom, cells from left to right.
+    std::sort(points.begin(), points.end(), [](const Point& a, const Point& b) {
+        return a.y != b.y ? a.y > b.y : a.x < b.x;
+    });
+    int64_t min_x = 0;
+    int64_t max_x = 0;
+    for (size_t i = 0; i < points.size(); i++) {
+        min_x = i == 0 ? points[i].x : std::min(min_x, points[i].x);
+        max_x = i == 0 ? points[i].x : std::max(max_x, points[i].x);
+    }
+    int64_t max_y = points.empty() ? 0 : points.front().y;
+    int64_t min_y = points.empty() ? 0 : points.back().y;
+    uint64_t width = points.empty() ? 0 : static_cast<uint64_t>(max_x) - static_cast<uint64_t>(min_x) + 1;
+    uint64_t height = points.empty() ? 0 : static_cast<uint64_t>(max_y) - static_cast<uint64_t>(min_y) + 1;
+
+    std::string out;
+    // Runs take a few bytes per cell at most.
+    out.reserve(128 + points.size() * 4);
+    char line[160];
+    snprintf(line, sizeof(line), "#CXRLE Pos=%lld,%lld\nx = %llu, y = %llu, rule = %s\n",
+             static_cast<long long>(min_x), static_cast<long long>(0 - static_cast<uint64_t>(max_y)),
+             static_cast<unsigned long long>(width), static_cast<unsigned long long>(height),
+             RuleString(life->rule(), life->torus()).c_str());
+    out.append(line);
+    size_t line_length = 0;
+    int64_t y = max_y;
+    size_t i = 0;
+    while (i < points.size()) {
+        if (points[i].y != y) {
+            AppendRun(static_cast<uint64_t>(y) - static_cast<uint64_t>(points[i].y), '$', &out, &line_length);
+            y = points[i].y;
+        }
+        // The live cells of this row starting at points[i], and the dead cells before them.
+        size_t j = i + 1;
+        while (j < points.size() && points[j].y == y && static_cast<uint64_t>(points[j].x) == static_cast<uint64_t>(points[j - 1].x) + 1) {
+            j++;
+        }
+        uint64_t dead = static_cast<uint64_t>(points[i].x) - static_cast<uint64_t>(min_x);
+        if (i > 0 && points[i - 1].y == y) {
+            dead = static_cast<uint64_t>(points[i].x) - static_cast<uint64_t>(points[i - 1].x) - 1;
+        }
+        if (dead > 0) {
+            AppendRun(dead, 'b', &out, &line_length);
+        }
+        AppendRun(j - i, 'o', &out, &line_length);
+        i = j;
+    }
+    out.append("!\n");
+
+    std::ofstream file(filename, std::ios::binary);
+    file.write(out.data(), out.size());
+    return static_cast<bool>(file);
+}
+
+}  // namespace conway
@@ -0,0 +1,42 @@
+#ifndef CONWAY_RLE_H
+#define CONWAY_RLE_H
+
+#include <cstdint>
+#include <string>
+
+#include "life.h"
+
+namespace conway {
+
+// Header line of a Run Length Encoded pattern: "x = 3, y = 3, rule = B3/S23".
+struct RLEHeader {
+    RLEHeader() : width(0), height(0) {}
+
+    int64_t width;
+    int64_t height;
+    // As written in the file, e.g. "B3/S23", "23/3" or "B3/S23:T64,64", or empty if the file has
+    // no rule.
+    std::string rule;
+};
+
+// Adds the live cells of a Run Length Encoded pattern file to life, centered on the origin
+// unless the file gives its position in a "#CXRLE Pos=x,y" line, and sets the rule of life to
+// the file's rule if it has one. Fills in header when given. Returns false if the file can't be
+// read, its rule isn't supported, or its rule has a torus other than the torus of life. Also
+// returns false for a corrupt file, with a number out of range or a run or row of more than
+// 2^28 cells, possibly after adding some of its cells. Cells of a pattern without a torus wrap
+// around the torus of life.
+bool LoadRLE(const std::string& filename, Life* life, RLEHeader* header = nullptr);
+
+// Reads only the header of a pattern file, e.g. to pick an engine for its rule before loading
+// it. Returns false if the file can't be read or a number in the header is out of range.
+bool ReadRLEHeader(const std::string& filename, RLEHeader* header);
+
+// Writes the live cells of life and its rule, with its torus, as a Run Length Encoded pattern,
+// including a "#CXRLE" line with its position so that loading the file restores the cells at
+// the same coordinates. Returns false if the file can't be written.
+bool SaveRLE(const std::string& filename, Life* life);
+
+}  // namespace conway
+
+#endif
@@ -0,0 +1,105 @@
+#include "rule.h"
+
+#include <cstdlib>
+
+namespace conway {
+
+namespace {
+
+// Parses the neighbor counts of one half of a rule, e.g. "23", up to the end or the slash.
+bool ParseCounts(const std::string& text, size_t* pos, uint16_t* counts) {
+    *counts = 0;
+    for (; *pos < text.size() && text[*pos] != '/'; (*pos)++) {
+        char c = text[*pos];
+        if (c < '0' || c > '8') {
+            return false;
+        }
+        *counts |= 1 << (c - '0');
+    }
+    return true;
+}
+
+}  // namespace
+
+bool ParseRule(const std::string& text, Rule* rule) {
+    size_t slash = text.find('/');
+    if (slash == std::string::npos) {
+        return false;
+    }
+    uint16_t birth;
+    uint16_t survival;
+    size_t pos = 0;
+    if (text[0] == 'B' || text[0] == 'b') {
+        pos = 1;
+        if (!ParseCounts(text, &pos, &birth) || pos + 1 >= text.size() ||
+            (text[pos + 1] != 'S' && text[pos + 1] != 's')) {
+            return false;
+        }
+        pos += 2;
+        if (!ParseCounts(text, &pos, &survival)) {
+            return false;
+        }
+    } else {
+        if (!ParseCounts(text, &pos, &survival)) {
+            return false;
+        }
+        pos++;
+        if (!ParseCounts(text, &pos, &birth)) {
+            return false;
+        }
+    }
+    if (pos != text.size() || (birth & 1) != 0) {
+        return false;
+    }
+    *rule = Rule(birth, survival);
+    return true;
+}
+
+bool ParseRule(const std::string& text, Rule* rule, Torus* torus) {
+    size_t colon = text.find(':');
+    if (colon == std::string::npos) {
+        *torus = Torus();
+        return ParseRule(text, rule);
+    }
+    // Golly's suffix is ":Tw,h", with both sizes positive for a torus.
+    const char* suffix = text.c_str() + colon + 1;
+    if (*suffix != 'T' && *suffix != 't') {
+        return false;
+    }
+    char* end;
+    long long width = strtoll(suffix + 1, &end, 10);
+    if (*end != ',' || end == suffix + 1) {
+        return false;
+    }
+    const char* height_text = end + 1;
+    long long height = strtoll(height_text, &end, 10);
+    if (*end != '\0' || end == height_text || width <= 0 || height <= 0) {
+        return false;
+    }
+    if (!ParseRule(text.substr(0, colon), rule)) {
+        return false;
+    }
+    *torus = Torus(width, height);
+    return true;
+}
+
+std::string RuleString(const Rule& rule, const Torus& torus) {
+    std::string text = "B";
+    for (int n = 0; n <= 8; n++) {
+        if ((rule.birth >> n) & 1) {
+            text.push_back('0' + n);
+        }
+    }
+    text += "/S";
+    for (int n = 0; n <= 8; n++) {
+        if ((rule.survival >> n) & 1) {
+            text.push_back('0' + n);
+        }
+    }
+    if (torus.bounded()) {
+        text += ":T" + std::to_string(torus.width) + "," + std::to_string(torus.height);
+    }
+    return text;
+}
+
+}  // namespace conway
@@ -0,0 +1,51 @@
+#ifndef CONWAY_RULE_H
+#define CONWAY_RULE_H
+
+#include <cstdint>
+#include <string>
+
+namespace conway {
+
+// A Life-like rule: a dead cell with n live neighbors is born if bit n of birth is set, and a
+// live cell with n live neighbors survives if bit n of survival is set. Defaults to Conway's
+// Life, B3/S23.
+struct Rule {
+    Rule() : birth(1 << 3), survival((1 << 2) | (1 << 3)) {}
+    Rule(uint16_t birth, uint16_t survival) : birth(birth), survival(survival) {}
+
+    bool operator==(const Rule& o) const { return birth == o.birth && survival == o.survival; }
+    bool operator!=(const Rule& o) const { return !(*this == o); }
+
+    uint16_t birth;
+    uint16_t survival;
+};
+
+// A width x height torus, the bounded grid of Golly's ":Tw,h" rule suffix, or the whole int64
+// plane (which also wraps at its edges) when both are 0.
+struct Torus {
+    Torus() : width(0), height(0) {}
+    Torus(int64_t width, int64_t height) : width(width), height(height) {}
+
+    bool bounded() const { return width != 0; }
+    bool operator==(const Torus& o) const { return width == o.width && height == o.height; }
+    bool operator!=(const Torus& o) const { return !(*this == o); }
+
+    int64_t width;
+    int64_t height;
+};
+
+// Parses a rulestring in B/S notation, e.g. "B36/S23", or in the older S/B notation, e.g.
+// "23/36". Rules with B0 aren't supported, since every empty cell of the infinite plane would
+// be born. Returns false if text isn't a supported rule.
+bool ParseRule(const std::string& text, Rule* rule);
+// Like ParseRule, but also accepts a torus suffix, e.g. "B3/S23:T64,64", and sets torus to it,
+// or to the plane without a suffix. Other bounded grids, and tori unbounded in one direction,
+// aren't supported.
+bool ParseRule(const std::string& text, Rule* rule, Torus* torus);
+
+// Returns the rule in B/S notation, with a ":Tw,h" suffix for a bounded torus.
+std::string RuleString(const Rule& rule, const Torus& torus = Torus());
+
+}  // namespace conway
+
+#endif
@@ -0,0 +1,145 @@
+#include "simulation.h"
+
+#include <chrono>
+
+namespace conway {
+
+Simulation::Simulation(std::unique_ptr<Life> life)
+    : life_(std::move(life)),
+      stop_(false),
+      paused_(true),
+      delay_ms_(0),
+      x_range_(0, -1),
+      y_range_(0, -1),
+      density_level_(0),
+      back_(0),
+      front_(1),
+      latest_(2),
+      thread_(&Simulation::Loop, this) {
+}
+
+Simulation::~Simulation() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stop_ = true;
+    }
+    wake_.notify_one();
+    thread_.join();
+}
+
+void Simulation::Run(std::function<void(Life*)> fn) {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        commands_.push_back(std::move(fn));
+    }
+    wake_.notify_one();
+}
+
+void Simulation::SetPaused(bool paused) {
+    Run([this, paused](Life* life) { paused_ = paused; });
+}
+
+void Simulation::Step() {
+    Run([](Life* life) { life->Step(); });
+}
+
+void Simulation::SetDelay(int delay_ms) {
+    Run([this, delay_ms](Life* life) { delay_ms_ = delay_ms; });
+}
+
+void Simulation::SetViewport(const Range& x_range, const Range& y_range, int density_level) {
+    Run([this, x_range, y_range, density_level](Life* life) {
+        x_range_ = x_range;
+        y_range_ = y_range;
+        density_level_ = density_level;
+    });
+}
+
+void Simulation::SetStatsEnabled(bool enabled) {
+    Run([enabled](Life* life) { life->set_stats_enabled(enabled); });
+}
+
+const Snapshot& Simulation::LatestSnapshot() {
+    if (latest_.load() & FRESH) {
+        front_ = latest_.exchange(front_) & ~FRESH;
+    }
+    return snapshots_[front_];
+}
+
+void Simulation::Publish() {
+    Snapshot& snapshot = snapshots_[back_];
+    snapshot.generation = life_->generation();
+    snapshot.x_range = x_range_;
+    snapshot.y_range = y_range_;
+    snapshot.has_stats = life_->stats_enabled();
+    if (snapshot.has_stats) {
+        snapshot.stats = life_->stats();
+    }
+    snapshot.density_level = density_level_;
+    snapshot.live_points.clear();
+    snapshot.tiles.clear();
+    if (density_level_ == 0) {
+        life_->ForEachLivePoint(x_range_, y_range_, [&snapshot](int64_t x, int64_t y) {
+            snapshot.live_points.emplace_back(x, y);
+        });
+    } else {
+        class Collector : public DensityVisitor {
+            public:
+            explicit Collector(std::vector<DensityTile>* tiles) : tiles_(tiles) {}
+            void Visit(int64_t x, int64_t y, uint64_t live_cells) override {
+                tiles_->push_back(DensityTile{Point(x, y), live_cells});
+            }
+
+            private:
+            std::vector<DensityTile>* tiles_;
+        } collector(&snapshot.tiles);
+        life_->VisitDensity(density_level_, x_range_, y_range_, &collector);
+    }
+    back_ = latest_.exchange(back_ | FRESH) & ~FRESH;
+}
+
+void Simulation::Loop() {
+    std::vector<std::function<void(Life*)>> commands;
+    auto next_step = std::chrono::steady_clock::now();
+    while (true) {
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            // Sleep until there are commands, or until the next generation is due.
+            auto woken = [this] { return stop_ || !commands_.empty(); };
+            if (paused_) {
+                wake_.wait(lock, woken);
+            } else if (delay_ms_ > 0) {
+                wake_.wait_until(lock, next_step, woken);
+            }
+            if (stop_) {
+                return;
+            }
+            commands.swap(commands_);
+        }
+        bool changed = !commands.empty();
+        for (auto& command : commands) {
+            command(life_.get());
+        }
+        commands.clear();
+
+        auto now = std::chrono::steady_clock::now();
+        if (!paused_ && now >= next_step) {
+            // Running flat out, generations before the reader takes the last snapshot are never
+            // drawn, so advance several of them at once.
+            bool unseen = delay_ms_ == 0 && (latest_.load() & FRESH);
+            life_->Step(unseen ? UNSEEN_STEPS : 1);
+            changed = true;
+            next_step += std::chrono::milliseconds(delay_ms_);
+            if (next_step < now) {
+                next_step = now;
+            }
+        }
+        // Running flat out, only take a snapshot once the reader took the last one, so that
+        // snapshots cost at most one per frame.
+        if (changed && (paused_ || delay_ms_ > 0 || !(latest_.load() & FRESH))) {
+            Publish();
+        }
+    }
+}
+
+}  // namespace conway
@@ -0,0 +1,105 @@
+#ifndef CONWAY_SIMULATION_H
+#define CONWAY_SIMULATION_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "life.h"
+
+namespace conway {
+
+// The live cells of a tile of the snapshot's density level.
+struct DensityTile {
+    Point index;
+    uint64_t live_cells;
+};
+
+// The live points of one generation inside the region it was taken for, or when zoomed out the
+// live cells per tile.
+struct Snapshot {
+    Snapshot() : generation(0), density_level(0), has_stats(false) {}
+
+    int64_t generation;
+    Range x_range;
+    Range y_range;
+    // At level 0 live_points holds the live points, and otherwise tiles the tiles of that level
+    // with live cells, see DensityVisitor.
+    int density_level;
+    std::vector<Point> live_points;
+    std::vector<DensityTile> tiles;
+    // The stats of the last step, while stats are enabled.
+    bool has_stats;
+    StepStats stats;
+};
+
+// Runs a Life on its own thread, either as fast as possible or one generation per delay, so
+// that slow generations never hold up input or drawing. Other threads reach the Life through
+// commands, which run on the simulation thread between generations, and read it through the
+// snapshots the simulation thread publishes.
+class Simulation {
+    public:
+    // Starts paused, with no delay and an empty viewport.
+    explicit Simulation(std::unique_ptr<Life> life);
+    // Stops the simulation thread, dropping commands not yet run.
+    ~Simulation();
+
+    // Queues fn(life) to run on the simulation thread between generations.
+    void Run(std::function<void(Life*)> fn);
+
+    void SetPaused(bool paused);
+    // Advances one generation, e.g. while paused.
+    void Step();
+    // Time between generations. With no delay, generations run back to back.
+    void SetDelay(int delay_ms);
+    // Region of the published snapshots, and the level of their tiles, or 0 for live points.
+    void SetViewport(const Range& x_range, const Range& y_range, int density_level = 0);
+    // Collects StepStats and publishes them with the snapshots.
+    void SetStatsEnabled(bool enabled);
+
+    // Returns the latest published snapshot without waiting for the simulation thread. It
+    // stays unchanged until the next call, which must come from the same thread.
+    const Snapshot& LatestSnapshot();
+
+    private:
+    void Loop();
+    void Publish();
+
+    std::unique_ptr<Life> life_;
+
+    std::mutex mutex_;
+    std::condition_variable wake_;
+    std::vector<std::function<void(Life*)>> commands_;
+    bool stop_;
+
+    // Only used on the simulation thread.
+    bool paused_;
+    int delay_ms_;
+    Range x_range_;
+    Range y_range_;
+    int density_level_;
+
+    // The simulation thread writes snapshots_[back_] and the reader reads snapshots_[front_].
+    // latest_ holds the index of the third, most recently published snapshot, plus FRESH until
+    // the reader takes it. Publishing and taking swap their snapshot with latest_ atomically,
+    // so neither side ever waits for the other.
+    static const int FRESH = 4;
+    // Generations per step while the latest snapshot is still fresh.
+    static const int64_t UNSEEN_STEPS = 16;
+    Snapshot snapshots_[3];
+    int back_;
+    int front_;
+    std::atomic<int> latest_;
+
+    // Last, so that it starts once everything else is initialized.
+    std::thread thread_;
+};
+
+}  // namespace conway
+
+#endif
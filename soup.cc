@@ -0,0 +1,195 @@
+// Headless search through many random soups, or patterns, for what they settle into.
+//
+// Usage: soup [--soups N] [--size N] [--density P] [--seed N] [--threads N]
+//             [--max-generations N] [--rule RULE] [pattern.rle | directory ...]
+//
+// Without patterns, runs --soups random soups of --size x --size cells, each alive with probability
+// --density, where soup i is drawn from seed + i so that any soup can be rerun alone. Directories
+// stand for every .rle file in them. Each soup or pattern runs until it settles, i.e. its
+// population is periodic, every object left repeats on its own and no spaceship is headed for
+// another object, or for at most --max-generations, on one of --threads threads, each of which
+// reuses its engines for all of its soups. Prints a CSV line per soup as soon as it finishes, so in
+// no particular order, with its census of objects by apgcode, and a summary with the census of all
+// soups to stderr. --rule runs every pattern under RULE instead of the rule in its file.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <dirent.h>
+#include <sys/stat.h>
+
+#include "census.h"
+#include "rle.h"
+#include "thread_pool.h"
+
+namespace {
+
+struct Options {
+    Options() : soups(1000), size(16), density(0.5), seed(1), threads(1), max_generations(20000),
+                has_rule(false) {}
+
+    int64_t soups;
+    int size;
+    double density;
+    uint64_t seed;
+    int threads;
+    int64_t max_generations;
+    conway::Rule rule;
+    bool has_rule;
+    std::vector<std::string> patterns;
+};
+
+bool IsDirectory(const std::string& path) {
+    struct stat st;
+    return stat(path.c_str(), &st) == 0 && S_ISDIR(st.st_mode);
+}
+
+std::vector<std::string> ListPatterns(const std::string& dir) {
+    std::vector<std::string> patterns;
+    DIR* d = opendir(dir.c_str());
+    if (d == nullptr) {
+        return patterns;
+    }
+    while (struct dirent* entry = readdir(d)) {
+        std::string name = entry->d_name;
+        if (name.size() > 4 && name.compare(name.size() - 4, 4, ".rle") == 0) {
+            patterns.push_back(dir + "/" + name);
+        }
+    }
+    closedir(d);
+    std::sort(patterns.begin(), patterns.end());
+    return patterns;
+}
+
+void PrintUsage() {
+    std::cerr << "Usage: soup [--soups N] [--size N] [--density P] [--seed N] [--threads N]\n"
+              << "            [--max-generations N] [--rule RULE] [pattern.rle | directory ...]" << std::endl;
+}
+
+bool ParseOptions(int argc, char** argv, Options* options) {
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        bool has_value = i + 1 < argc;
+        if (arg == "--soups" && has_value) {
+            options->soups = std::max<int64_t>(0, std::atoll(argv[++i]));
+        } else if (arg == "--size" && has_value) {
+            options->size = std::max(1, std::atoi(argv[++i]));
+        } else if (arg == "--density" && has_value) {
+            options->density = std::min(1.0, std::max(0.0, std::atof(argv[++i])));
+        } else if (arg == "--seed" && has_value) {
+            options->seed = std::strtoull(argv[++i], nullptr, 10);
+        } else if (arg == "--threads" && has_value) {
+            options->threads = std::max(1, std::atoi(argv[++i]));
+        } else if (arg == "--max-generations" && has_value) {
+            options->max_generations = std::max<int64_t>(1, std::atoll(argv[++i]));
+        } else if (arg == "--rule" && has_value) {
+            // Soups run on the plane.
+            if (!conway::ParseRule(argv[++i], &options->rule)) {
+                return false;
+            }
+            options->has_rule = true;
+        } else if (!arg.empty() && arg[0] != '-') {
+            if (IsDirectory(arg)) {
+                std::vector<std::string> patterns = ListPatterns(arg);
+                options->patterns.insert(options->patterns.end(), patterns.begin(), patterns.end());
+            } else {
+                options->patterns.push_back(arg);
+            }
+        } else {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Adds random cells in a size x size square centered on the origin.
+void AddSoup(uint64_t seed, const Options& options, conway::Life* life) {
+    std::mt19937_64 rng(seed);
+    std::bernoulli_distribution alive(options.density);
+    int64_t corner = -options.size / 2;
+    for (int y = 0; y < options.size; y++) {
+        for (int x = 0; x < options.size; x++) {
+            if (alive(rng)) {
+                life->AddLivePoint(conway::Point(corner + x, corner + y));
+            }
+        }
+    }
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+    Options options;
+    if (!ParseOptions(argc, argv, &options)) {
+        PrintUsage();
+        return 2;
+    }
+    bool random = options.patterns.empty();
+    size_t jobs = random ? static_cast<size_t>(options.soups) : options.patterns.size();
+
+    conway::WorkStealingPool pool(options.threads);
+    std::vector<std::unique_ptr<conway::SoupRunner>> runners;
+    for (int i = 0; i < pool.num_threads(); i++) {
+        runners.emplace_back(new conway::SoupRunner(options.rule, options.max_generations));
+    }
+
+    std::mutex mutex;
+    std::map<std::string, int> total;
+    int64_t stable = 0;
+    int64_t errors = 0;
+    std::cout << "soup,status,generations,population,period,census\n" << std::flush;
+    auto start = std::chrono::steady_clock::now();
+    pool.ParallelFor(jobs, [&](size_t job, int thread) {
+        conway::SoupRunner* runner = runners[thread].get();
+        std::string name;
+        bool loaded = true;
+        if (random) {
+            uint64_t seed = options.seed + job;
+            name = std::to_string(seed);
+            AddSoup(seed, options, runner->life());
+        } else {
+            name = options.patterns[job];
+            loaded = conway::LoadRLE(name, runner->life());
+            if (loaded && options.has_rule) {
+                runner->life()->set_rule(options.rule);
+            }
+        }
+        conway::SoupOutcome outcome;
+        if (loaded) {
+            outcome = runner->Run();
+        } else {
+            runner->Clear();
+        }
+        char line[128];
+        std::snprintf(line, sizeof(line), "%s,%lld,%llu,%lld,", !loaded ? "error" : outcome.stable ? "stable" : "capped",
+                      (long long)outcome.generations, (unsigned long long)outcome.population,
+                      (long long)outcome.period);
+        std::string census = conway::FormatCensus(outcome.census);
+
+        std::lock_guard<std::mutex> lock(mutex);
+        std::cout << name << "," << line << census << "\n" << std::flush;
+        if (!loaded) {
+            errors++;
+            return;
+        }
+        stable += outcome.stable;
+        for (const auto& object : outcome.census) {
+            total[object.first] += object.second;
+        }
+    });
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    std::cerr << jobs << " soups, " << stable << " stable, " << errors << " errors in " << seconds << " s ("
+              << (seconds > 0 ? jobs / seconds * 3600 : 0) << " soups/hour)\n"
+              << conway::FormatCensus(total) << std::endl;
+    return errors == 0 ? 0 : 1;
+}
@@ -0,0 +1,85 @@
+#include "spill.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+namespace conway {
+
+SpillStore::SpillStore() : fd_(-1), end_(0), bytes_(0), free_(MAX_RECORD + 1) {
+    const char* dir = std::getenv("TMPDIR");
+    std::string path = std::string(dir != nullptr && *dir != '\0' ? dir : "/tmp") + "/conway-spill-XXXXXX";
+    std::vector<char> name(path.begin(), path.end());
+    name.push_back('\0');
+    fd_ = mkstemp(name.data());
+    if (fd_ >= 0) {
+        unlink(name.data());
+    }
+}
+
+SpillStore::~SpillStore() {
+    for (char* segment : segments_) {
+        munmap(segment, SEGMENT_SIZE);
+    }
+    if (fd_ >= 0) {
+        close(fd_);
+    }
+}
+
+bool SpillStore::Write(const void* data, size_t size, Handle* handle) {
+    std::vector<uint64_t>& free = free_[size];
+    if (!free.empty()) {
+        handle->offset = free.back();
+        free.pop_back();
+    } else {
+        // Records don't straddle segments.
+        if (end_ % SEGMENT_SIZE + size > SEGMENT_SIZE) {
+            end_ += SEGMENT_SIZE - end_ % SEGMENT_SIZE;
+        }
+        if (end_ + size > file_size() && !Grow()) {
+            return false;
+        }
+        handle->offset = end_;
+        end_ += size;
+    }
+    handle->size = static_cast<uint32_t>(size);
+    memcpy(At(handle->offset), data, size);
+    bytes_ += size;
+    return true;
+}
+
+void SpillStore::Read(const Handle& handle, void* data) const {
+    memcpy(data, At(handle.offset), handle.size);
+}
+
+void SpillStore::Free(const Handle& handle) {
+    free_[handle.size].push_back(handle.offset);
+    bytes_ -= handle.size;
+}
+
+// The mapping is shared, so the data stays in the file and comes back on the next access.
+void SpillStore::Release() {
+    for (char* segment : segments_) {
+        madvise(segment, SEGMENT_SIZE, MADV_DONTNEED);
+    }
+}
+
+bool SpillStore::Grow() {
+    off_t size = static_cast<off_t>(file_size() + SEGMENT_SIZE);
+    if (fd_ < 0 || ftruncate(fd_, size) != 0) {
+        return false;
+    }
+    void* segment = mmap(nullptr, SEGMENT_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd_,
+                         size - static_cast<off_t>(SEGMENT_SIZE));
+    if (segment == MAP_FAILED) {
+        return false;
+    }
+    segments_.push_back(static_cast<char*>(segment));
+    return true;
+}
+
+}  // namespace conway
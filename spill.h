@@ -0,0 +1,63 @@
+#ifndef CONWAY_SPILL_H
+#define CONWAY_SPILL_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace conway {
+
+// Records of up to MAX_RECORD bytes kept in a temporary file mapped into memory, for moving
+// data out of the heap. The file is unlinked as soon as it is created, so it goes away with the
+// process. It grows a segment at a time, so records never move, and freed records are reused
+// by records of the same size. Release gives the pages back to the page cache, so that the
+// records stop counting towards the resident memory of the process until they are read again,
+// and the kernel writes them out to disk as it needs the memory. Not thread-safe.
+class SpillStore {
+    public:
+    static const size_t MAX_RECORD = 4096;
+    static const size_t SEGMENT_SIZE = size_t(16) << 20;
+
+    struct Handle {
+        uint64_t offset;
+        uint32_t size;
+    };
+
+    // Creates the file in $TMPDIR, or /tmp.
+    SpillStore();
+    ~SpillStore();
+
+    bool ok() const { return fd_ >= 0; }
+
+    // Copies size bytes, at most MAX_RECORD, into the store. Returns false if the file couldn't
+    // grow.
+    bool Write(const void* data, size_t size, Handle* handle);
+    void Read(const Handle& handle, void* data) const;
+    void Free(const Handle& handle);
+
+    // Drops the pages of the file from the memory of the process; see above.
+    void Release();
+
+    // Bytes of the records held, and of the file.
+    size_t bytes() const { return bytes_; }
+    size_t file_size() const { return segments_.size() * SEGMENT_SIZE; }
+
+    private:
+    SpillStore(const SpillStore&);
+    SpillStore& operator=(const SpillStore&);
+
+    bool Grow();
+    char* At(uint64_t offset) const { return segments_[offset / SEGMENT_SIZE] + offset % SEGMENT_SIZE; }
+
+    int fd_;
+    std::vector<char*> segments_;
+    // Where records go once no freed record of their size is left.
+    uint64_t end_;
+    size_t bytes_;
+    // Offsets of freed records, by size.
+    std::vector<std::vector<uint64_t>> free_;
+};
+
+}  // namespace conway
+
+#endif
@@ -0,0 +1,73 @@
+#include "stats.h"
+
+#include <cstdio>
+
+namespace conway {
+
+StepStats::StepStats()
+    : generation(0),
+      steps(0),
+      step_seconds(0),
+      live_cells(0),
+      blocks(0),
+      active_blocks(0),
+      blocks_created(0),
+      blocks_destroyed(0),
+      spilled_blocks(0),
+      blocks_evicted(0),
+      blocks_paged_in(0),
+      table_size(0),
+      table_capacity(0),
+      total_probe_length(0),
+      max_probe_length(0),
+      num_phases(0) {
+}
+
+double* StepStats::Phase(const char* name) {
+    for (int i = 0; i < num_phases; i++) {
+        if (phases[i].name == name) {
+            return &phases[i].seconds;
+        }
+    }
+    if (num_phases == MAX_PHASES) {
+        return nullptr;
+    }
+    phases[num_phases] = PhaseTime{name, 0};
+    return &phases[num_phases++].seconds;
+}
+
+std::string FormatStats(const StepStats& stats, char separator) {
+    char buf[512];
+    int n = snprintf(buf, sizeof(buf),
+                     "generation=%lld%csteps=%lld%cstep_ms=%.3f%clive_cells=%llu%cblocks=%llu%c"
+                     "active_blocks=%llu%ccreated=%llu%cdestroyed=%llu%ctable=%zu/%zu%cload=%.2f%c"
+                     "mean_probe=%.2f%cmax_probe=%zu",
+                     static_cast<long long>(stats.generation), separator,
+                     static_cast<long long>(stats.steps), separator,
+                     stats.step_seconds * 1e3, separator,
+                     static_cast<unsigned long long>(stats.live_cells), separator,
+                     static_cast<unsigned long long>(stats.blocks), separator,
+                     static_cast<unsigned long long>(stats.active_blocks), separator,
+                     static_cast<unsigned long long>(stats.blocks_created), separator,
+                     static_cast<unsigned long long>(stats.blocks_destroyed), separator,
+                     stats.table_size, stats.table_capacity, separator,
+                     stats.table_capacity == 0 ? 0.0 : static_cast<double>(stats.table_size) / stats.table_capacity,
+                     separator,
+                     stats.table_size == 0 ? 0.0 : static_cast<double>(stats.total_probe_length) / stats.table_size,
+                     separator, stats.max_probe_length);
+    std::string text(buf, n < static_cast<int>(sizeof(buf)) ? n : sizeof(buf) - 1);
+    if (stats.spilled_blocks != 0 || stats.blocks_evicted != 0 || stats.blocks_paged_in != 0) {
+        snprintf(buf, sizeof(buf), "%cspilled=%llu%cevicted=%llu%cpaged_in=%llu", separator,
+                 static_cast<unsigned long long>(stats.spilled_blocks), separator,
+                 static_cast<unsigned long long>(stats.blocks_evicted), separator,
+                 static_cast<unsigned long long>(stats.blocks_paged_in));
+        text += buf;
+    }
+    for (int i = 0; i < stats.num_phases; i++) {
+        snprintf(buf, sizeof(buf), "%c%s_ms=%.3f", separator, stats.phases[i].name, stats.phases[i].seconds * 1e3);
+        text += buf;
+    }
+    return text;
+}
+
+}  // namespace conway
@@ -0,0 +1,86 @@
+#ifndef CONWAY_STATS_H
+#define CONWAY_STATS_H
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+
+namespace conway {
+
+// Time spent in one phase of a step.
+struct PhaseTime {
+    const char* name;
+    double seconds;
+};
+
+// Counters for the last Step of a Life, collected while stats are enabled. Blocks are whatever
+// the engine stores cells in: blocks for BlockLife and BitBlockLife, nodes for HashLife, and
+// none for LiveLife.
+struct StepStats {
+    StepStats();
+
+    // Generation after the step, and the generations it advanced.
+    int64_t generation;
+    int64_t steps;
+    double step_seconds;
+
+    uint64_t live_cells;
+    // Blocks in use after the step, and blocks computed during it rather than skipped.
+    uint64_t blocks;
+    uint64_t active_blocks;
+    uint64_t blocks_created;
+    uint64_t blocks_destroyed;
+    // Blocks out of memory after the step, for engines that spill blocks to disk, and blocks
+    // the step moved out and back in.
+    uint64_t spilled_blocks;
+    uint64_t blocks_evicted;
+    uint64_t blocks_paged_in;
+
+    // The engine's main hash table, summed over shards. A probe length is how many slots or
+    // chain links past the first a lookup of an entry passes.
+    size_t table_size;
+    size_t table_capacity;
+    size_t total_probe_length;
+    size_t max_probe_length;
+
+    // Phases of the step timed by the engine, in the order they first ran.
+    static const int MAX_PHASES = 4;
+    PhaseTime phases[MAX_PHASES];
+    int num_phases;
+
+    // Returns where to add the time of the named phase, or nullptr once MAX_PHASES phases are
+    // taken. Names are compared by address, so they should be string literals.
+    double* Phase(const char* name);
+};
+
+// One "name=value" field per counter, separated by separator, e.g. ' ' for logging one step
+// per line or '\n' for an overlay. The spill counters only appear once blocks were spilled.
+std::string FormatStats(const StepStats& stats, char separator = ' ');
+
+// Adds the time from construction to destruction to *seconds. Does nothing, not even read the
+// clock, when seconds is null, so timers stay in place when stats are disabled.
+class ScopedTimer {
+    public:
+    explicit ScopedTimer(double* seconds) : seconds_(seconds) {
+        if (seconds_ != nullptr) {
+            start_ = std::chrono::steady_clock::now();
+        }
+    }
+    ~ScopedTimer() { Stop(); }
+
+    // Adds the time so far, ending the timer before the end of its scope.
+    void Stop() {
+        if (seconds_ != nullptr) {
+            *seconds_ += std::chrono::duration<double>(std::chrono::steady_clock::now() - start_).count();
+            seconds_ = nullptr;
+        }
+    }
+
+    private:
+    double* seconds_;
+    std::chrono::steady_clock::time_point start_;
+};
+
+}  // namespace conway
+
+#endif
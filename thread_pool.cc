@@ -0,0 +1,116 @@
+#include "thread_pool.h"
+
+#include <algorithm>
+
+namespace conway {
+
+WorkStealingPool::WorkStealingPool(int num_threads)
+    : num_threads_(std::max(1, num_threads)),
+      queues_(new Queue[std::max(1, num_threads)]),
+      fn_(nullptr),
+      epoch_(0),
+      running_(0),
+      stop_(false) {
+    for (int i = 1; i < num_threads_; i++) {
+        threads_.emplace_back(&WorkStealingPool::WorkerLoop, this, i);
+    }
+}
+
+WorkStealingPool::~WorkStealingPool() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stop_ = true;
+    }
+    start_.notify_all();
+    for (auto& t : threads_) {
+        t.join();
+    }
+}
+
+void WorkStealingPool::ParallelFor(size_t num_tasks, const std::function<void(size_t, int)>& fn) {
+    if (num_threads_ == 1 || num_tasks <= 1) {
+        for (size_t i = 0; i < num_tasks; i++) {
+            fn(i, 0);
+        }
+        return;
+    }
+    for (int i = 0; i < num_threads_; i++) {
+        std::lock_guard<std::mutex> lock(queues_[i].mutex);
+        queues_[i].begin = num_tasks * i / num_threads_;
+        queues_[i].end = num_tasks * (i + 1) / num_threads_;
+    }
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        fn_ = &fn;
+        epoch_++;
+        running_ = num_threads_ - 1;
+    }
+    start_.notify_all();
+    RunTasks(0);
+    std::unique_lock<std::mutex> lock(mutex_);
+    done_.wait(lock, [this] { return running_ == 0; });
+    fn_ = nullptr;
+}
+
+void WorkStealingPool::WorkerLoop(int thread) {
+    uint64_t epoch = 0;
+    while (true) {
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            start_.wait(lock, [this, epoch] { return stop_ || epoch_ != epoch; });
+            if (stop_) {
+                return;
+            }
+            epoch = epoch_;
+        }
+        RunTasks(thread);
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (--running_ == 0) {
+            done_.notify_one();
+        }
+    }
+}
+
+// Tasks are only ever removed from the queues, so once neither this thread's queue nor any
+// other has tasks left, the loop is done for this thread.
+void WorkStealingPool::RunTasks(int thread) {
+    size_t task;
+    while (PopTask(thread, &task) || (StealTasks(thread) && PopTask(thread, &task))) {
+        (*fn_)(task, thread);
+    }
+}
+
+bool WorkStealingPool::PopTask(int thread, size_t* task) {
+    Queue& queue = queues_[thread];
+    std::lock_guard<std::mutex> lock(queue.mutex);
+    if (queue.begin == queue.end) {
+        return false;
+    }
+    *task = queue.begin++;
+    return true;
+}
+
+bool WorkStealingPool::StealTasks(int thread) {
+    for (int i = 1; i < num_threads_; i++) {
+        Queue& victim = queues_[(thread + i) % num_threads_];
+        size_t begin, end;
+        {
+            std::lock_guard<std::mutex> lock(victim.mutex);
+            size_t remaining = victim.end - victim.begin;
+            if (remaining == 0) {
+                continue;
+            }
+            begin = victim.end - (remaining + 1) / 2;
+            end = victim.end;
+            victim.end = begin;
+        }
+        Queue& queue = queues_[thread];
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        queue.begin = begin;
+        queue.end = end;
+        return true;
+    }
+    return false;
+}
+
+}  // namespace conway
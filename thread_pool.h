@@ -0,0 +1,57 @@
+#ifndef CONWAY_THREAD_POOL_H
+#define CONWAY_THREAD_POOL_H
+
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace conway {
+
+// Fixed set of threads running data parallel loops. Tasks start out evenly split between the
+// threads, and a thread which runs out of tasks steals half of the remaining tasks of another
+// thread, so uneven tasks still keep every thread busy.
+class WorkStealingPool {
+    public:
+    // The calling thread takes part in every loop, so this starts num_threads - 1 threads.
+    explicit WorkStealingPool(int num_threads);
+    ~WorkStealingPool();
+
+    int num_threads() const { return num_threads_; }
+
+    // Calls fn(task, thread) for every task in [0, num_tasks) and returns once all of them ran.
+    // thread is in [0, num_threads()) and no two tasks run on the same thread at the same time.
+    void ParallelFor(size_t num_tasks, const std::function<void(size_t, int)>& fn);
+
+    private:
+    // Remaining tasks [begin, end) of one thread.
+    struct Queue {
+        std::mutex mutex;
+        size_t begin;
+        size_t end;
+    };
+
+    void WorkerLoop(int thread);
+    void RunTasks(int thread);
+    bool PopTask(int thread, size_t* task);
+    bool StealTasks(int thread);
+
+    int num_threads_;
+    std::vector<std::thread> threads_;
+    std::unique_ptr<Queue[]> queues_;
+
+    std::mutex mutex_;
+    std::condition_variable start_;
+    std::condition_variable done_;
+    const std::function<void(size_t, int)>* fn_;
+    uint64_t epoch_;
+    int running_;
+    bool stop_;
+};
+
+}  // namespace conway
+
+#endif